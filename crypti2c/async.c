@@ -0,0 +1,170 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "async.h"
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "util.h"
+#include "log.h"
+
+struct ci2c_async
+{
+  struct ci2c_sched *sched;
+  int efd;
+  struct ci2c_mpsc done;
+
+  /* Only touched by the polling thread */
+  uint64_t signaled;
+
+  unsigned int in_flight;
+};
+
+/* Runs on the bus worker thread */
+static void
+async_complete (struct ci2c_job *job, void *arg)
+{
+  struct ci2c_request *req = arg;
+  struct ci2c_async *ctx = req->ctx;
+  uint64_t one = 1;
+
+  ci2c_mpsc_push (&ctx->done, &req->completion);
+
+  /* Only fails if the counter would overflow */
+  if (write (ctx->efd, &one, sizeof (one)) != sizeof (one))
+    CI2C_LOG (SEVERE, "Failed to signal completion: %d", errno);
+}
+
+struct ci2c_async *
+ci2c_async_new (struct ci2c_sched *sched)
+{
+  struct ci2c_async *ctx;
+
+  assert (NULL != sched);
+
+  ctx = (struct ci2c_async *)ci2c_malloc_wipe (sizeof (*ctx));
+
+  if ((ctx->efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+      ci2c_free_wipe ((uint8_t *)ctx, sizeof (*ctx));
+      return NULL;
+    }
+
+  ctx->sched = sched;
+  ci2c_mpsc_init (&ctx->done);
+
+  return ctx;
+}
+
+int
+ci2c_async_fd (const struct ci2c_async *ctx)
+{
+  assert (NULL != ctx);
+
+  return ctx->efd;
+}
+
+int
+ci2c_submit_command (struct ci2c_async *ctx, unsigned int bus,
+                     struct ci2c_request *req)
+{
+  assert (NULL != ctx);
+  assert (NULL != req);
+
+  req->ctx = ctx;
+  req->job.cb = async_complete;
+  req->job.cb_arg = req;
+
+  __atomic_add_fetch (&ctx->in_flight, 1, __ATOMIC_RELAXED);
+
+  if (ci2c_sched_submit (ctx->sched, bus, &req->job) < 0)
+    {
+      __atomic_sub_fetch (&ctx->in_flight, 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+
+  return 0;
+}
+
+unsigned int
+ci2c_poll_completions (struct ci2c_async *ctx,
+                       struct ci2c_request **done,
+                       unsigned int max)
+{
+  struct ci2c_mpsc_node *node;
+  uint64_t count;
+  unsigned int n = 0;
+
+  assert (NULL != ctx);
+  assert (NULL != done || 0 == max);
+
+  if (read (ctx->efd, &count, sizeof (count)) == sizeof (count))
+    ctx->signaled += count;
+
+  while (n < max && ctx->signaled > 0)
+    {
+      /* A signaled completion can sit behind a push that another
+         worker hasn't finished yet */
+      if (NULL == (node = ci2c_mpsc_pop (&ctx->done)))
+        {
+          sched_yield ();
+          continue;
+        }
+
+      ctx->signaled--;
+      done[n++] = CI2C_CONTAINER_OF (node, struct ci2c_request, completion);
+    }
+
+  /* Hand the rest back to the eventfd so it stays readable */
+  if (ctx->signaled > 0)
+    {
+      if (write (ctx->efd, &ctx->signaled, sizeof (ctx->signaled))
+          == sizeof (ctx->signaled))
+        ctx->signaled = 0;
+    }
+
+  __atomic_sub_fetch (&ctx->in_flight, n, __ATOMIC_RELAXED);
+
+  return n;
+}
+
+unsigned int
+ci2c_async_in_flight (const struct ci2c_async *ctx)
+{
+  assert (NULL != ctx);
+
+  return __atomic_load_n (&ctx->in_flight, __ATOMIC_RELAXED);
+}
+
+void
+ci2c_async_free (struct ci2c_async *ctx)
+{
+  assert (NULL != ctx);
+
+  if (0 != ci2c_async_in_flight (ctx))
+    CI2C_LOG (WARNING, "Freeing async context with %u requests in flight",
+              ci2c_async_in_flight (ctx));
+
+  close (ctx->efd);
+  ci2c_free_wipe ((uint8_t *)ctx, sizeof (*ctx));
+}
@@ -0,0 +1,111 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdbool.h>
+#include "scheduler.h"
+
+/**
+ * An asynchronous command.  The caller owns it and fills in
+ * job.addr, job.cmd, job.rsp and job.rsp_len; job.cb must be left
+ * alone.  The request must stay valid until it has been returned by
+ * ci2c_poll_completions.
+ */
+struct ci2c_request
+{
+  struct ci2c_job job;
+  void *user_data;
+
+  /* Internal */
+  struct ci2c_async *ctx;
+  struct ci2c_mpsc_node completion;
+};
+
+struct ci2c_async;
+
+/**
+ * Creates an asynchronous front end on top of a scheduler.
+ *
+ * @param sched The scheduler that runs the commands
+ *
+ * @return The context, NULL on error
+ */
+struct ci2c_async *
+ci2c_async_new (struct ci2c_sched *sched);
+
+/**
+ * Returns the eventfd that becomes readable when completions are
+ * waiting.  Add it to an epoll/poll set and call
+ * ci2c_poll_completions when it fires.  Don't read it directly.
+ *
+ * @param ctx The context
+ */
+int
+ci2c_async_fd (const struct ci2c_async *ctx);
+
+/**
+ * Queues a command on a bus without blocking.
+ *
+ * @param ctx The context
+ * @param bus The scheduler's bus index
+ * @param req The request
+ *
+ * @return 0 on success, -1 if the bus doesn't exist
+ */
+int
+ci2c_submit_command (struct ci2c_async *ctx, unsigned int bus,
+                     struct ci2c_request *req);
+
+/**
+ * Collects finished requests without blocking.  Only one thread may
+ * poll a context.  If more than max are waiting the eventfd stays
+ * readable.
+ *
+ * @param ctx The context
+ * @param done Filled with finished requests
+ * @param max The size of done
+ *
+ * @return The number of requests placed in done
+ */
+unsigned int
+ci2c_poll_completions (struct ci2c_async *ctx,
+                       struct ci2c_request **done,
+                       unsigned int max);
+
+/**
+ * Returns the number of requests submitted but not yet returned by
+ * ci2c_poll_completions.
+ *
+ * @param ctx The context
+ */
+unsigned int
+ci2c_async_in_flight (const struct ci2c_async *ctx);
+
+/**
+ * Frees the context.  Every request must have been collected first.
+ *
+ * @param ctx The context
+ */
+void
+ci2c_async_free (struct ci2c_async *ctx);
+
+#endif /* ASYNC_H */
@@ -0,0 +1,130 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "batch.h"
+#include <assert.h>
+#include <string.h>
+#include "timing.h"
+#include "log.h"
+
+/* The wake window the whole batch asks for up front.  Commands that
+   don't fit in one window are still run, one window at a time. */
+static uint64_t
+batch_need_usec (const struct ci2c_session *s,
+                 const struct ci2c_batch_cmd *cmds, unsigned int n)
+{
+  uint64_t need = 0;
+  uint64_t limit = s->watchdog_usec - s->guard_usec;
+  unsigned int x;
+
+  for (x = 0; x < n && need < limit; x++)
+    need += ci2c_timespec_to_usec (cmds[x].cmd->exec_time);
+
+  return (need < limit) ? need : limit;
+}
+
+unsigned int
+ci2c_session_process_batch (struct ci2c_session *s,
+                            struct ci2c_batch_cmd *cmds,
+                            unsigned int n,
+                            struct ci2c_batch_result *result)
+{
+  struct timespec batch_start, cmd_start, cmd_end;
+  unsigned long wakes;
+  uint64_t wake_usec;
+  unsigned int x;
+  bool failed = false;
+
+  assert (NULL != s);
+  assert (NULL != cmds || 0 == n);
+
+  ci2c_now (&batch_start);
+  wakes = s->wakes;
+  wake_usec = s->wake_usec;
+
+  for (x = 0; x < n; x++)
+    {
+      cmds[x].status = RSP_COMM_ERROR;
+      cmds[x].ran = false;
+      cmds[x].start_usec = 0;
+      cmds[x].elapsed_usec = 0;
+    }
+
+  if (n > 0 &&
+      WAKE_OK != ci2c_session_ensure_awake (s, batch_need_usec (s, cmds, n)))
+    {
+      CI2C_LOG (DEBUG, "Batch aborted, device did not wake");
+      n = 0;
+      failed = true;
+    }
+
+  for (x = 0; x < n; x++)
+    {
+      ci2c_now (&cmd_start);
+
+      cmds[x].ran = true;
+      cmds[x].status = ci2c_session_process_command (s, cmds[x].cmd,
+                                                     cmds[x].rsp,
+                                                     cmds[x].rsp_len);
+      ci2c_now (&cmd_end);
+
+      cmds[x].start_usec = ci2c_timespec_diff_usec (cmd_start, batch_start);
+      cmds[x].elapsed_usec = ci2c_timespec_diff_usec (cmd_end, cmd_start);
+
+      if (RSP_SUCCESS != cmds[x].status)
+        {
+          CI2C_LOG (DEBUG, "Batch stopped at command %u: 0x%02X", x,
+                    cmds[x].status);
+          failed = true;
+          break;
+        }
+    }
+
+  if (NULL != result)
+    {
+      result->completed = x;
+      result->failed = failed;
+      result->wakes = s->wakes - wakes;
+      result->wake_usec = s->wake_usec - wake_usec;
+
+      ci2c_now (&cmd_end);
+      result->total_usec = ci2c_timespec_diff_usec (cmd_end, batch_start);
+    }
+
+  return x;
+}
+
+unsigned int
+ci2c_process_batch (int fd,
+                    struct ci2c_batch_cmd *cmds,
+                    unsigned int n,
+                    struct ci2c_batch_result *result)
+{
+  struct ci2c_session s;
+  unsigned int completed;
+
+  ci2c_session_init (&s, fd);
+
+  completed = ci2c_session_process_batch (&s, cmds, n, result);
+
+  ci2c_session_release (&s, false);
+
+  return completed;
+}
@@ -0,0 +1,90 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command_adaptation.h"
+#include "session.h"
+
+/* One command of a batch */
+struct ci2c_batch_cmd
+{
+  struct Command_ATSHA204 *cmd;
+  uint8_t *rsp;
+  unsigned int rsp_len;
+
+  /* Filled in by the batch */
+  enum CI2C_STATUS_RESPONSE status;
+  bool ran;
+  uint64_t start_usec;          /**< Offset from the start of the batch */
+  uint64_t elapsed_usec;        /**< Send to validated response */
+};
+
+/* What happened to a batch as a whole */
+struct ci2c_batch_result
+{
+  unsigned int completed;       /**< Commands that succeeded */
+  bool failed;                  /**< cmds[completed] failed */
+  unsigned int wakes;           /**< Wakes the batch needed */
+  uint64_t wake_usec;           /**< Time spent waking */
+  uint64_t total_usec;
+};
+
+/**
+ * Runs commands back to back inside an existing session, e.g. Nonce,
+ * GenDig, MAC.  The session is woken once with room for the whole
+ * batch if the watchdog allows it; otherwise it is idled and re-woken
+ * between commands, which keeps TempKey.  The batch stops at the
+ * first command that doesn't return RSP_SUCCESS.  The device is left
+ * awake.
+ *
+ * @param s The session
+ * @param cmds The commands
+ * @param n The number of commands
+ * @param result Filled in with the batch summary.  May be NULL.
+ *
+ * @return The number of commands that succeeded.  n if all did.
+ */
+unsigned int
+ci2c_session_process_batch (struct ci2c_session *s,
+                            struct ci2c_batch_cmd *cmds,
+                            unsigned int n,
+                            struct ci2c_batch_result *result);
+
+/**
+ * Wakes the device, runs a batch and puts the device back to sleep.
+ *
+ * @param fd The open file descriptor with the slave acquired
+ * @param cmds The commands
+ * @param n The number of commands
+ * @param result Filled in with the batch summary.  May be NULL.
+ *
+ * @return The number of commands that succeeded.  n if all did.
+ */
+unsigned int
+ci2c_process_batch (int fd,
+                    struct ci2c_batch_cmd *cmds,
+                    unsigned int n,
+                    struct ci2c_batch_result *result);
+
+#endif /* BATCH_H */
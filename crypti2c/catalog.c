@@ -0,0 +1,235 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "catalog.h"
+#include <assert.h>
+#include "crc.h"
+#include "timing.h"
+#include "transport.h"
+
+#define MSEC(x) ((x) * 1000)
+
+/* Keep in opcode order */
+static const struct ci2c_opcode_info catalog[] =
+  {
+    { CI2C_OP_PAUSE, "Pause", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "0", "selector", 0, 0, 100, 400, MSEC (2), false },
+    { CI2C_OP_READ, "Read", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      4, 32, "zone, bit 7 for a block", "address", 0, 0,
+      100, 400, MSEC (4), false },
+    { CI2C_OP_MAC, "MAC", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      32, 0, "mode", "slot", 0, 32, MSEC (5), MSEC (12), MSEC (35), false },
+    { CI2C_OP_HMAC, "HMAC", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      32, 0, "mode", "slot", 0, 0, MSEC (13), MSEC (27), MSEC (69), false },
+    { CI2C_OP_WRITE, "Write", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "zone, bit 7 for a block", "address", 4, 64,
+      MSEC (1), MSEC (4), MSEC (42), false },
+    { CI2C_OP_GENDIG, "GenDig", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "zone", "slot", 0, 4, MSEC (5), MSEC (11), MSEC (43), true },
+    { CI2C_OP_NONCE, "Nonce", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      32, 1, "mode", "0", 20, 32, MSEC (10), MSEC (22), MSEC (60), false },
+    { CI2C_OP_LOCK, "Lock", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "zone", "summary CRC", 0, 0, MSEC (1), MSEC (5), MSEC (24),
+      true },
+    { CI2C_OP_RANDOM, "Random", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      32, 0, "mode", "0", 0, 0, MSEC (5), MSEC (11), MSEC (50), false },
+    { CI2C_OP_DERIVEKEY, "DeriveKey",
+      CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "random", "target slot", 0, 32, MSEC (5), MSEC (14), MSEC (62),
+      true },
+    { CI2C_OP_UPDATEEXTRA, "UpdateExtra",
+      CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "mode", "value", 0, 0, MSEC (4), MSEC (8), MSEC (12), true },
+    { CI2C_OP_CHECKMAC, "CheckMac", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 0, "mode", "slot", 77, 77, MSEC (5), MSEC (12), MSEC (38), false },
+    { CI2C_OP_DEVREV, "DevRev", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      4, 0, "0", "0", 0, 0, 100, 400, MSEC (2), false },
+    { CI2C_OP_GENKEY, "GenKey", CI2C_FAMILY_ECC108,
+      64, 1, "mode", "slot", 0, 3, MSEC (11), MSEC (85), MSEC (115), true },
+    { CI2C_OP_SIGN, "Sign", CI2C_FAMILY_ECC108,
+      64, 0, "mode", "slot", 0, 0, MSEC (11), MSEC (38), MSEC (60), false },
+    { CI2C_OP_VERIFY, "Verify", CI2C_FAMILY_ECC108,
+      1, 0, "mode", "key slot or type", 64, 128,
+      MSEC (11), MSEC (43), MSEC (72), false },
+    { CI2C_OP_PRIVWRITE, "PrivWrite", CI2C_FAMILY_ECC108,
+      1, 0, "encrypted", "slot", 36, 68, MSEC (1), MSEC (24), MSEC (48),
+      true },
+    { CI2C_OP_SHA, "SHA", CI2C_FAMILY_ATSHA204 | CI2C_FAMILY_ECC108,
+      1, 32, "mode", "0", 0, 64, 100, MSEC (9), MSEC (22), false }
+  };
+
+#define CATALOG_LEN (sizeof (catalog) / sizeof (catalog[0]))
+
+/* Frames as serialized by ci2c_serialize_command_into; checked by
+   ci2c_catalog_self_test */
+static const uint8_t frame_random[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_RANDOM, 0x00, 0x00, 0x00,
+    0x24, 0xCD };
+
+static const uint8_t frame_random_no_seed[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_RANDOM, 0x01, 0x00, 0x00,
+    0x27, 0x47 };
+
+static const uint8_t frame_devrev[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_DEVREV, 0x00, 0x00, 0x00,
+    0x03, 0x5D };
+
+static const uint8_t frame_read_serial_lo[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_READ, 0x00, 0x00, 0x00,
+    0x1E, 0x2D };
+
+static const uint8_t frame_read_serial_hi[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_READ, 0x00, 0x02, 0x00,
+    0x18, 0xAD };
+
+static const uint8_t frame_read_config_0[] =
+  { CI2C_WORD_ADDR_COMMAND, 0x07, CI2C_OP_READ, CI2C_ZONE_BLOCK, 0x00, 0x00,
+    0x09, 0xAD };
+
+#define PREBUILT(f, op, len) { f, sizeof (f), op, len }
+
+static const struct ci2c_prebuilt prebuilt[PREBUILT_COUNT] =
+  {
+    [PREBUILT_RANDOM] = PREBUILT (frame_random, CI2C_OP_RANDOM, 32),
+    [PREBUILT_RANDOM_NO_SEED] = PREBUILT (frame_random_no_seed,
+                                          CI2C_OP_RANDOM, 32),
+    [PREBUILT_DEVREV] = PREBUILT (frame_devrev, CI2C_OP_DEVREV, 4),
+    [PREBUILT_READ_SERIAL_LO] = PREBUILT (frame_read_serial_lo,
+                                          CI2C_OP_READ, 4),
+    [PREBUILT_READ_SERIAL_HI] = PREBUILT (frame_read_serial_hi,
+                                          CI2C_OP_READ, 4),
+    [PREBUILT_READ_CONFIG_0] = PREBUILT (frame_read_config_0,
+                                         CI2C_OP_READ, 32)
+  };
+
+const struct ci2c_opcode_info *
+ci2c_catalog_lookup (uint8_t opcode)
+{
+  unsigned int lo = 0;
+  unsigned int hi = CATALOG_LEN;
+  unsigned int mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+
+      if (catalog[mid].opcode == opcode)
+        return &catalog[mid];
+      else if (catalog[mid].opcode < opcode)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+const struct ci2c_opcode_info *
+ci2c_catalog (unsigned int *count)
+{
+  assert (NULL != count);
+
+  *count = CATALOG_LEN;
+
+  return catalog;
+}
+
+int
+ci2c_command_init (struct Command_ATSHA204 *c, uint8_t opcode,
+                   uint8_t param1, uint16_t param2,
+                   uint8_t *data, unsigned int data_len)
+{
+  const struct ci2c_opcode_info *info = ci2c_catalog_lookup (opcode);
+
+  assert (NULL != c);
+  assert (NULL != data || 0 == data_len);
+
+  if (NULL == info || data_len < info->data_min || data_len > info->data_max)
+    return -1;
+
+  c->command = CI2C_WORD_ADDR_COMMAND;
+  c->count = 0;
+  c->opcode = opcode;
+  c->param1 = param1;
+  c->param2[0] = param2 & 0xFF;
+  c->param2[1] = param2 >> 8;
+  c->data = data;
+  c->data_len = data_len;
+  c->exec_time = ci2c_usec_to_timespec (info->max_usec);
+
+  return 0;
+}
+
+const struct ci2c_prebuilt *
+ci2c_prebuilt_get (enum CI2C_PREBUILT which)
+{
+  if (which >= PREBUILT_COUNT)
+    return NULL;
+
+  return &prebuilt[which];
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_process_prebuilt (int fd, enum CI2C_PREBUILT which,
+                       uint8_t *rsp, unsigned int rsp_len)
+{
+  const struct ci2c_prebuilt *p = ci2c_prebuilt_get (which);
+  struct timespec wait;
+
+  assert (NULL != rsp);
+
+  if (NULL == p || rsp_len < p->rsp_len)
+    return RSP_PARSE_ERROR;
+
+  wait = ci2c_usec_to_timespec (ci2c_catalog_lookup (p->opcode)->max_usec);
+
+  return ci2c_send_and_receive (fd, p->frame, p->len,
+                                rsp, p->rsp_len, &wait);
+}
+
+bool
+ci2c_catalog_self_test (void)
+{
+  unsigned int x;
+  const struct ci2c_prebuilt *p;
+  uint16_t crc;
+
+  for (x = 1; x < CATALOG_LEN; x++)
+    if (catalog[x - 1].opcode >= catalog[x].opcode)
+      return false;
+
+  for (x = 0; x < PREBUILT_COUNT; x++)
+    {
+      p = &prebuilt[x];
+
+      if (p->frame[0] != CI2C_WORD_ADDR_COMMAND || p->frame[1] != p->len - 1
+          || p->frame[CI2C_OPCODE_OFFSET] != p->opcode
+          || NULL == ci2c_catalog_lookup (p->opcode))
+        return false;
+
+      crc = ci2c_calculate_crc16 (&p->frame[1], p->len - 3);
+
+      if (p->frame[p->len - 2] != (crc & 0xFF)
+          || p->frame[p->len - 1] != (crc >> 8))
+        return false;
+    }
+
+  return true;
+}
@@ -0,0 +1,181 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command_adaptation.h"
+
+/* Opcodes of the ATSHA204 and ECC108 command sets */
+#define CI2C_OP_PAUSE 0x01
+#define CI2C_OP_READ 0x02
+#define CI2C_OP_MAC 0x08
+#define CI2C_OP_HMAC 0x11
+#define CI2C_OP_WRITE 0x12
+#define CI2C_OP_GENDIG 0x15
+#define CI2C_OP_NONCE 0x16
+#define CI2C_OP_LOCK 0x17
+#define CI2C_OP_RANDOM 0x1B
+#define CI2C_OP_DERIVEKEY 0x1C
+#define CI2C_OP_UPDATEEXTRA 0x20
+#define CI2C_OP_CHECKMAC 0x28
+#define CI2C_OP_DEVREV 0x30
+#define CI2C_OP_GENKEY 0x40
+#define CI2C_OP_SIGN 0x41
+#define CI2C_OP_VERIFY 0x45
+#define CI2C_OP_PRIVWRITE 0x46
+#define CI2C_OP_SHA 0x47
+
+/* Which devices implement an opcode */
+#define CI2C_FAMILY_ATSHA204 0x01
+#define CI2C_FAMILY_ECC108 0x02
+
+/* Set in Read/Write param1 to move a 32 byte block instead of a word */
+#define CI2C_ZONE_BLOCK 0x80
+
+/* Zones, as in Read/Write param1 */
+#define CI2C_ZONE_CONFIG 0
+#define CI2C_ZONE_OTP 1
+#define CI2C_ZONE_DATA 2
+
+/* A word and a block, the two Read/Write sizes */
+#define CI2C_WORD_LEN 4
+#define CI2C_BLOCK_LEN 32
+
+/**
+ * Static description of one opcode.  Times are per the datasheets;
+ * max is what the device guarantees and is used as the command's
+ * exec_time.
+ */
+struct ci2c_opcode_info
+{
+  uint8_t opcode;
+  const char *name;
+  unsigned int families;        /**< CI2C_FAMILY_* mask */
+  unsigned int rsp_len;         /**< Payload length in the basic mode */
+  unsigned int rsp_len_alt;     /**< In the alternate mode, e.g. a 32 byte
+                                   Read, 0 if there is none */
+  const char *param1;           /**< What param1 selects */
+  const char *param2;           /**< What param2 selects */
+  unsigned int data_min;        /**< Data bytes accepted */
+  unsigned int data_max;
+  unsigned int min_usec;
+  unsigned int typ_usec;
+  unsigned int max_usec;
+  bool once;                    /**< Has effects that would repeat if it
+                                   were resent, so it gets one attempt
+                                   by default */
+};
+
+/**
+ * Looks up an opcode.
+ *
+ * @param opcode The opcode
+ *
+ * @return The description or NULL if the opcode is unknown
+ */
+const struct ci2c_opcode_info *
+ci2c_catalog_lookup (uint8_t opcode);
+
+/**
+ * Returns the catalog and its length, for iteration.
+ *
+ * @param count Set to the number of entries
+ */
+const struct ci2c_opcode_info *
+ci2c_catalog (unsigned int *count);
+
+/**
+ * Fills in a command from the catalog, including its exec_time.
+ *
+ * @param c The command
+ * @param opcode The opcode
+ * @param param1 Param1
+ * @param param2 Param2, sent little endian
+ * @param data The data, may be NULL if data_len is 0
+ * @param data_len The data length
+ *
+ * @return 0 on success, -1 if the opcode is unknown or the data
+ * length is out of range
+ */
+int
+ci2c_command_init (struct Command_ATSHA204 *c, uint8_t opcode,
+                   uint8_t param1, uint16_t param2,
+                   uint8_t *data, unsigned int data_len);
+
+/* Commands whose bytes never change, sent from ready-made frames */
+enum CI2C_PREBUILT
+  {
+    PREBUILT_RANDOM = 0,        /**< Random, updating the seed */
+    PREBUILT_RANDOM_NO_SEED,    /**< Random, leaving the seed alone */
+    PREBUILT_DEVREV,            /**< DevRev */
+    PREBUILT_READ_SERIAL_LO,    /**< Config word 0, SN[0:3] */
+    PREBUILT_READ_SERIAL_HI,    /**< Config word 2, SN[4:7] */
+    PREBUILT_READ_CONFIG_0,     /**< Config block 0 */
+    PREBUILT_COUNT
+  };
+
+/* A CRC-stamped wire frame, word address included */
+struct ci2c_prebuilt
+{
+  const uint8_t *frame;
+  unsigned int len;
+  uint8_t opcode;
+  unsigned int rsp_len;
+};
+
+/**
+ * Returns a prebuilt frame.
+ *
+ * @param which The command
+ *
+ * @return The frame or NULL if which is out of range
+ */
+const struct ci2c_prebuilt *
+ci2c_prebuilt_get (enum CI2C_PREBUILT which);
+
+/**
+ * Sends a prebuilt command.  There is nothing to serialize and no CRC
+ * to compute; the frame goes straight from read only memory to the
+ * bus.
+ *
+ * @param fd The open file descriptor
+ * @param which The command
+ * @param rsp The response buffer
+ * @param rsp_len Its length, at least the command's response length
+ *
+ * @return The response status, RSP_PARSE_ERROR if which or rsp_len
+ * is out of range
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_process_prebuilt (int fd, enum CI2C_PREBUILT which,
+                       uint8_t *rsp, unsigned int rsp_len);
+
+/**
+ * Checks the prebuilt frames against the CRC routine.
+ *
+ * @return True if every frame carries the right count and CRC
+ */
+bool
+ci2c_catalog_self_test (void);
+
+#endif /* CATALOG_H */
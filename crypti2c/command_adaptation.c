@@ -28,6 +28,9 @@
 #include <assert.h>
 #include "util.h"
 #include "log.h"
+#include "timing.h"
+#include "exec_model.h"
+#include "retry.h"
 
 const char*
 status_to_string (enum CI2C_STATUS_RESPONSE rsp)
@@ -45,6 +48,9 @@ status_to_string (enum CI2C_STATUS_RESPONSE rsp)
     case RSP_PARSE_ERROR:
       rsp_string = "Response Parse Error";
       break;
+    case ECC_FAULT:
+      rsp_string = "Response ECC Fault";
+      break;
     case RSP_EXECUTION_ERROR:
       rsp_string = "Response Execution Error";
       break;
@@ -54,6 +60,12 @@ status_to_string (enum CI2C_STATUS_RESPONSE rsp)
     case RSP_COMM_ERROR:
       rsp_string = "Response Communication Error";
       break;
+    case RSP_TIMEOUT:
+      rsp_string = "Response Timeout";
+      break;
+    case RSP_CANCELLED:
+      rsp_string = "Response Cancelled";
+      break;
     case RSP_NAK:
       rsp_string = "Response NAK";
       break;
@@ -66,30 +78,89 @@ status_to_string (enum CI2C_STATUS_RESPONSE rsp)
 }
 
 
-enum CI2C_STATUS_RESPONSE
-ci2c_process_command (int fd, struct Command_ATSHA204 *c,
-                      uint8_t* rec_buf, unsigned int recv_len)
+static void
+print_command (const struct Command_ATSHA204 *c)
 {
-  unsigned int c_len = 0;
-  uint8_t *serialized;
+  CI2C_LOG (DEBUG, "*** Printing Command ***");
+  CI2C_LOG (DEBUG, "Command: 0x%02X", c->command);
+  CI2C_LOG (DEBUG, "Count: 0x%02X", c->count);
+  CI2C_LOG (DEBUG, "OpCode: 0x%02X", c->opcode);
+  CI2C_LOG (DEBUG, "param1: 0x%02X", c->param1);
+  CI2C_LOG (DEBUG, "param2: 0x%02X 0x%02X", c->param2[0], c->param2[1]);
+
+  if (c->data_len > 0)
+    ci2c_print_hex_string ("Data", c->data, c->data_len);
+
+  CI2C_LOG (DEBUG, "*** End Printing Command ***");
+}
+
+static enum CI2C_STATUS_RESPONSE
+process_frame (int fd, struct Command_ATSHA204 *c, struct ci2c_frame *frame,
+               uint8_t* rec_buf, unsigned int recv_len,
+               const struct ci2c_deadline *d)
+{
+  enum CI2C_STATUS_RESPONSE rsp;
 
   assert (NULL != c);
+  assert (NULL != frame);
   assert (NULL != rec_buf);
 
-  c_len = ci2c_serialize_command (c, &serialized);
+  frame->len = ci2c_serialize_command_into (c, frame->buf,
+                                            sizeof (frame->buf));
+
+  if (0 == frame->len)
+    {
+      CI2C_LOG (SEVERE, "Command too large: %u data bytes", c->data_len);
+      return RSP_PARSE_ERROR;
+    }
 
-  enum CI2C_STATUS_RESPONSE rsp = ci2c_send_and_receive (fd,
-                                                         serialized,
-                                                         c_len,
-                                                         rec_buf,
-                                                         recv_len,
-                                                         &c->exec_time);
+  rsp = ci2c_send_and_receive_until (fd, frame->buf, frame->len,
+                                     rec_buf, recv_len, &c->exec_time, d);
 
-  ci2c_free_wipe (serialized, c_len);
+  /* Data may be key material */
+  ci2c_wipe (frame->buf, frame->len);
 
   return rsp;
+}
 
+enum CI2C_STATUS_RESPONSE
+ci2c_process_command (int fd, struct Command_ATSHA204 *c,
+                      uint8_t* rec_buf, unsigned int recv_len)
+{
+  return ci2c_process_command_until (fd, c, rec_buf, recv_len, NULL);
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_process_command_until (int fd, struct Command_ATSHA204 *c,
+                            uint8_t* rec_buf, unsigned int recv_len,
+                            const struct ci2c_deadline *d)
+{
+  struct ci2c_frame frame;
 
+  return process_frame (fd, c, &frame, rec_buf, recv_len, d);
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_process_command_frame (int fd, struct Command_ATSHA204 *c,
+                            struct ci2c_frame *frame,
+                            uint8_t* rec_buf, unsigned int recv_len)
+{
+  return process_frame (fd, c, frame, rec_buf, recv_len, NULL);
+}
+
+/* What a command returns when its deadline stops it */
+static enum CI2C_STATUS_RESPONSE
+deadline_response (enum CI2C_DEADLINE_STATE state)
+{
+  return (DEADLINE_CANCELLED == state) ? RSP_CANCELLED : RSP_TIMEOUT;
+}
+
+/* Waits until wait after from, never past the deadline */
+static enum CI2C_DEADLINE_STATE
+wait_within (const struct ci2c_deadline *d, struct timespec from,
+             struct timespec wait)
+{
+  return ci2c_deadline_wait_until (d, ci2c_timespec_add (from, wait));
 }
 
 enum CI2C_STATUS_RESPONSE
@@ -100,81 +171,270 @@ ci2c_send_and_receive (int fd,
                        unsigned int recv_buf_len,
                        struct timespec *wait_time)
 {
-  struct timespec tim_rem;
-  enum CI2C_STATUS_RESPONSE rsp = RSP_AWAKE;
-  const unsigned int NUM_RETRIES = 10;
-  unsigned int x = 0;
+  return ci2c_send_and_receive_until (fd, send_buf, send_buf_len,
+                                      recv_buf, recv_buf_len, wait_time,
+                                      NULL);
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_send_and_receive_until (int fd,
+                             const uint8_t *send_buf,
+                             unsigned int send_buf_len,
+                             uint8_t *recv_buf,
+                             unsigned int recv_buf_len,
+                             struct timespec *wait_time,
+                             const struct ci2c_deadline *d)
+{
+  struct timespec first_wait, poll_wait, sent_at, done_at, now;
+  struct ci2c_retry_policy policy;
+  struct ci2c_wake_result wake;
+  struct ci2c_deadline dl;
+  enum CI2C_DEADLINE_STATE state;
+  enum CI2C_STATUS_RESPONSE rsp = RSP_COMM_ERROR;
+  unsigned int attempt = 0;
+  unsigned int polls = 0;
   ssize_t result = 0;
+  bool combined = false;
+  bool learn = false;
+  bool rewake = false;
+  int addr = -1;
+  uint8_t opcode = 0;
+  uint8_t rsp_frame[CI2C_MAX_FRAME_LEN];
+  unsigned int rsp_frame_len = recv_buf_len + CI2C_RSP_OVERHEAD;
 
   assert (NULL != send_buf);
   assert (NULL != recv_buf);
   assert (NULL != wait_time);
 
-  /* Send the data at first.  During a read, if the device responds
-  with an "I'm Awake" flag, we've lost synchronization, so send the
-  data again in that case only.  Arbitrarily retry this procedure
-  NUM_RETRIES times */
-  for (x=0; x < NUM_RETRIES && rsp == RSP_AWAKE; x++)
+  first_wait = *wait_time;
+  poll_wait = *wait_time;
+
+  if (send_buf_len > CI2C_OPCODE_OFFSET)
+    opcode = send_buf[CI2C_OPCODE_OFFSET];
+
+  ci2c_retry_policy_for (opcode, &policy);
+
+  /* The policy's limit applies within the caller's budget */
+  if (NULL != d)
+    dl = *d;
+  else
+    ci2c_deadline_init (&dl, 0, NULL);
+
+  if (policy.deadline_usec > 0)
+    ci2c_deadline_tighten (&dl, policy.deadline_usec);
+
+  CI2C_RETRY_COUNT (commands);
+
+  /* With the model on, wait out roughly the learned execution time
+     once and then poll quickly, instead of sleeping the caller's
+     worst case before every read */
+  if (ci2c_exec_model_enabled () && send_buf_len > CI2C_OPCODE_OFFSET)
     {
-      ci2c_print_hex_string ("Sending", send_buf, send_buf_len);
+      learn = true;
+      addr = ci2c_transport_addr (fd);
+      first_wait = ci2c_usec_to_timespec
+        (ci2c_exec_model_first_wait (fd, addr, opcode,
+                                     ci2c_timespec_to_usec (*wait_time)));
+      poll_wait = ci2c_usec_to_timespec (ci2c_exec_model_poll_usec ());
+    }
 
-      result = ci2c_write (fd,
-                           send_buf,
-                           send_buf_len);
+  if (0 == first_wait.tv_sec && 0 == first_wait.tv_nsec
+      && rsp_frame_len <= sizeof (rsp_frame))
+    combined = ci2c_has_combined_transfer (fd);
 
-      if (result > 1)
+  /* Send the command and collect the response.  If the device answers
+     with an "I'm Awake" flag we've lost synchronization, and if the
+     response or the write is corrupted the command may not have been
+     seen; send it again in those cases, as the retry policy allows. */
+  for (attempt = 0; attempt < policy.max_attempts; attempt++)
+    {
+      if (attempt > 0)
         {
-          do
+          CI2C_RETRY_COUNT (resends);
+          ci2c_now (&now);
+          state = wait_within (&dl, now, ci2c_usec_to_timespec
+                               (ci2c_retry_backoff_usec (&policy, attempt)));
+
+          if (DEADLINE_OK != state)
             {
-              nanosleep (wait_time , &tim_rem);
+              rsp = deadline_response (state);
+              break;
             }
-          while ((rsp = ci2c_read_and_validate (fd, recv_buf, recv_buf_len))
-                 == RSP_NAK);
-          CI2C_LOG (DEBUG, "Command Response: %s", status_to_string (rsp));
+
+          if (rewake)
+            {
+              CI2C_RETRY_COUNT (rewakes);
+              ci2c_wakeup_until (fd, NULL, &dl, &wake);
+              CI2C_LOG (DEBUG, "Re-wake: %s",
+                        ci2c_wake_status_to_string (wake.status));
+              rewake = false;
+            }
+        }
+
+      if (DEADLINE_OK != (state = ci2c_deadline_check (&dl)))
+        {
+          rsp = deadline_response (state);
+          break;
+        }
+
+      ci2c_print_hex_string ("Sending", send_buf, send_buf_len);
+
+      if (combined)
+        {
+          /* No execution time to wait out: send the frame and read
+             the reply in one transaction.  The kernel fails the whole
+             transfer if either message is NAKed, so a failure may
+             mean the frame never arrived; resend it like a failed
+             write. */
+          ci2c_now (&sent_at);
+          result = ci2c_write_read (fd, send_buf, send_buf_len,
+                                    rsp_frame, rsp_frame_len);
+
+          if (result < 0)
+            {
+              CI2C_LOG (WARNING, "Combined transfer failed");
+              CI2C_RETRY_COUNT (write_failures);
+              rsp = RSP_COMM_ERROR;
+              rewake = policy.rewake;
+              continue;
+            }
+
+          rsp = (result > 0) ?
+            ci2c_validate_response (rsp_frame, result,
+                                    recv_buf, recv_buf_len) : RSP_NAK;
         }
       else
         {
-          perror ("Send failed\n");
-          exit (1);
+          result = ci2c_write (fd,
+                               send_buf,
+                               send_buf_len);
+
+          if (result <= 1)
+            {
+              CI2C_LOG (WARNING, "Send failed");
+              CI2C_RETRY_COUNT (write_failures);
+              rsp = RSP_COMM_ERROR;
+              rewake = policy.rewake;
+              continue;
+            }
+
+          ci2c_now (&sent_at);
+
+          /* The device runs the command to completion whatever
+             happens here */
+          if (DEADLINE_OK != (state = wait_within (&dl, sent_at, first_wait)))
+            {
+              rsp = deadline_response (state);
+              break;
+            }
+
+          rsp = ci2c_read_and_validate (fd, recv_buf, recv_buf_len);
+        }
+
+      for (polls = 0; RSP_NAK == rsp; polls++)
+        {
+          if (policy.max_polls > 0 && polls >= policy.max_polls)
+            {
+              rsp = RSP_TIMEOUT;
+              break;
+            }
+
+          CI2C_RETRY_COUNT (polls);
+          ci2c_now (&now);
+
+          if (DEADLINE_OK != (state = wait_within (&dl, now, poll_wait)))
+            {
+              rsp = deadline_response (state);
+              break;
+            }
+
+          rsp = ci2c_read_and_validate (fd, recv_buf, recv_buf_len);
         }
 
+      CI2C_LOG (DEBUG, "Command Response: %s", status_to_string (rsp));
 
+      if (learn && RSP_AWAKE != rsp && RSP_COMM_ERROR != rsp
+          && RSP_TIMEOUT != rsp && RSP_CANCELLED != rsp)
+        {
+          ci2c_now (&done_at);
+          ci2c_exec_model_record (fd, addr, opcode,
+                                  ci2c_timespec_diff_usec (done_at, sent_at));
+        }
+
+      if (RSP_AWAKE == rsp)
+        CI2C_RETRY_COUNT (resyncs);
+      else if (RSP_COMM_ERROR == rsp)
+        {
+          CI2C_RETRY_COUNT (crc_failures);
+          rewake = policy.rewake;
+        }
+      else
+        break;
     }
 
+  if (RSP_TIMEOUT == rsp)
+    CI2C_RETRY_COUNT (timeouts);
+
+  if (combined)
+    ci2c_wipe (rsp_frame, rsp_frame_len);
+
   return rsp;
 }
 
 unsigned int
 ci2c_serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized)
+{
+  uint8_t frame[CI2C_MAX_FRAME_LEN];
+  unsigned int total_len;
+
+  assert (NULL != c);
+  assert (NULL != serialized);
+
+  total_len = ci2c_serialize_command_into (c, frame, sizeof (frame));
+
+  assert (0 != total_len);
+
+  *serialized = ci2c_malloc_wipe (total_len);
+  memcpy (*serialized, frame, total_len);
+  ci2c_wipe (frame, total_len);
+
+  return total_len;
+
+}
+
+unsigned int
+ci2c_serialize_command_into (struct Command_ATSHA204 *c,
+                             uint8_t *data, unsigned int max_len)
 {
   unsigned int total_len = 0;
   unsigned int crc_len = 0;
   unsigned int crc_offset = 0;
-  uint8_t *data;
-  uint16_t *crc;
-
+  uint16_t crc;
 
   assert (NULL != c);
-  assert (NULL != serialized);
+  assert (NULL != data);
 
   total_len = sizeof (c->command) + sizeof (c->count) +sizeof (c->opcode) +
     sizeof (c->param1) + sizeof (c->param2) + c->data_len + sizeof (c->checksum);
 
+  /* The count byte covers everything but the word address */
+  if (total_len > max_len || total_len - sizeof (c->command) > UINT8_MAX)
+    return 0;
+
   crc_len = total_len - sizeof (c->command) - sizeof (c->checksum);
 
   crc_offset = total_len - sizeof (c->checksum);
 
   c->count = total_len - sizeof (c->command);
 
-  data = (uint8_t*)malloc (total_len);
-
-  assert (NULL != data);
-
-  print_command (c);
+  if (ci2c_is_debug ())
+    {
+      print_command (c);
 
-  CI2C_LOG (DEBUG,
-           "Total len: %d, count: %d, CRC_LEN: %d, CRC_OFFSET: %d\n",
-           total_len, c->count, crc_len, crc_offset);
+      CI2C_LOG (DEBUG,
+                "Total len: %d, count: %d, CRC_LEN: %d, CRC_OFFSET: %d\n",
+                total_len, c->count, crc_len, crc_offset);
+    }
 
   /* copy over the command */
   data[0] = c->command;
@@ -186,72 +446,77 @@ ci2c_serialize_command (struct Command_ATSHA204 *c, uint8_t **serialized)
   if (c->data_len > 0)
     memcpy (&data[6], c->data, c->data_len);
 
-  crc = (uint16_t *)&data[crc_offset];
-  *crc = ci2c_calculate_crc16 (&data[1], crc_len);
-
-  *serialized = data;
+  crc = ci2c_calculate_crc16 (&data[1], crc_len);
+  memcpy (&data[crc_offset], &crc, sizeof (crc));
 
   return total_len;
 
 }
 
-enum CI2C_STATUS_RESPONSE
-ci2c_read_and_validate (int fd, uint8_t *buf, unsigned int len)
+static enum CI2C_STATUS_RESPONSE
+get_status_response (const uint8_t *rsp)
 {
+  enum CI2C_STATUS_RESPONSE status;
 
-  uint8_t* tmp = NULL;
-  const int PAYLOAD_LEN_SIZE = 1;
-  const int CRC_SIZE = 2;
-  enum CI2C_STATUS_RESPONSE status = RSP_COMM_ERROR;
-  unsigned int recv_buf_len = 0;
-  bool crc_valid;
-  unsigned int crc_offset;
-  int read_bytes;
-  const unsigned int STATUS_RSP = 4;
-
-  assert (NULL != buf);
-
-  recv_buf_len = len + PAYLOAD_LEN_SIZE + CRC_SIZE;
+  switch (rsp[1])
+    {
+    case RSP_SUCCESS:
+    case RSP_CHECKMAC_MISCOMPARE:
+    case RSP_PARSE_ERROR:
+    case ECC_FAULT:
+    case RSP_EXECUTION_ERROR:
+    case RSP_AWAKE:
+    case RSP_COMM_ERROR:
+      status = (enum CI2C_STATUS_RESPONSE)rsp[1];
+      break;
+    default:
+      CI2C_LOG (WARNING, "Unknown status 0x%02X", rsp[1]);
+      status = RSP_COMM_ERROR;
+    }
 
-  crc_offset = recv_buf_len - 2;
+  return status;
+}
 
-  /* The buffer that comes back has a length byte at the front and a
-   * two byte crc at the end. */
-  tmp = ci2c_malloc_wipe (recv_buf_len);
+enum CI2C_STATUS_RESPONSE
+ci2c_check_response (const uint8_t *frame, ssize_t read_bytes,
+                     unsigned int len,
+                     const uint8_t **payload, unsigned int *payload_len)
+{
+  enum CI2C_STATUS_RESPONSE status = RSP_COMM_ERROR;
+  const unsigned int recv_buf_len = len + CI2C_RSP_OVERHEAD;
+  const unsigned int crc_offset = recv_buf_len - CI2C_CRC_16_LEN;
+  const unsigned int STATUS_RSP = 4;
+  const uint8_t *view = NULL;
+  unsigned int view_len = 0;
 
-  read_bytes = ci2c_read (fd, tmp, recv_buf_len);
+  assert (NULL != frame);
 
   /* First Case: We've read the buffer and it's a status packet */
 
-  if (read_bytes == recv_buf_len && tmp[0] == STATUS_RSP)
+  if (read_bytes == recv_buf_len && frame[0] == STATUS_RSP)
   {
-      ci2c_print_hex_string ("Status RSP", tmp, STATUS_RSP);
-      status = get_status_response (tmp);
+      ci2c_print_hex_string ("Status RSP", frame, STATUS_RSP);
+      status = get_status_response (frame);
       CI2C_LOG (DEBUG, status_to_string (status));
-      CI2C_LOG (DEBUG, "Copying %d into buf", tmp[1]);
-      memcpy (buf, &tmp[1], 1);
-
+      view = &frame[1];
+      view_len = 1;
   }
 
   /* Second case: We received the expected message length */
-  else if (read_bytes == recv_buf_len && tmp[0] == recv_buf_len)
+  else if (read_bytes == recv_buf_len && frame[0] == recv_buf_len)
     {
-      ci2c_print_hex_string ("Received RSP", tmp, recv_buf_len);
+      ci2c_print_hex_string ("Received RSP", frame, recv_buf_len);
 
-      crc_valid = ci2c_is_crc_16_valid (tmp,
-                                        recv_buf_len - CI2C_CRC_16_LEN,
-                                        tmp + crc_offset);
-
-      if (true == crc_valid)
+      if (ci2c_is_crc_16_valid (frame, recv_buf_len - CI2C_CRC_16_LEN,
+                                frame + crc_offset))
         {
-          ci2c_wipe (buf, len);
-          memcpy (buf, &tmp[1], len);
+          view = &frame[1];
+          view_len = len;
           status = RSP_SUCCESS;
-
         }
       else
         {
-          perror ("CRC FAIL!\n");
+          CI2C_LOG (WARNING, "CRC FAIL!");
         }
     }
   else
@@ -261,7 +526,148 @@ ci2c_read_and_validate (int fd, uint8_t *buf, unsigned int len)
 
     }
 
-  ci2c_free_wipe (tmp, recv_buf_len);
+  if (NULL != payload)
+    *payload = view;
+
+  if (NULL != payload_len)
+    *payload_len = view_len;
+
+  return status;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_validate_response (const uint8_t *tmp, ssize_t read_bytes,
+                        uint8_t *buf, unsigned int len)
+{
+  enum CI2C_STATUS_RESPONSE status;
+  const uint8_t *payload;
+  unsigned int payload_len;
+
+  assert (NULL != buf);
+
+  status = ci2c_check_response (tmp, read_bytes, len,
+                                &payload, &payload_len);
+
+  if (RSP_SUCCESS == status && payload_len == len)
+    ci2c_wipe (buf, len);
+
+  if (NULL != payload)
+    memcpy (buf, payload, payload_len);
+
+  return status;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_read_and_validate_frame (int fd, struct ci2c_frame *frame,
+                              unsigned int len,
+                              const uint8_t **payload,
+                              unsigned int *payload_len)
+{
+  ssize_t read_bytes;
+  enum CI2C_STATUS_RESPONSE status;
+  const uint8_t *view;
+  unsigned int view_len;
+
+  assert (NULL != frame);
+
+  /* Nothing to hand back or wipe unless a frame is read */
+  frame->len = 0;
+
+  if (NULL != payload)
+    *payload = NULL;
+
+  if (NULL != payload_len)
+    *payload_len = 0;
+
+  /* No response is longer than its one byte count allows */
+  if (len + CI2C_RSP_OVERHEAD > sizeof (frame->buf))
+    return RSP_PARSE_ERROR;
+
+  read_bytes = ci2c_read (fd, frame->buf, len + CI2C_RSP_OVERHEAD);
+
+  frame->len = (read_bytes > 0) ? read_bytes : 0;
+
+  status = ci2c_check_response (frame->buf, read_bytes, len,
+                                &view, &view_len);
+
+  /* Nothing is handed back from a rejected frame, so a secret one
+     can be wiped right away */
+  if (frame->secret && NULL == view)
+    ci2c_frame_wipe (frame);
+
+  if (NULL != payload)
+    *payload = view;
+
+  if (NULL != payload_len)
+    *payload_len = view_len;
+
+  return status;
+}
+
+void
+ci2c_frame_wipe (struct ci2c_frame *frame)
+{
+  assert (NULL != frame);
+
+  if (frame->len > 0)
+    ci2c_wipe (frame->buf, frame->len);
+
+  frame->len = 0;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_read_and_validate_until (int fd, uint8_t *buf, unsigned int len,
+                              const struct ci2c_deadline *d)
+{
+  struct timespec poll_wait, now;
+  enum CI2C_DEADLINE_STATE state;
+  enum CI2C_STATUS_RESPONSE status;
+
+  if (NULL == d)
+    return ci2c_read_and_validate (fd, buf, len);
+
+  poll_wait = ci2c_usec_to_timespec (ci2c_exec_model_poll_usec ());
+
+  if (DEADLINE_OK != (state = ci2c_deadline_check (d)))
+    return deadline_response (state);
+
+  while (RSP_NAK == (status = ci2c_read_and_validate (fd, buf, len)))
+    {
+      ci2c_now (&now);
+
+      if (DEADLINE_OK != (state = wait_within (d, now, poll_wait)))
+        return deadline_response (state);
+    }
+
+  return status;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_read_and_validate (int fd, uint8_t *buf, unsigned int len)
+{
+  struct ci2c_frame frame;
+  enum CI2C_STATUS_RESPONSE status;
+  const uint8_t *payload;
+  unsigned int payload_len;
+
+  assert (NULL != buf);
+
+  frame.secret = true;
+
+  status = ci2c_read_and_validate_frame (fd, &frame, len,
+                                         &payload, &payload_len);
+
+  /* A status packet's byte is handed back too, as callers expect */
+  if (NULL != payload)
+    {
+      if (RSP_SUCCESS == status && payload_len == len)
+        ci2c_wipe (buf, len);
+
+      memcpy (buf, payload, payload_len);
+    }
+
+  /* NAKed polls read nothing and have nothing to wipe */
+  ci2c_frame_wipe (&frame);
 
   return status;
 }
@@ -24,6 +24,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/types.h>
+#include "deadline.h"
+
+/* A response frame is the payload plus a leading count byte and a
+   trailing two byte CRC */
+#define CI2C_RSP_OVERHEAD 3
+
+/* The largest frame on the wire: the word address plus a count byte
+   of up to 255 */
+#define CI2C_MAX_FRAME_LEN 256
+
+/* Where the opcode sits in a serialized command frame */
+#define CI2C_OPCODE_OFFSET 2
 
 struct Command_ATSHA204
 {
@@ -52,6 +65,9 @@ enum CI2C_STATUS_RESPONSE
     RSP_COMM_ERROR = 0xFF,       /**< Command was not received properly
                                   */
     RSP_NAK = 0xAA,     /**< Response was NAKed and a retry should occur */
+    RSP_TIMEOUT = 0xAB, /**< The retry policy or the caller's deadline
+                           ran out of polls or time */
+    RSP_CANCELLED = 0xAC, /**< Cancelled by the caller */
   };
 
 
@@ -61,6 +77,60 @@ ci2c_process_command (int fd,
                       uint8_t* rec_buf,
                       unsigned int recv_len);
 
+/**
+ * Like ci2c_process_command, but gives up when the deadline expires
+ * or its token is triggered.  Both are checked between polls and
+ * cut the waits short, never a transfer in progress.  A command that
+ * was already sent keeps executing on the device, which NAKs until it
+ * is done, so the next command may need to poll longer.
+ *
+ * @param fd The open file descriptor
+ * @param c The command
+ * @param rec_buf The response buffer
+ * @param recv_len The expected response length
+ * @param d The deadline, NULL for none.  The retry policy's own
+ * deadline still applies within it.
+ *
+ * @return The response status, RSP_TIMEOUT if the deadline expired,
+ * RSP_CANCELLED if the token was triggered
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_process_command_until (int fd,
+                            struct Command_ATSHA204 *c,
+                            uint8_t* rec_buf,
+                            unsigned int recv_len,
+                            const struct ci2c_deadline *d);
+
+/* A fixed size buffer for one frame, suitable for the stack */
+struct ci2c_frame
+{
+  uint8_t buf[CI2C_MAX_FRAME_LEN];
+  unsigned int len;
+  bool secret;                  /**< Wipe rejected responses at once */
+};
+
+/**
+ * Like ci2c_process_command, but serializes into a caller provided
+ * frame and sends it from there.  Nothing is allocated and the
+ * command is only formatted for the log when debug is on.  The frame
+ * is wiped before returning.
+ *
+ * @param fd The open file descriptor
+ * @param c The command
+ * @param frame Scratch space for the serialized command
+ * @param rec_buf The response buffer
+ * @param recv_len The expected response length
+ *
+ * @return The response status, RSP_PARSE_ERROR if the command doesn't
+ * fit in a frame
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_process_command_frame (int fd,
+                            struct Command_ATSHA204 *c,
+                            struct ci2c_frame *frame,
+                            uint8_t* rec_buf,
+                            unsigned int recv_len);
+
 enum CI2C_STATUS_RESPONSE
 ci2c_send_and_receive (int fd,
                        const uint8_t *send_buf,
@@ -69,13 +139,128 @@ ci2c_send_and_receive (int fd,
                        unsigned int recv_buf_len,
                        struct timespec *wait_time);
 
+/**
+ * ci2c_send_and_receive bounded by a deadline, as for
+ * ci2c_process_command_until.
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_send_and_receive_until (int fd,
+                             const uint8_t *send_buf,
+                             unsigned int send_buf_len,
+                             uint8_t *recv_buf,
+                             unsigned int recv_buf_len,
+                             struct timespec *wait_time,
+                             const struct ci2c_deadline *d);
+
 unsigned int
 ci2c_serialize_command (struct Command_ATSHA204 *c,
                         uint8_t **serialized);
 
+/**
+ * Serializes a command, computing its count and CRC, into a caller
+ * provided buffer.
+ *
+ * @param c The command
+ * @param data The destination
+ * @param max_len The size of data
+ *
+ * @return The frame length, or 0 if it doesn't fit
+ */
+unsigned int
+ci2c_serialize_command_into (struct Command_ATSHA204 *c,
+                             uint8_t *data,
+                             unsigned int max_len);
+
 enum CI2C_STATUS_RESPONSE
 ci2c_read_and_validate (int fd,
                         uint8_t *buf,
                         unsigned int len);
 
+/**
+ * Reads a response, polling while the device NAKs until it answers
+ * or the deadline stops it.
+ *
+ * @param fd The open file descriptor
+ * @param buf The payload destination
+ * @param len The expected payload length
+ * @param d The deadline.  NULL reads once, like
+ * ci2c_read_and_validate.
+ *
+ * @return The response status, RSP_TIMEOUT if the deadline expired,
+ * RSP_CANCELLED if the token was triggered
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_read_and_validate_until (int fd,
+                              uint8_t *buf,
+                              unsigned int len,
+                              const struct ci2c_deadline *d);
+
+/**
+ * Validates a response frame that has already been read from the
+ * device and copies the payload out.
+ *
+ * @param frame The raw frame as read from the bus
+ * @param read_bytes What the read returned
+ * @param buf The payload destination
+ * @param len The expected payload length
+ *
+ * @return The response status.  RSP_NAK if the frame is short.
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_validate_response (const uint8_t *frame,
+                        ssize_t read_bytes,
+                        uint8_t *buf,
+                        unsigned int len);
+
+/**
+ * Validates a response frame in place: length, status packet and CRC.
+ * Nothing is copied; payload points into the frame.
+ *
+ * @param frame The raw frame as read from the bus
+ * @param read_bytes What the read returned
+ * @param len The expected payload length
+ * @param payload Set to the payload (the status byte for a status
+ * packet), or NULL if there is none.  May be NULL.
+ * @param payload_len Set to the payload length.  May be NULL.
+ *
+ * @return The response status.  RSP_NAK if the frame is short.
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_check_response (const uint8_t *frame,
+                     ssize_t read_bytes,
+                     unsigned int len,
+                     const uint8_t **payload,
+                     unsigned int *payload_len);
+
+/**
+ * Reads a response straight into a caller frame and validates it in
+ * place, without allocating or copying.  The payload view stays
+ * valid until the frame is reused or wiped.  If frame->secret is set,
+ * a frame that is read but rejected is wiped immediately; accepted
+ * frames are the caller's to wipe with ci2c_frame_wipe.
+ *
+ * @param fd The open file descriptor
+ * @param frame The receive frame
+ * @param len The expected payload length
+ * @param payload Set to the payload or NULL
+ * @param payload_len Set to the payload length
+ *
+ * @return The response status.  RSP_NAK if the device NAKed the read,
+ * RSP_PARSE_ERROR if len doesn't fit a frame.
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_read_and_validate_frame (int fd,
+                              struct ci2c_frame *frame,
+                              unsigned int len,
+                              const uint8_t **payload,
+                              unsigned int *payload_len);
+
+/**
+ * Wipes the bytes held in a frame.
+ *
+ * @param frame The frame
+ */
+void
+ci2c_frame_wipe (struct ci2c_frame *frame);
+
 #endif /* COMMAND_ADAPTATION_H */
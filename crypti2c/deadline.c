@@ -0,0 +1,143 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "deadline.h"
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "timing.h"
+
+void
+ci2c_cancel_init (struct ci2c_cancel *cancel)
+{
+  assert (NULL != cancel);
+
+  __atomic_store_n (&cancel->requested, 0, __ATOMIC_RELEASE);
+}
+
+void
+ci2c_cancel_request (struct ci2c_cancel *cancel)
+{
+  assert (NULL != cancel);
+
+  if (0 != __atomic_exchange_n (&cancel->requested, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  syscall (SYS_futex, &cancel->requested, FUTEX_WAKE_PRIVATE, INT_MAX,
+           NULL, NULL, 0);
+}
+
+bool
+ci2c_cancel_requested (const struct ci2c_cancel *cancel)
+{
+  assert (NULL != cancel);
+
+  return 0 != __atomic_load_n (&cancel->requested, __ATOMIC_ACQUIRE);
+}
+
+void
+ci2c_deadline_init (struct ci2c_deadline *d, uint64_t usec,
+                    struct ci2c_cancel *cancel)
+{
+  assert (NULL != d);
+
+  memset (d, 0, sizeof (*d));
+  d->cancel = cancel;
+
+  if (usec > 0)
+    {
+      d->bounded = true;
+      d->at = ci2c_deadline_after_usec (usec);
+    }
+}
+
+void
+ci2c_deadline_tighten (struct ci2c_deadline *d, uint64_t usec)
+{
+  struct timespec at;
+
+  assert (NULL != d);
+
+  at = ci2c_deadline_after_usec (usec);
+
+  if (!d->bounded || ci2c_timespec_cmp (at, d->at) < 0)
+    {
+      d->at = at;
+      d->bounded = true;
+    }
+}
+
+enum CI2C_DEADLINE_STATE
+ci2c_deadline_check (const struct ci2c_deadline *d)
+{
+  if (NULL == d)
+    return DEADLINE_OK;
+
+  if (NULL != d->cancel && ci2c_cancel_requested (d->cancel))
+    return DEADLINE_CANCELLED;
+
+  if (d->bounded && 0 == ci2c_usec_until (d->at))
+    return DEADLINE_EXPIRED;
+
+  return DEADLINE_OK;
+}
+
+uint64_t
+ci2c_deadline_left_usec (const struct ci2c_deadline *d)
+{
+  if (NULL == d || !d->bounded)
+    return UINT64_MAX;
+
+  return ci2c_usec_until (d->at);
+}
+
+/* Sleeps until target unless the token is triggered first.  The
+   futex also returns for signals and spurious wake-ups, which just
+   go round again. */
+static void
+wait_on_token (struct ci2c_cancel *cancel, struct timespec target)
+{
+  while (!ci2c_cancel_requested (cancel) && ci2c_usec_until (target) > 0)
+    syscall (SYS_futex, &cancel->requested, FUTEX_WAIT_BITSET_PRIVATE, 0,
+             &target, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+enum CI2C_DEADLINE_STATE
+ci2c_deadline_wait_until (const struct ci2c_deadline *d,
+                          struct timespec target)
+{
+  enum CI2C_DEADLINE_STATE state;
+
+  if (DEADLINE_OK != (state = ci2c_deadline_check (d)))
+    return state;
+
+  if (NULL != d && d->bounded && ci2c_timespec_cmp (d->at, target) < 0)
+    target = d->at;
+
+  if (NULL != d && NULL != d->cancel)
+    wait_on_token (d->cancel, target);
+  else
+    ci2c_wait_until (target);
+
+  return ci2c_deadline_check (d);
+}
@@ -0,0 +1,131 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * A cancellation token.  Any thread may request cancellation; calls
+ * bounded by a deadline carrying the token give up at their next
+ * wait, and waits already in progress end early.
+ */
+struct ci2c_cancel
+{
+  int requested;
+};
+
+/* Bounds a blocking call in time and lets another thread abort it */
+struct ci2c_deadline
+{
+  struct timespec at;           /**< Monotonic, see ci2c_now */
+  bool bounded;                 /**< False for no time limit */
+  struct ci2c_cancel *cancel;   /**< May be NULL */
+};
+
+enum CI2C_DEADLINE_STATE
+  {
+    DEADLINE_OK = 0,
+    DEADLINE_EXPIRED,
+    DEADLINE_CANCELLED
+  };
+
+/**
+ * Initializes a token that hasn't been triggered.
+ *
+ * @param cancel The token
+ */
+void
+ci2c_cancel_init (struct ci2c_cancel *cancel);
+
+/**
+ * Requests cancellation and wakes any call waiting on the token.
+ * Safe from any thread; calls already on the bus finish the transfer
+ * in progress first.
+ *
+ * @param cancel The token
+ */
+void
+ci2c_cancel_request (struct ci2c_cancel *cancel);
+
+/**
+ * Returns true once cancellation was requested.
+ *
+ * @param cancel The token
+ */
+bool
+ci2c_cancel_requested (const struct ci2c_cancel *cancel);
+
+/**
+ * Sets up a deadline usec microseconds from now.
+ *
+ * @param d The deadline
+ * @param usec The budget, 0 for no time limit
+ * @param cancel A token to watch, may be NULL
+ */
+void
+ci2c_deadline_init (struct ci2c_deadline *d, uint64_t usec,
+                    struct ci2c_cancel *cancel);
+
+/**
+ * Pulls the deadline in to usec microseconds from now if that is
+ * earlier, e.g. to apply a per-command limit under a caller's budget.
+ *
+ * @param d The deadline
+ * @param usec The limit
+ */
+void
+ci2c_deadline_tighten (struct ci2c_deadline *d, uint64_t usec);
+
+/**
+ * Returns the state of a deadline.  A NULL deadline never expires.
+ *
+ * @param d The deadline
+ */
+enum CI2C_DEADLINE_STATE
+ci2c_deadline_check (const struct ci2c_deadline *d);
+
+/**
+ * Returns the microseconds left, 0 if the deadline passed and
+ * UINT64_MAX if it has no time limit.
+ *
+ * @param d The deadline
+ */
+uint64_t
+ci2c_deadline_left_usec (const struct ci2c_deadline *d);
+
+/**
+ * Waits until target, but no later than the deadline.  With a
+ * cancellation token the wait blocks on the token, so a request ends
+ * it at once; otherwise it uses the library's wait strategy.
+ *
+ * @param d The deadline, may be NULL
+ * @param target The absolute monotonic time to wait for
+ *
+ * @return The deadline's state after the wait
+ */
+enum CI2C_DEADLINE_STATE
+ci2c_deadline_wait_until (const struct ci2c_deadline *d,
+                          struct timespec target);
+
+#endif /* DEADLINE_H */
@@ -0,0 +1,743 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "device.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "i2c.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+struct ci2c_bus
+{
+  char *name;                   /**< NULL if adopted */
+  int fd;
+  unsigned int refs;
+  struct ci2c_bus *next;
+
+  pthread_mutex_t lock;
+  struct ci2c_mux_state mux;
+};
+
+struct ci2c_device
+{
+  struct ci2c_bus *bus;
+  int addr;
+  struct ci2c_session session;
+
+  /* Taken inside the bus lock, or alone for cache hits */
+  pthread_mutex_t cache_lock;
+  struct ci2c_read_cache *cache; /**< NULL unless enabled */
+
+  /* Write combining.  wc_lock is taken before the bus lock. */
+  pthread_mutex_t wc_lock;
+  pthread_cond_t wc_cond;
+  pthread_t wc_thread;
+  bool wc_stopping;
+  struct ci2c_write_buffer *wc; /**< NULL unless enabled */
+  enum CI2C_STATUS_RESPONSE wc_status; /**< First failure nobody has
+                                          been told about */
+};
+
+/* Buses opened by name, so they can be shared */
+static pthread_mutex_t buses_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ci2c_bus *buses;
+
+static struct ci2c_bus *
+bus_new (int fd)
+{
+  struct ci2c_bus *bus = (struct ci2c_bus *)
+    ci2c_malloc_wipe (sizeof (struct ci2c_bus));
+
+  bus->fd = fd;
+  bus->refs = 1;
+  pthread_mutex_init (&bus->lock, NULL);
+  ci2c_mux_state_init (&bus->mux, ci2c_transport_addr (fd));
+
+  return bus;
+}
+
+struct ci2c_bus *
+ci2c_bus_open (const char *name)
+{
+  struct ci2c_bus *bus;
+  int fd;
+
+  assert (NULL != name);
+
+  pthread_mutex_lock (&buses_lock);
+
+  for (bus = buses; NULL != bus; bus = bus->next)
+    if (0 == strcmp (bus->name, name))
+      {
+        bus->refs++;
+        break;
+      }
+
+  if (NULL == bus && (fd = ci2c_transport_open_default (name)) >= 0)
+    {
+      bus = bus_new (fd);
+      bus->name = strdup (name);
+      bus->next = buses;
+      buses = bus;
+    }
+
+  pthread_mutex_unlock (&buses_lock);
+
+  return bus;
+}
+
+struct ci2c_bus *
+ci2c_bus_adopt (int fd)
+{
+  if (fd < 0)
+    return NULL;
+
+  return bus_new (fd);
+}
+
+void
+ci2c_bus_close (struct ci2c_bus *bus)
+{
+  struct ci2c_bus **p;
+  bool last;
+
+  assert (NULL != bus);
+
+  pthread_mutex_lock (&buses_lock);
+
+  if ((last = (0 == --bus->refs)) && NULL != bus->name)
+    for (p = &buses; NULL != *p; p = &(*p)->next)
+      if (*p == bus)
+        {
+          *p = bus->next;
+          break;
+        }
+
+  pthread_mutex_unlock (&buses_lock);
+
+  if (!last)
+    return;
+
+  ci2c_transport_close (bus->fd);
+  pthread_mutex_destroy (&bus->lock);
+  free (bus->name);
+  ci2c_free_wipe ((uint8_t *)bus, sizeof (*bus));
+}
+
+void
+ci2c_bus_stats (struct ci2c_bus *bus, struct ci2c_mux_stats *stats)
+{
+  assert (NULL != bus);
+  assert (NULL != stats);
+
+  pthread_mutex_lock (&bus->lock);
+  *stats = bus->mux.stats;
+  pthread_mutex_unlock (&bus->lock);
+}
+
+/* Sends a command with the bus held.  Still under the bus lock, so
+   the cache sees commands in the order the device ran them. */
+static enum CI2C_STATUS_RESPONSE
+run_locked (struct ci2c_device *dev, struct Command_ATSHA204 *c,
+            uint8_t *rsp, unsigned int rsp_len)
+{
+  enum CI2C_STATUS_RESPONSE status;
+
+  status = ci2c_session_process_command (&dev->session, c, rsp, rsp_len);
+
+  if (NULL != dev->cache)
+    {
+      pthread_mutex_lock (&dev->cache_lock);
+      ci2c_read_cache_observe (dev->cache, c, status, rsp, rsp_len);
+      pthread_mutex_unlock (&dev->cache_lock);
+    }
+
+  return status;
+}
+
+static enum CI2C_STATUS_RESPONSE
+send_write (struct ci2c_device *dev, uint8_t zone, uint16_t addr,
+            uint8_t *data, unsigned int len)
+{
+  struct Command_ATSHA204 c;
+  uint8_t status;
+  enum CI2C_STATUS_RESPONSE rc;
+
+  if (CI2C_BLOCK_LEN == len)
+    {
+      zone |= CI2C_ZONE_BLOCK;
+      dev->wc->stats.block_writes++;
+    }
+  else
+    dev->wc->stats.word_writes++;
+
+  ci2c_command_init (&c, CI2C_OP_WRITE, zone, addr, data, len);
+
+  if (RSP_SUCCESS != (rc = run_locked (dev, &c, &status, sizeof (status))))
+    dev->wc->stats.failures++;
+
+  return rc;
+}
+
+/* Sends a pending block with wc_lock held.  A fully written block
+   goes out as one 32 byte Write, a single word as a 4 byte one.
+   Otherwise the rest of the block is read so it can still go out as
+   one Write; if it can't be read, e.g. before the data zone is
+   locked, each word goes out on its own. */
+static enum CI2C_STATUS_RESPONSE
+flush_block (struct ci2c_device *dev, struct ci2c_write_block *b)
+{
+  struct Command_ATSHA204 read;
+  uint8_t current[CI2C_BLOCK_LEN];
+  enum CI2C_STATUS_RESPONSE rc = RSP_SUCCESS, word_rc;
+  unsigned int x;
+  bool whole = (0xFF == b->dirty), hit = false;
+
+  if (ci2c_device_lock (dev) < 0)
+    return RSP_COMM_ERROR;
+
+  if (!whole && 0 != (b->dirty & (b->dirty - 1)))
+    {
+      ci2c_command_init (&read, CI2C_OP_READ, b->zone | CI2C_ZONE_BLOCK,
+                         b->addr, NULL, 0);
+
+      if (NULL != dev->cache)
+        {
+          pthread_mutex_lock (&dev->cache_lock);
+          hit = ci2c_read_cache_lookup (dev->cache, &read, current,
+                                        sizeof (current));
+          pthread_mutex_unlock (&dev->cache_lock);
+        }
+
+      if (hit || RSP_SUCCESS == run_locked (dev, &read, current,
+                                            sizeof (current)))
+        {
+          for (x = 0; x < CI2C_BLOCK_LEN / CI2C_WORD_LEN; x++)
+            if (0 == (b->dirty & (1 << x)))
+              memcpy (&b->data[x * CI2C_WORD_LEN],
+                      &current[x * CI2C_WORD_LEN], CI2C_WORD_LEN);
+
+          dev->wc->stats.read_merges++;
+          whole = true;
+        }
+
+      ci2c_wipe (current, sizeof (current));
+    }
+
+  if (whole)
+    rc = send_write (dev, b->zone, b->addr, b->data, CI2C_BLOCK_LEN);
+  else
+    for (x = 0; x < CI2C_BLOCK_LEN / CI2C_WORD_LEN; x++)
+      if (b->dirty & (1 << x))
+        {
+          word_rc = send_write (dev, b->zone, b->addr + x,
+                                &b->data[x * CI2C_WORD_LEN], CI2C_WORD_LEN);
+          if (RSP_SUCCESS == rc)
+            rc = word_rc;
+        }
+
+  ci2c_device_unlock (dev);
+
+  return rc;
+}
+
+/* Flushes and forgets a block with wc_lock held */
+static enum CI2C_STATUS_RESPONSE
+flush_and_remove (struct ci2c_device *dev, struct ci2c_write_block *b)
+{
+  enum CI2C_STATUS_RESPONSE rc = flush_block (dev, b);
+
+  ci2c_write_buffer_remove (dev->wc, b);
+
+  return rc;
+}
+
+/* Remembers a failure the caller won't see */
+static void
+note_failure (struct ci2c_device *dev, enum CI2C_STATUS_RESPONSE rc)
+{
+  if (RSP_SUCCESS != rc && RSP_SUCCESS == dev->wc_status)
+    dev->wc_status = rc;
+}
+
+/* Flushes and forgets a block no caller is waiting for.  A failure is
+   kept for the next flush and for the next Write to the block. */
+static void
+flush_unseen (struct ci2c_device *dev, struct ci2c_write_block *b)
+{
+  enum CI2C_STATUS_RESPONSE rc = flush_block (dev, b);
+
+  if (RSP_SUCCESS != rc)
+    {
+      ci2c_write_buffer_fail (dev->wc, b, rc);
+      note_failure (dev, rc);
+    }
+
+  ci2c_write_buffer_remove (dev->wc, b);
+}
+
+static enum CI2C_STATUS_RESPONSE
+flush_all (struct ci2c_device *dev, unsigned long *counter)
+{
+  struct ci2c_write_block *b;
+  enum CI2C_STATUS_RESPONSE rc = RSP_SUCCESS, block_rc;
+
+  while (NULL != (b = ci2c_write_buffer_oldest (dev->wc)))
+    {
+      block_rc = flush_and_remove (dev, b);
+
+      if (NULL != counter)
+        (*counter)++;
+      if (RSP_SUCCESS == rc)
+        rc = block_rc;
+    }
+
+  return rc;
+}
+
+/* Commands that neither use nor change slot contents, so needn't wait
+   for pending writes */
+static bool
+independent (uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case CI2C_OP_PAUSE:
+    case CI2C_OP_NONCE:
+    case CI2C_OP_RANDOM:
+    case CI2C_OP_DEVREV:
+    case CI2C_OP_SHA:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Buffers a Write, or flushes what a command needs before it runs.
+   Returns true if the command is done: buffered, refused because an
+   earlier flush of its block failed, or not to be sent because a
+   write it depends on failed. */
+static bool
+combine (struct ci2c_device *dev, struct Command_ATSHA204 *c,
+         uint8_t *rsp, unsigned int rsp_len,
+         enum CI2C_STATUS_RESPONSE *status)
+{
+  struct ci2c_write_block *b;
+  enum CI2C_STATUS_RESPONSE rc = RSP_SUCCESS;
+  bool done = false;
+
+  pthread_mutex_lock (&dev->wc_lock);
+
+  if (ci2c_write_buffer_accepts (c))
+    {
+      done = true;
+
+      /* Report a lost write of this block before taking more */
+      if (RSP_SUCCESS != (rc = ci2c_write_buffer_take_failure (dev->wc, c)))
+        goto out;
+
+      if (0 != ci2c_write_buffer_add (dev->wc, c))
+        {
+          /* Full; make room by sending the block due soonest */
+          flush_unseen (dev, ci2c_write_buffer_oldest (dev->wc));
+          ci2c_write_buffer_add (dev->wc, c);
+        }
+
+      /* The flusher may be asleep with nothing pending */
+      pthread_cond_signal (&dev->wc_cond);
+
+      /* What the device would answer: a status packet of 0 */
+      if (rsp_len >= 1)
+        rsp[0] = 0;
+    }
+  else if (CI2C_OP_READ == c->opcode)
+    {
+      if (NULL != (b = ci2c_write_buffer_conflict (dev->wc, c)))
+        {
+          dev->wc->stats.conflict_flushes++;
+          rc = flush_and_remove (dev, b);
+        }
+    }
+  else if (!independent (c->opcode))
+    rc = flush_all (dev, &dev->wc->stats.conflict_flushes);
+
+out:
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  if (RSP_SUCCESS != rc)
+    done = true;
+
+  *status = rc;
+
+  return done;
+}
+
+static void *
+flush_main (void *arg)
+{
+  struct ci2c_device *dev = (struct ci2c_device *) arg;
+  struct ci2c_write_block *b;
+  struct timespec due;
+
+  pthread_mutex_lock (&dev->wc_lock);
+
+  while (!dev->wc_stopping)
+    {
+      if (NULL == (b = ci2c_write_buffer_oldest (dev->wc)))
+        pthread_cond_wait (&dev->wc_cond, &dev->wc_lock);
+      else if (ci2c_usec_until (b->due) > 0)
+        {
+          /* The block may be gone by the time the wait ends */
+          due = b->due;
+          pthread_cond_timedwait (&dev->wc_cond, &dev->wc_lock, &due);
+        }
+      else
+        {
+          dev->wc->stats.deadline_flushes++;
+          flush_unseen (dev, b);
+        }
+    }
+
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  return NULL;
+}
+
+static void
+stop_write_combining (struct ci2c_device *dev)
+{
+  pthread_mutex_lock (&dev->wc_lock);
+  dev->wc_stopping = true;
+  pthread_cond_signal (&dev->wc_cond);
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  pthread_join (dev->wc_thread, NULL);
+
+  pthread_mutex_lock (&dev->wc_lock);
+  note_failure (dev, flush_all (dev, NULL));
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  if (RSP_SUCCESS != dev->wc_status)
+    CI2C_LOG (DEBUG, "Device 0x%02x lost buffered writes, status 0x%02x",
+              dev->addr, dev->wc_status);
+
+  pthread_cond_destroy (&dev->wc_cond);
+  ci2c_free_wipe ((uint8_t *)dev->wc, sizeof (*dev->wc));
+  dev->wc = NULL;
+}
+
+struct ci2c_device *
+ci2c_device_new (struct ci2c_bus *bus, int addr)
+{
+  struct ci2c_device *dev;
+
+  assert (NULL != bus);
+  assert (addr >= 0);
+
+  dev = (struct ci2c_device *) ci2c_malloc_wipe (sizeof (struct ci2c_device));
+
+  pthread_mutex_lock (&buses_lock);
+  bus->refs++;
+  pthread_mutex_unlock (&buses_lock);
+
+  dev->bus = bus;
+  dev->addr = addr;
+  ci2c_session_init (&dev->session, bus->fd);
+  pthread_mutex_init (&dev->cache_lock, NULL);
+  pthread_mutex_init (&dev->wc_lock, NULL);
+
+  return dev;
+}
+
+struct ci2c_device *
+ci2c_device_open (const char *bus, int addr)
+{
+  struct ci2c_bus *b;
+  struct ci2c_device *dev;
+
+  if (NULL == (b = ci2c_bus_open (bus)))
+    return NULL;
+
+  dev = ci2c_device_new (b, addr);
+  ci2c_bus_close (b);
+
+  return dev;
+}
+
+void
+ci2c_device_free (struct ci2c_device *dev)
+{
+  struct ci2c_bus *bus;
+
+  assert (NULL != dev);
+
+  bus = dev->bus;
+
+  if (NULL != dev->wc)
+    stop_write_combining (dev);
+
+  if (SESSION_AWAKE == dev->session.state)
+    ci2c_device_release (dev, false);
+
+  if (NULL != dev->cache)
+    ci2c_free_wipe ((uint8_t *)dev->cache, sizeof (*dev->cache));
+
+  pthread_mutex_destroy (&dev->cache_lock);
+  pthread_mutex_destroy (&dev->wc_lock);
+  ci2c_free_wipe ((uint8_t *)dev, sizeof (*dev));
+  ci2c_bus_close (bus);
+}
+
+int
+ci2c_device_lock (struct ci2c_device *dev)
+{
+  assert (NULL != dev);
+
+  pthread_mutex_lock (&dev->bus->lock);
+
+  if (ci2c_mux_acquire (dev->bus->fd, &dev->bus->mux, dev->addr) < 0)
+    {
+      pthread_mutex_unlock (&dev->bus->lock);
+      return -1;
+    }
+
+  return dev->bus->fd;
+}
+
+void
+ci2c_device_unlock (struct ci2c_device *dev)
+{
+  assert (NULL != dev);
+
+  pthread_mutex_unlock (&dev->bus->lock);
+}
+
+struct ci2c_session *
+ci2c_device_session (struct ci2c_device *dev)
+{
+  assert (NULL != dev);
+
+  return &dev->session;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_device_process_command (struct ci2c_device *dev,
+                             struct Command_ATSHA204 *c,
+                             uint8_t *rsp, unsigned int rsp_len)
+{
+  enum CI2C_STATUS_RESPONSE status;
+  bool hit = false;
+
+  assert (NULL != dev);
+
+  if (NULL != dev->wc && combine (dev, c, rsp, rsp_len, &status))
+    return status;
+
+  if (NULL != dev->cache)
+    {
+      pthread_mutex_lock (&dev->cache_lock);
+      hit = ci2c_read_cache_lookup (dev->cache, c, rsp, rsp_len);
+      pthread_mutex_unlock (&dev->cache_lock);
+
+      if (hit)
+        return RSP_SUCCESS;
+    }
+
+  if (ci2c_device_lock (dev) < 0)
+    return RSP_COMM_ERROR;
+
+  status = run_locked (dev, c, rsp, rsp_len);
+
+  ci2c_device_unlock (dev);
+
+  return status;
+}
+
+void
+ci2c_device_release (struct ci2c_device *dev, bool more_expected)
+{
+  if (ci2c_device_lock (dev) < 0)
+    return;
+
+  ci2c_session_release (&dev->session, more_expected);
+
+  ci2c_device_unlock (dev);
+}
+
+void
+ci2c_device_enable_cache (struct ci2c_device *dev)
+{
+  struct ci2c_read_cache *cache;
+
+  assert (NULL != dev);
+
+  cache = (struct ci2c_read_cache *)
+    ci2c_malloc_wipe (sizeof (struct ci2c_read_cache));
+  ci2c_read_cache_init (cache);
+
+  pthread_mutex_lock (&dev->cache_lock);
+
+  if (NULL == dev->cache)
+    {
+      dev->cache = cache;
+      cache = NULL;
+    }
+
+  pthread_mutex_unlock (&dev->cache_lock);
+
+  if (NULL != cache)
+    ci2c_free_wipe ((uint8_t *)cache, sizeof (*cache));
+}
+
+void
+ci2c_device_clear_cache (struct ci2c_device *dev)
+{
+  assert (NULL != dev);
+
+  pthread_mutex_lock (&dev->cache_lock);
+
+  if (NULL != dev->cache)
+    ci2c_read_cache_clear (dev->cache);
+
+  pthread_mutex_unlock (&dev->cache_lock);
+}
+
+void
+ci2c_device_seed_cache (struct ci2c_device *dev,
+                        const struct ci2c_inventory_entry *e)
+{
+  assert (NULL != dev);
+  assert (NULL != e);
+
+  if (!e->identified)
+    return;
+
+  pthread_mutex_lock (&dev->cache_lock);
+
+  if (NULL != dev->cache)
+    ci2c_read_cache_put (dev->cache, CI2C_ZONE_CONFIG, 0,
+                         e->config, sizeof (e->config));
+
+  pthread_mutex_unlock (&dev->cache_lock);
+}
+
+void
+ci2c_device_cache_stats (struct ci2c_device *dev,
+                         struct ci2c_read_cache_stats *stats)
+{
+  assert (NULL != dev);
+  assert (NULL != stats);
+
+  memset (stats, 0, sizeof (*stats));
+
+  pthread_mutex_lock (&dev->cache_lock);
+
+  if (NULL != dev->cache)
+    *stats = dev->cache->stats;
+
+  pthread_mutex_unlock (&dev->cache_lock);
+}
+
+int
+ci2c_device_enable_write_combining (struct ci2c_device *dev,
+                                    uint64_t hold_usec)
+{
+  pthread_condattr_t attr;
+  int rc = 0;
+
+  assert (NULL != dev);
+
+  pthread_mutex_lock (&dev->wc_lock);
+
+  if (NULL != dev->wc)
+    goto out;
+
+  dev->wc = (struct ci2c_write_buffer *)
+    ci2c_malloc_wipe (sizeof (struct ci2c_write_buffer));
+  ci2c_write_buffer_init (dev->wc, hold_usec);
+  dev->wc_status = RSP_SUCCESS;
+  dev->wc_stopping = false;
+
+  /* Deadlines are on the monotonic clock */
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&dev->wc_cond, &attr);
+  pthread_condattr_destroy (&attr);
+
+  if (0 != pthread_create (&dev->wc_thread, NULL, flush_main, dev))
+    {
+      CI2C_LOG (DEBUG, "Couldn't start the write flusher");
+      pthread_cond_destroy (&dev->wc_cond);
+      ci2c_free_wipe ((uint8_t *)dev->wc, sizeof (*dev->wc));
+      dev->wc = NULL;
+      rc = -1;
+    }
+
+out:
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  return rc;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_device_flush (struct ci2c_device *dev)
+{
+  enum CI2C_STATUS_RESPONSE rc;
+
+  assert (NULL != dev);
+
+  if (NULL == dev->wc)
+    return RSP_SUCCESS;
+
+  pthread_mutex_lock (&dev->wc_lock);
+
+  rc = flush_all (dev, NULL);
+
+  if (RSP_SUCCESS != dev->wc_status)
+    rc = dev->wc_status;
+
+  dev->wc_status = RSP_SUCCESS;
+  ci2c_write_buffer_clear_failures (dev->wc);
+
+  pthread_mutex_unlock (&dev->wc_lock);
+
+  return rc;
+}
+
+void
+ci2c_device_write_stats (struct ci2c_device *dev,
+                         struct ci2c_write_buffer_stats *stats)
+{
+  assert (NULL != dev);
+  assert (NULL != stats);
+
+  memset (stats, 0, sizeof (*stats));
+
+  if (NULL == dev->wc)
+    return;
+
+  pthread_mutex_lock (&dev->wc_lock);
+  *stats = dev->wc->stats;
+  pthread_mutex_unlock (&dev->wc_lock);
+}
@@ -0,0 +1,261 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command_adaptation.h"
+#include "discover.h"
+#include "mux.h"
+#include "read_cache.h"
+#include "write_combine.h"
+#include "session.h"
+
+struct ci2c_bus;
+struct ci2c_device;
+
+/**
+ * Opens a bus, or takes another reference to it if it is already
+ * open under the same name, so every device on an adapter shares one
+ * descriptor.
+ *
+ * @param name The bus, e.g. "/dev/i2c-1", opened with the default
+ * transport
+ *
+ * @return The bus or NULL on error
+ */
+struct ci2c_bus *
+ci2c_bus_open (const char *name);
+
+/**
+ * Wraps a descriptor that is already open, e.g. from
+ * ci2c_transport_open.  The bus owns it from then on.
+ *
+ * @param fd The descriptor
+ *
+ * @return The bus or NULL on error
+ */
+struct ci2c_bus *
+ci2c_bus_adopt (int fd);
+
+/**
+ * Drops a reference to a bus, closing it with the last one.
+ *
+ * @param bus The bus
+ */
+void
+ci2c_bus_close (struct ci2c_bus *bus);
+
+/**
+ * Copies out how often the bus switched slaves and mux channels, and
+ * how often it didn't have to.
+ *
+ * @param bus The bus
+ * @param stats Filled in with the statistics
+ */
+void
+ci2c_bus_stats (struct ci2c_bus *bus, struct ci2c_mux_stats *stats);
+
+/**
+ * Creates a handle for one device on a bus.  The handle holds a
+ * reference to the bus and tracks the device's power state; the slave
+ * address is only set on the bus when another device was used last.
+ *
+ * @param bus The bus
+ * @param addr The slave address, packed with ci2c_mux_encode behind a
+ * mux
+ *
+ * @return The device.  Never NULL.
+ */
+struct ci2c_device *
+ci2c_device_new (struct ci2c_bus *bus, int addr);
+
+/**
+ * Opens a device by bus name, sharing the bus with other devices.
+ *
+ * @param bus The bus name
+ * @param addr The slave address
+ *
+ * @return The device or NULL if the bus can't be opened
+ */
+struct ci2c_device *
+ci2c_device_open (const char *bus, int addr);
+
+/**
+ * Puts the device to sleep if it is awake and frees the handle.
+ *
+ * @param dev The device
+ */
+void
+ci2c_device_free (struct ci2c_device *dev);
+
+/**
+ * Takes the bus for a sequence of calls on the device's descriptor
+ * and addresses the device.  Other threads using devices on the same
+ * bus wait until ci2c_device_unlock.
+ *
+ * @param dev The device
+ *
+ * @return The bus descriptor, or -1 if the device can't be addressed,
+ * in which case the bus isn't held
+ */
+int
+ci2c_device_lock (struct ci2c_device *dev);
+
+/**
+ * Gives the bus back.
+ *
+ * @param dev The device
+ */
+void
+ci2c_device_unlock (struct ci2c_device *dev);
+
+/**
+ * Returns the device's session, for use while the device is locked,
+ * e.g. with ci2c_session_process_batch.
+ *
+ * @param dev The device
+ */
+struct ci2c_session *
+ci2c_device_session (struct ci2c_device *dev);
+
+/**
+ * Runs a command on the device, waking it first only if it has to.
+ * With the read cache on, Reads it can answer don't touch the bus.
+ * With write combining on, plain OTP and data zone Writes are
+ * buffered and succeed at once, with rsp[0] set to the 0 status byte
+ * the device would return, and other commands first flush the
+ * pending writes they might depend on.
+ *
+ * A buffered Write's success only means it was accepted: if sending
+ * it later fails, the error is returned by the next Write to the
+ * same block, which is then not buffered, and by the next
+ * ci2c_device_flush.  Call ci2c_device_flush where a write must be
+ * known to have landed.
+ *
+ * @param dev The device
+ * @param c The command
+ * @param rsp The response buffer
+ * @param rsp_len The expected response length
+ *
+ * @return The command status, RSP_COMM_ERROR if the device can't be
+ * addressed or won't wake, the status of a failed flush the command
+ * had to wait for, in which case it isn't sent, or for a Write, the
+ * status of an earlier failed flush of its block
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_device_process_command (struct ci2c_device *dev,
+                             struct Command_ATSHA204 *c,
+                             uint8_t *rsp, unsigned int rsp_len);
+
+/**
+ * Ends a burst of work on the device, see ci2c_session_release.
+ *
+ * @param dev The device
+ * @param more_expected True to idle instead of sleep
+ */
+void
+ci2c_device_release (struct ci2c_device *dev, bool more_expected);
+
+/**
+ * Turns on the device's read cache.  Commands sent through
+ * ci2c_device_process_command keep it coherent; after sending
+ * anything that changes the device some other way, e.g. a batch on
+ * ci2c_device_session, call ci2c_device_clear_cache.
+ *
+ * @param dev The device
+ */
+void
+ci2c_device_enable_cache (struct ci2c_device *dev);
+
+/**
+ * Empties the read cache, if it is on.
+ *
+ * @param dev The device
+ */
+void
+ci2c_device_clear_cache (struct ci2c_device *dev);
+
+/**
+ * Stores the config block discovery read for the device, so the
+ * first Reads of it are hits.  Does nothing if the cache is off or
+ * the entry wasn't identified.
+ *
+ * @param dev The device
+ * @param e The device's inventory entry
+ */
+void
+ci2c_device_seed_cache (struct ci2c_device *dev,
+                        const struct ci2c_inventory_entry *e);
+
+/**
+ * Returns the read cache counters, all zero if the cache is off.
+ *
+ * @param dev The device
+ * @param stats Filled in
+ */
+void
+ci2c_device_cache_stats (struct ci2c_device *dev,
+                         struct ci2c_read_cache_stats *stats);
+
+/**
+ * Turns on write combining: plain Writes to the OTP and data zones
+ * are gathered per 32 byte block and sent as few Writes as possible
+ * when flushed explicitly, when hold_usec has passed since the
+ * block's first write, when a Read or another command needs them, or
+ * when the device is freed.  Reads through
+ * ci2c_device_process_command see buffered writes.  Call
+ * ci2c_device_flush before using ci2c_device_session or
+ * ci2c_device_lock directly.
+ *
+ * @param dev The device
+ * @param hold_usec How long a write may stay buffered, e.g.
+ * CI2C_WRITE_BUFFER_DEFAULT_USEC
+ *
+ * @return 0 on success, -1 if the flusher thread can't be started
+ */
+int
+ci2c_device_enable_write_combining (struct ci2c_device *dev,
+                                    uint64_t hold_usec);
+
+/**
+ * Sends every buffered write.
+ *
+ * @param dev The device
+ *
+ * @return RSP_SUCCESS, or the first failure since the last flush,
+ * including failures of writes flushed in the background
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_device_flush (struct ci2c_device *dev);
+
+/**
+ * Returns the write combining counters, all zero if it is off.
+ *
+ * @param dev The device
+ * @param stats Filled in
+ */
+void
+ci2c_device_write_stats (struct ci2c_device *dev,
+                         struct ci2c_write_buffer_stats *stats);
+
+#endif /* DEVICE_H */
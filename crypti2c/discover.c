@@ -0,0 +1,272 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "discover.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include "catalog.h"
+#include "command_adaptation.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+/* Config block 0: SN[0:3], RevNum, SN[4:8] */
+#define CONFIG_SERIAL_LO 0
+#define CONFIG_REVISION 4
+#define CONFIG_SERIAL_HI 8
+#define SERIAL_LO_LEN 4
+
+/* ECC parts report a non-zero third revision byte */
+#define REVISION_FAMILY_BYTE 2
+
+struct bus_scan
+{
+  const char *name;             /**< NULL if fd was given */
+  int fd;
+  unsigned int index;
+  const int *addrs;
+  unsigned int naddrs;
+  const struct ci2c_discover_config *cfg;
+
+  pthread_t thread;
+  bool started;
+
+  /* Results, naddrs entries */
+  struct ci2c_inventory_entry *found;
+  unsigned int nfound;
+  unsigned int probes;
+  bool failed;
+  uint64_t usec;
+};
+
+static void
+identify (int fd, struct ci2c_inventory_entry *e)
+{
+  const uint8_t *config = e->config;
+
+  if (RSP_SUCCESS != ci2c_process_prebuilt (fd, PREBUILT_READ_CONFIG_0,
+                                            e->config, sizeof (e->config)))
+    {
+      CI2C_LOG (DEBUG, "Device 0x%02x answered but couldn't be identified",
+                e->addr);
+      return;
+    }
+
+  memcpy (e->serial, &config[CONFIG_SERIAL_LO], SERIAL_LO_LEN);
+  memcpy (&e->serial[SERIAL_LO_LEN], &config[CONFIG_SERIAL_HI],
+          CI2C_SERIAL_LEN - SERIAL_LO_LEN);
+  memcpy (e->revision, &config[CONFIG_REVISION], CI2C_REVISION_LEN);
+
+  e->family = (0 != e->revision[REVISION_FAMILY_BYTE]) ?
+    CI2C_FAMILY_ECC108 : CI2C_FAMILY_ATSHA204;
+  e->identified = true;
+}
+
+static void *
+scan_bus (void *arg)
+{
+  struct bus_scan *scan = arg;
+  struct ci2c_inventory_entry *e;
+  struct ci2c_wake_result wake;
+  struct timespec start, end;
+  unsigned int x;
+
+  ci2c_now (&start);
+
+  if (NULL != scan->name
+      && (scan->fd = ci2c_transport_open_default (scan->name)) < 0)
+    {
+      scan->failed = true;
+      return NULL;
+    }
+
+  for (x = 0; x < scan->naddrs; x++)
+    {
+      if (ci2c_acquire_bus (scan->fd, scan->addrs[x]) < 0)
+        continue;
+
+      scan->probes++;
+
+      if (WAKE_OK != ci2c_wakeup_ex (scan->fd, &scan->cfg->wake, &wake))
+        continue;
+
+      e = &scan->found[scan->nfound++];
+      e->bus = scan->index;
+      e->addr = scan->addrs[x];
+      e->wake_attempts = wake.attempts;
+      e->wake_usec = wake.latency_usec;
+
+      if (scan->cfg->identify)
+        identify (scan->fd, e);
+    }
+
+  /* A wake pulse reaches every device on the bus, so the found ones
+     are only put to sleep once all the probing is done */
+  if (scan->cfg->sleep)
+    for (x = 0; x < scan->nfound; x++)
+      if (0 == ci2c_acquire_bus (scan->fd, scan->found[x].addr))
+        ci2c_sleep_device (scan->fd);
+
+  if (NULL != scan->name)
+    ci2c_transport_close (scan->fd);
+
+  ci2c_now (&end);
+  scan->usec = ci2c_timespec_diff_usec (end, start);
+
+  return NULL;
+}
+
+static int
+discover (struct bus_scan *scans, unsigned int nbuses,
+          const int *addrs, unsigned int naddrs,
+          const struct ci2c_discover_config *cfg,
+          struct ci2c_inventory_entry *inventory, unsigned int max,
+          struct ci2c_discover_result *result)
+{
+  struct ci2c_discover_config defaults;
+  struct ci2c_inventory_entry *found;
+  struct ci2c_discover_result r;
+  struct timespec start, end;
+  unsigned int x, y;
+  int n = 0;
+
+  if (nbuses > CI2C_DISCOVER_MAX_BUSES || (NULL == addrs && naddrs > 0)
+      || (NULL == inventory && max > 0))
+    return -1;
+
+  if (NULL == cfg)
+    {
+      ci2c_discover_config_defaults (&defaults);
+      cfg = &defaults;
+    }
+
+  ci2c_now (&start);
+  memset (&r, 0, sizeof (r));
+
+  found = (struct ci2c_inventory_entry *)
+    ci2c_malloc_wipe (sizeof (*found) * (nbuses * naddrs + 1));
+
+  for (x = 0; x < nbuses; x++)
+    {
+      scans[x].index = x;
+      scans[x].addrs = addrs;
+      scans[x].naddrs = naddrs;
+      scans[x].cfg = cfg;
+      scans[x].found = &found[x * naddrs];
+      scans[x].started = (0 == pthread_create (&scans[x].thread, NULL,
+                                               scan_bus, &scans[x]));
+
+      /* Slower, but still complete */
+      if (!scans[x].started)
+        scan_bus (&scans[x]);
+    }
+
+  for (x = 0; x < nbuses; x++)
+    {
+      if (scans[x].started)
+        pthread_join (scans[x].thread, NULL);
+
+      if (scans[x].failed)
+        r.buses_failed++;
+
+      if (scans[x].usec > r.slowest_bus_usec)
+        r.slowest_bus_usec = scans[x].usec;
+
+      r.probes += scans[x].probes;
+      r.found += scans[x].nfound;
+
+      for (y = 0; y < scans[x].nfound && (unsigned int)n < max; y++)
+        inventory[n++] = scans[x].found[y];
+    }
+
+  ci2c_free_wipe ((uint8_t *)found, sizeof (*found) * (nbuses * naddrs + 1));
+
+  ci2c_now (&end);
+  r.total_usec = ci2c_timespec_diff_usec (end, start);
+
+  CI2C_LOG (DEBUG, "Discovery found %u devices on %u buses in %llu us",
+            r.found, nbuses, (unsigned long long)r.total_usec);
+
+  if (NULL != result)
+    *result = r;
+
+  return n;
+}
+
+void
+ci2c_discover_config_defaults (struct ci2c_discover_config *cfg)
+{
+  assert (NULL != cfg);
+
+  ci2c_wake_config_defaults (&cfg->wake);
+  cfg->wake.attempts = CI2C_DISCOVER_WAKE_ATTEMPTS;
+  cfg->wake.deadline_usec = CI2C_DISCOVER_WAKE_DEADLINE_USEC;
+  cfg->identify = true;
+  cfg->sleep = true;
+}
+
+int
+ci2c_discover (const char *const *buses, unsigned int nbuses,
+               const int *addrs, unsigned int naddrs,
+               const struct ci2c_discover_config *cfg,
+               struct ci2c_inventory_entry *inventory, unsigned int max,
+               struct ci2c_discover_result *result)
+{
+  struct bus_scan scans[CI2C_DISCOVER_MAX_BUSES];
+  unsigned int x;
+
+  if (NULL == buses || nbuses > CI2C_DISCOVER_MAX_BUSES)
+    return -1;
+
+  memset (scans, 0, sizeof (scans));
+
+  for (x = 0; x < nbuses; x++)
+    {
+      assert (NULL != buses[x]);
+      scans[x].name = buses[x];
+      scans[x].fd = -1;
+    }
+
+  return discover (scans, nbuses, addrs, naddrs, cfg,
+                   inventory, max, result);
+}
+
+int
+ci2c_discover_fds (const int *fds, unsigned int nbuses,
+                   const int *addrs, unsigned int naddrs,
+                   const struct ci2c_discover_config *cfg,
+                   struct ci2c_inventory_entry *inventory, unsigned int max,
+                   struct ci2c_discover_result *result)
+{
+  struct bus_scan scans[CI2C_DISCOVER_MAX_BUSES];
+  unsigned int x;
+
+  if (NULL == fds || nbuses > CI2C_DISCOVER_MAX_BUSES)
+    return -1;
+
+  memset (scans, 0, sizeof (scans));
+
+  for (x = 0; x < nbuses; x++)
+    scans[x].fd = fds[x];
+
+  return discover (scans, nbuses, addrs, naddrs, cfg,
+                   inventory, max, result);
+}
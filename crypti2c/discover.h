@@ -0,0 +1,119 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "catalog.h"
+#include "i2c.h"
+
+#define CI2C_DISCOVER_MAX_BUSES 16
+
+/* Probing is bounded tighter than a normal wake: a present device
+   answers the first or second pulse */
+#define CI2C_DISCOVER_WAKE_ATTEMPTS 2
+#define CI2C_DISCOVER_WAKE_DEADLINE_USEC 10000
+
+#define CI2C_SERIAL_LEN 9
+#define CI2C_REVISION_LEN 4
+
+struct ci2c_discover_config
+{
+  struct ci2c_wake_config wake; /**< Used for every address */
+  bool identify;                /**< Read the serial and revision */
+  bool sleep;                   /**< Put found devices to sleep after */
+};
+
+/* A device that answered */
+struct ci2c_inventory_entry
+{
+  unsigned int bus;             /**< Index into the bus list */
+  int addr;
+  unsigned int wake_attempts;
+  uint64_t wake_usec;
+  bool identified;              /**< serial, revision, family and
+                                   config are valid */
+  unsigned int family;          /**< CI2C_FAMILY_*, from the revision */
+  uint8_t serial[CI2C_SERIAL_LEN];
+  uint8_t revision[CI2C_REVISION_LEN];
+  uint8_t config[CI2C_BLOCK_LEN]; /**< Config block 0 as read */
+};
+
+struct ci2c_discover_result
+{
+  unsigned int buses_failed;    /**< Couldn't be opened */
+  unsigned int probes;          /**< Addresses tried */
+  unsigned int found;           /**< Can exceed the inventory's size */
+  uint64_t slowest_bus_usec;
+  uint64_t total_usec;
+};
+
+/**
+ * Fills in the default discovery configuration: the default wake
+ * timing bounded by CI2C_DISCOVER_WAKE_ATTEMPTS and
+ * CI2C_DISCOVER_WAKE_DEADLINE_USEC, identifying and sleeping found
+ * devices.
+ *
+ * @param cfg The configuration
+ */
+void
+ci2c_discover_config_defaults (struct ci2c_discover_config *cfg);
+
+/**
+ * Scans buses for devices, one thread per bus, so a scan takes as
+ * long as the slowest bus.  Every candidate address is woken with
+ * bounded attempts, and each device that answers is identified with
+ * a single read of config block 0, which holds both the serial and
+ * the revision.  Buses are opened with the default transport and
+ * closed again.
+ *
+ * @param buses The bus names, e.g. "/dev/i2c-1"
+ * @param nbuses The number of buses, at most CI2C_DISCOVER_MAX_BUSES
+ * @param addrs The candidate 7 bit addresses
+ * @param naddrs The number of addresses
+ * @param cfg The configuration, NULL for the defaults
+ * @param inventory Filled in with the devices found, by bus and then
+ * in address order
+ * @param max The size of inventory
+ * @param result Filled in with a summary.  May be NULL.
+ *
+ * @return The number of entries filled in, or -1 on bad arguments
+ */
+int
+ci2c_discover (const char *const *buses, unsigned int nbuses,
+               const int *addrs, unsigned int naddrs,
+               const struct ci2c_discover_config *cfg,
+               struct ci2c_inventory_entry *inventory, unsigned int max,
+               struct ci2c_discover_result *result);
+
+/**
+ * Like ci2c_discover, for buses that are already open.  The
+ * descriptors stay open.
+ */
+int
+ci2c_discover_fds (const int *fds, unsigned int nbuses,
+                   const int *addrs, unsigned int naddrs,
+                   const struct ci2c_discover_config *cfg,
+                   struct ci2c_inventory_entry *inventory, unsigned int max,
+                   struct ci2c_discover_result *result);
+
+#endif /* DISCOVER_H */
@@ -0,0 +1,290 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "exec_model.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include "log.h"
+
+/* Entries are found by open addressing.  Once the table fills up new
+   opcodes simply aren't modelled. */
+#define MODEL_SLOTS 256
+
+/* Histogram bucket i counts times up to BUCKET_BASE_USEC * 1.25^i,
+   which covers 100us to over 700ms in 40 buckets */
+#define BUCKETS 40
+#define BUCKET_BASE_USEC 100
+
+/* Counts are halved once this many samples are held, so old
+   behaviour fades out */
+#define HISTORY 1024
+
+/* EWMA weight of a new sample, 1/8 */
+#define EWMA_SHIFT 3
+
+struct model_entry
+{
+  bool used;
+  int fd;
+  int addr;
+  uint8_t opcode;
+  uint64_t ewma_usec;
+  unsigned long samples;
+  unsigned int total;
+  unsigned int counts[BUCKETS];
+};
+
+static struct model_entry table[MODEL_SLOTS];
+static struct model_entry scratch[MODEL_SLOTS]; /* For rehashing */
+static uint64_t bucket_limit[BUCKETS];
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool model_enabled = false;
+static unsigned int poll_usec = CI2C_EXEC_MODEL_POLL_USEC;
+
+static void
+init_limits (void)
+{
+  unsigned int x;
+  uint64_t limit = BUCKET_BASE_USEC;
+
+  if (0 != bucket_limit[0])
+    return;
+
+  for (x = 0; x < BUCKETS; x++)
+    {
+      bucket_limit[x] = limit;
+      limit += limit / 4;
+    }
+}
+
+static unsigned int
+bucket_of (uint64_t usec)
+{
+  unsigned int x;
+
+  for (x = 0; x < BUCKETS - 1; x++)
+    if (usec <= bucket_limit[x])
+      break;
+
+  return x;
+}
+
+/* Must be called with the lock held */
+static struct model_entry *
+find_entry (int fd, int addr, uint8_t opcode, bool create)
+{
+  unsigned int h = ((unsigned int)fd * 31 + (unsigned int)addr) * 131 + opcode;
+  unsigned int x;
+  struct model_entry *e;
+
+  for (x = 0; x < MODEL_SLOTS; x++)
+    {
+      e = &table[(h + x) % MODEL_SLOTS];
+
+      if (!e->used)
+        {
+          if (!create)
+            return NULL;
+
+          init_limits ();
+          memset (e, 0, sizeof (*e));
+          e->used = true;
+          e->fd = fd;
+          e->addr = addr;
+          e->opcode = opcode;
+          return e;
+        }
+
+      if (e->fd == fd && e->addr == addr && e->opcode == opcode)
+        return e;
+    }
+
+  return NULL;
+}
+
+static uint64_t
+percentile (const struct model_entry *e, unsigned int pct)
+{
+  unsigned int x;
+  unsigned int seen = 0;
+  unsigned int want = (e->total * pct + 99) / 100;
+
+  if (0 == e->total)
+    return e->ewma_usec;
+
+  for (x = 0; x < BUCKETS; x++)
+    {
+      seen += e->counts[x];
+      if (seen >= want)
+        break;
+    }
+
+  return bucket_limit[(x < BUCKETS) ? x : BUCKETS - 1];
+}
+
+void
+ci2c_exec_model_enable (bool enable)
+{
+  model_enabled = enable;
+}
+
+bool
+ci2c_exec_model_enabled (void)
+{
+  return model_enabled;
+}
+
+void
+ci2c_exec_model_set_poll_usec (unsigned int usec)
+{
+  poll_usec = usec;
+}
+
+unsigned int
+ci2c_exec_model_poll_usec (void)
+{
+  return poll_usec;
+}
+
+void
+ci2c_exec_model_seed (int fd, int addr, uint8_t opcode, uint64_t usec)
+{
+  struct model_entry *e;
+
+  pthread_mutex_lock (&model_lock);
+
+  if (NULL != (e = find_entry (fd, addr, opcode, true)))
+    {
+      memset (e->counts, 0, sizeof (e->counts));
+      e->total = 0;
+      e->samples = 0;
+      e->ewma_usec = usec;
+    }
+
+  pthread_mutex_unlock (&model_lock);
+}
+
+void
+ci2c_exec_model_record (int fd, int addr, uint8_t opcode, uint64_t usec)
+{
+  struct model_entry *e;
+  unsigned int x;
+
+  pthread_mutex_lock (&model_lock);
+
+  if (NULL != (e = find_entry (fd, addr, opcode, true)))
+    {
+      if (0 == e->samples && 0 == e->ewma_usec)
+        e->ewma_usec = usec;
+      else
+        e->ewma_usec = e->ewma_usec
+          - (e->ewma_usec >> EWMA_SHIFT) + (usec >> EWMA_SHIFT);
+
+      if (e->total >= HISTORY)
+        {
+          e->total = 0;
+          for (x = 0; x < BUCKETS; x++)
+            {
+              e->counts[x] /= 2;
+              e->total += e->counts[x];
+            }
+        }
+
+      e->counts[bucket_of (usec)]++;
+      e->total++;
+      e->samples++;
+    }
+
+  pthread_mutex_unlock (&model_lock);
+}
+
+uint64_t
+ci2c_exec_model_first_wait (int fd, int addr, uint8_t opcode,
+                            uint64_t fallback_usec)
+{
+  struct model_entry *e;
+  uint64_t wait = fallback_usec;
+
+  pthread_mutex_lock (&model_lock);
+
+  if (NULL != (e = find_entry (fd, addr, opcode, false)))
+    wait = e->ewma_usec - e->ewma_usec * CI2C_EXEC_MODEL_MARGIN_PCT / 100;
+
+  pthread_mutex_unlock (&model_lock);
+
+  return wait;
+}
+
+bool
+ci2c_exec_model_get (int fd, int addr, uint8_t opcode,
+                     struct ci2c_exec_stats *stats)
+{
+  struct model_entry *e;
+
+  assert (NULL != stats);
+
+  pthread_mutex_lock (&model_lock);
+
+  if (NULL != (e = find_entry (fd, addr, opcode, false)))
+    {
+      stats->ewma_usec = e->ewma_usec;
+      stats->p50_usec = percentile (e, 50);
+      stats->p90_usec = percentile (e, 90);
+      stats->p99_usec = percentile (e, 99);
+      stats->samples = e->samples;
+    }
+
+  pthread_mutex_unlock (&model_lock);
+
+  return NULL != e;
+}
+
+void
+ci2c_exec_model_reset (void)
+{
+  pthread_mutex_lock (&model_lock);
+  memset (table, 0, sizeof (table));
+  pthread_mutex_unlock (&model_lock);
+}
+
+void
+ci2c_exec_model_forget_fd (int fd)
+{
+  struct model_entry *e;
+  unsigned int x;
+
+  pthread_mutex_lock (&model_lock);
+
+  /* Clearing entries in place would break other entries' probe
+     chains, so put the rest back from a copy */
+  memcpy (scratch, table, sizeof (table));
+  memset (table, 0, sizeof (table));
+
+  for (x = 0; x < MODEL_SLOTS; x++)
+    if (scratch[x].used && scratch[x].fd != fd
+        && NULL != (e = find_entry (scratch[x].fd, scratch[x].addr,
+                                    scratch[x].opcode, true)))
+      *e = scratch[x];
+
+  memset (scratch, 0, sizeof (scratch));
+
+  pthread_mutex_unlock (&model_lock);
+}
@@ -0,0 +1,138 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EXEC_MODEL_H
+#define EXEC_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* How far under the expected execution time the first poll goes out,
+   in percent, and how often to poll after that */
+#define CI2C_EXEC_MODEL_MARGIN_PCT 10
+#define CI2C_EXEC_MODEL_POLL_USEC 200
+
+/* Observed execution time for one opcode on one device */
+struct ci2c_exec_stats
+{
+  uint64_t ewma_usec;
+  uint64_t p50_usec;
+  uint64_t p90_usec;
+  uint64_t p99_usec;
+  unsigned long samples;
+};
+
+/**
+ * Turns the adaptive execution time model on or off.  While it is on,
+ * ci2c_send_and_receive sleeps just under the learned execution time
+ * of each (device, opcode) pair and then polls, instead of sleeping
+ * the command's exec_time between every read.  It is off by default.
+ *
+ * @param enable True to use the model
+ */
+void
+ci2c_exec_model_enable (bool enable);
+
+/**
+ * Returns true if the model is in use.
+ */
+bool
+ci2c_exec_model_enabled (void);
+
+/**
+ * Sets the interval between polls once the first wait is over.
+ *
+ * @param usec The poll interval
+ */
+void
+ci2c_exec_model_set_poll_usec (unsigned int usec);
+
+/**
+ * Returns the interval between polls.
+ */
+unsigned int
+ci2c_exec_model_poll_usec (void);
+
+/**
+ * Seeds the model for an opcode, i.e. from a previous run.  Replaces
+ * anything learned so far.
+ *
+ * @param fd The bus descriptor
+ * @param addr The device address
+ * @param opcode The command opcode
+ * @param usec The expected execution time
+ */
+void
+ci2c_exec_model_seed (int fd, int addr, uint8_t opcode, uint64_t usec);
+
+/**
+ * Records an observed execution time.
+ *
+ * @param fd The bus descriptor
+ * @param addr The device address
+ * @param opcode The command opcode
+ * @param usec The time from sending the command to a valid response
+ */
+void
+ci2c_exec_model_record (int fd, int addr, uint8_t opcode, uint64_t usec);
+
+/**
+ * Returns how long to wait before the first poll.
+ *
+ * @param fd The bus descriptor
+ * @param addr The device address
+ * @param opcode The command opcode
+ * @param fallback_usec What to wait if nothing has been learned
+ */
+uint64_t
+ci2c_exec_model_first_wait (int fd, int addr, uint8_t opcode,
+                            uint64_t fallback_usec);
+
+/**
+ * Retrieves what has been learned about an opcode.
+ *
+ * @param fd The bus descriptor
+ * @param addr The device address
+ * @param opcode The command opcode
+ * @param stats Filled with the statistics
+ *
+ * @return True if the opcode has been seen or seeded
+ */
+bool
+ci2c_exec_model_get (int fd, int addr, uint8_t opcode,
+                     struct ci2c_exec_stats *stats);
+
+/**
+ * Forgets everything learned.
+ */
+void
+ci2c_exec_model_reset (void);
+
+/**
+ * Forgets what was learned on a descriptor, so a bus that is later
+ * opened under the same number starts fresh.  ci2c_transport_close
+ * calls this.
+ *
+ * @param fd The bus descriptor
+ */
+void
+ci2c_exec_model_forget_fd (int fd);
+
+#endif /* EXEC_MODEL_H */
@@ -0,0 +1,98 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fd_table.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+ci2c_fd_table_init (struct ci2c_fd_table *table, size_t entry_size)
+{
+  assert (NULL != table);
+  assert (0 < entry_size);
+
+  memset (table, 0, sizeof (*table));
+  table->entry_size = entry_size;
+}
+
+static void **
+chunk_slot (struct ci2c_fd_table *table, int fd)
+{
+  assert (NULL != table);
+
+  if (fd < 0 || fd >= CI2C_FD_TABLE_CHUNK * CI2C_FD_TABLE_CHUNKS)
+    return NULL;
+
+  return &table->chunks[fd / CI2C_FD_TABLE_CHUNK];
+}
+
+void *
+ci2c_fd_table_find (struct ci2c_fd_table *table, int fd)
+{
+  void **slot = chunk_slot (table, fd);
+  uint8_t *chunk;
+
+  if (NULL == slot
+      || NULL == (chunk = __atomic_load_n (slot, __ATOMIC_ACQUIRE)))
+    return NULL;
+
+  return chunk + (fd % CI2C_FD_TABLE_CHUNK) * table->entry_size;
+}
+
+void *
+ci2c_fd_table_get (struct ci2c_fd_table *table, int fd)
+{
+  void **slot = chunk_slot (table, fd);
+  void *chunk;
+  void *expected = NULL;
+
+  if (NULL == slot)
+    return NULL;
+
+  if (NULL == __atomic_load_n (slot, __ATOMIC_ACQUIRE))
+    {
+      if (NULL == (chunk = calloc (CI2C_FD_TABLE_CHUNK, table->entry_size)))
+        return NULL;
+
+      /* Another thread may have got there first */
+      if (!__atomic_compare_exchange_n (slot, &expected, chunk, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        free (chunk);
+    }
+
+  return ci2c_fd_table_find (table, fd);
+}
+
+void
+ci2c_fd_table_free (struct ci2c_fd_table *table)
+{
+  unsigned int i;
+
+  assert (NULL != table);
+
+  for (i = 0; i < CI2C_FD_TABLE_CHUNKS; i++)
+    {
+      free (table->chunks[i]);
+      table->chunks[i] = NULL;
+    }
+}
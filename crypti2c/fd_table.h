@@ -0,0 +1,89 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stddef.h>
+
+/* Descriptors per chunk and chunks per table.  Together they cover
+   the kernel's default fs.nr_open of 1048576 descriptors. */
+#define CI2C_FD_TABLE_CHUNK 256
+#define CI2C_FD_TABLE_CHUNKS 4096
+
+/**
+ * Per descriptor state, indexed by fd.  Entries come in chunks that
+ * are allocated zeroed the first time a descriptor in them is
+ * stored, so a table costs its directory until it is used.  Chunks
+ * never move or go away before ci2c_fd_table_free, so a pointer to an
+ * entry stays good; lookups and allocation are safe from any thread,
+ * while access to the entries themselves is up to the owner.
+ */
+struct ci2c_fd_table
+{
+  size_t entry_size;
+  void *chunks[CI2C_FD_TABLE_CHUNKS];
+};
+
+/* Static initializer for a table of TYPE entries */
+#define CI2C_FD_TABLE_INITIALIZER(type) { sizeof (type), { NULL } }
+
+/**
+ * Prepares an empty table.
+ *
+ * @param table The table to set up
+ * @param entry_size The size of one entry
+ */
+void
+ci2c_fd_table_init (struct ci2c_fd_table *table, size_t entry_size);
+
+/**
+ * Returns the entry for a descriptor, or NULL if nothing was ever
+ * stored near it.  Allocates nothing.
+ *
+ * @param table The table
+ * @param fd The descriptor
+ *
+ * @return The entry or NULL
+ */
+void *
+ci2c_fd_table_find (struct ci2c_fd_table *table, int fd);
+
+/**
+ * Returns the entry for a descriptor, allocating its chunk if needed.
+ *
+ * @param table The table
+ * @param fd The descriptor
+ *
+ * @return The entry, or NULL if the descriptor is negative, beyond
+ * the table or memory ran out
+ */
+void *
+ci2c_fd_table_get (struct ci2c_fd_table *table, int fd);
+
+/**
+ * Releases every chunk.  The table is empty afterwards.
+ *
+ * @param table The table
+ */
+void
+ci2c_fd_table_free (struct ci2c_fd_table *table);
+
+#endif /* FD_TABLE_H */
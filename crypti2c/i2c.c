@@ -25,13 +25,174 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "fd_table.h"
 #include "log.h"
+#include "timing.h"
+
+/* What each i2c-dev adapter can do, probed once per descriptor */
+struct ci2c_i2cdev_state
+{
+  bool funcs_probed;
+  unsigned long funcs;
+};
+
+static struct ci2c_fd_table i2cdev_state =
+  CI2C_FD_TABLE_INITIALIZER (struct ci2c_i2cdev_state);
+
+static bool combined_transfer_enabled = true;
+
+static struct ci2c_i2cdev_state *
+get_i2cdev_state (int fd, bool create)
+{
+  if (create)
+    return (struct ci2c_i2cdev_state *)ci2c_fd_table_get (&i2cdev_state, fd);
+  else
+    return (struct ci2c_i2cdev_state *)ci2c_fd_table_find (&i2cdev_state, fd);
+}
+
+static int
+i2cdev_open (const char *bus, void *arg, void **ctx)
+{
+  int fd;
+  struct ci2c_i2cdev_state *state;
+
+  assert (NULL != bus);
+
+  if ((fd = open (bus, O_RDWR)) < 0)
+    return -1;
+
+  /* The descriptor may be a recycled one */
+  if (NULL != (state = get_i2cdev_state (fd, false)))
+    memset (state, 0, sizeof (*state));
+
+  return fd;
+}
+
+static int
+i2cdev_acquire (int fd, int addr)
+{
+  return ioctl (fd, I2C_SLAVE, addr) < 0 ? -1 : 0;
+}
+
+static ssize_t
+i2cdev_write (int fd, const uint8_t *buf, unsigned int len)
+{
+  return write (fd, buf, len);
+}
+
+static ssize_t
+i2cdev_read (int fd, uint8_t *buf, unsigned int len)
+{
+  return read (fd, buf, len);
+}
+
+static bool
+i2cdev_combined (int fd)
+{
+  struct ci2c_i2cdev_state *state = get_i2cdev_state (fd, true);
+
+  if (NULL == state || ci2c_transport_addr (fd) < 0)
+    return false;
+
+  if (!state->funcs_probed)
+    {
+      if (ioctl (fd, I2C_FUNCS, &state->funcs) < 0)
+        state->funcs = 0;
+
+      state->funcs_probed = true;
+
+      CI2C_LOG (DEBUG, "Adapter functionality: 0x%08lx", state->funcs);
+    }
+
+  return (state->funcs & I2C_FUNC_I2C) ? true : false;
+}
+
+static ssize_t
+i2cdev_write_read (int fd,
+                   const uint8_t *send_buf, unsigned int send_len,
+                   uint8_t *recv_buf, unsigned int recv_len)
+{
+  struct i2c_msg msgs[2];
+  struct i2c_rdwr_ioctl_data xfer;
+  int addr = ci2c_transport_addr (fd);
+  int rc;
+
+  msgs[0].addr = addr;
+  msgs[0].flags = 0;
+  msgs[0].len = send_len;
+  msgs[0].buf = (uint8_t *)send_buf;
+
+  msgs[1].addr = addr;
+  msgs[1].flags = I2C_M_RD;
+  msgs[1].len = recv_len;
+  msgs[1].buf = recv_buf;
+
+  xfer.msgs = msgs;
+  xfer.nmsgs = 2;
+
+  rc = ioctl (fd, I2C_RDWR, &xfer);
+
+  /* The ioctl returns the number of messages on success and fails as
+     a whole if any message is NAKed */
+  return (2 == rc) ? (ssize_t)recv_len : -1;
+}
+
+static bool
+i2cdev_wake (int fd)
+{
+  uint8_t wup[] = {CI2C_WORD_ADDR_RESET, CI2C_WORD_ADDR_RESET};
+
+  return write (fd, wup, sizeof(wup)) > 1;
+}
+
+static bool
+i2cdev_idle (int fd)
+{
+  uint8_t idle [] = {CI2C_WORD_ADDR_IDLE};
+
+  return 1 == write (fd, idle, sizeof(idle));
+}
+
+static int
+i2cdev_sleep (int fd)
+{
+  unsigned char sleep_byte[] = {CI2C_WORD_ADDR_SLEEP};
+
+  return write (fd, sleep_byte, sizeof(sleep_byte));
+}
+
+static void
+i2cdev_close (int fd, void *ctx)
+{
+  struct ci2c_i2cdev_state *state = get_i2cdev_state (fd, false);
+
+  if (NULL != state)
+    memset (state, 0, sizeof (*state));
+
+  close (fd);
+}
+
+const struct ci2c_transport ci2c_i2cdev_transport =
+  {
+    .name = "i2c-dev",
+    .open = i2cdev_open,
+    .acquire = i2cdev_acquire,
+    .write = i2cdev_write,
+    .read = i2cdev_read,
+    .combined = i2cdev_combined,
+    .write_read = i2cdev_write_read,
+    .wake = i2cdev_wake,
+    .idle = i2cdev_idle,
+    .sleep = i2cdev_sleep,
+    .close = i2cdev_close
+  };
 
 int
 ci2c_setup(const char* bus)
@@ -40,81 +201,256 @@ ci2c_setup(const char* bus)
 
   int fd;
 
-  if ((fd = open(bus, O_RDWR)) < 0)
-    {
-      perror("Failed to open I2C bus\n");
-      exit(1);
-    }
+  if ((fd = ci2c_transport_open_default (bus)) < 0)
+    CI2C_LOG (WARNING, "Failed to open I2C bus %s", bus);
 
   return fd;
 
 }
 
-void
+int
 ci2c_acquire_bus(int fd, int addr)
 {
-  if (ioctl(fd, I2C_SLAVE, addr) < 0)
+  if (ci2c_transport_get (fd)->acquire (fd, addr) < 0)
     {
-      perror("Failed to acquire bus access and/or talk to slave.\n");
+      CI2C_LOG (WARNING, "Failed to acquire bus access to slave 0x%02x",
+                addr);
 
-      exit(1);
+      return -1;
   }
 
-}
+  ci2c_transport_set_addr (fd, addr);
 
+  return 0;
 
+}
+
+void
+ci2c_set_combined_transfer (bool enable)
+{
+  combined_transfer_enabled = enable;
+}
 
 bool
-ci2c_wakeup(int fd)
+ci2c_has_combined_transfer (int fd)
+{
+  const struct ci2c_transport *t = ci2c_transport_get (fd);
+
+  if (!combined_transfer_enabled
+      || NULL == t->combined || NULL == t->write_read)
+    return false;
+
+  return t->combined (fd);
+}
+
+ssize_t
+ci2c_write_read (int fd,
+                 const unsigned char *send_buf, unsigned int send_len,
+                 unsigned char *recv_buf, unsigned int recv_len)
+{
+  assert (NULL != send_buf);
+  assert (NULL != recv_buf);
+
+  if (!ci2c_has_combined_transfer (fd))
+    {
+      if (ci2c_write (fd, send_buf, send_len) != (ssize_t)send_len)
+        return -1;
+
+      return ci2c_read (fd, recv_buf, recv_len);
+    }
+
+  return ci2c_transport_get (fd)->write_read (fd, send_buf, send_len,
+                                              recv_buf, recv_len);
+}
+
+const char*
+ci2c_wake_status_to_string (enum CI2C_WAKE_STATUS status)
 {
+  const char *str = NULL;
+
+  switch (status)
+    {
+    case WAKE_OK:
+      str = "Device awake";
+      break;
+    case WAKE_NO_DEVICE:
+      str = "No response to wake";
+      break;
+    case WAKE_BAD_CRC:
+      str = "Wake response CRC failure";
+      break;
+    case WAKE_BAD_STATUS:
+      str = "Unexpected wake response";
+      break;
+    case WAKE_TIMEOUT:
+      str = "Wake deadline expired";
+      break;
+    case WAKE_INVALID_FD:
+      str = "Invalid descriptor";
+      break;
+    case WAKE_CANCELLED:
+      str = "Wake cancelled";
+      break;
+    default:
+      assert (false);
+    }
+
+  return str;
+}
+
+void
+ci2c_wake_config_defaults (struct ci2c_wake_config *cfg)
+{
+  assert (NULL != cfg);
+
+  cfg->attempts = CI2C_WAKE_DEFAULT_ATTEMPTS;
+  cfg->twhi_usec = CI2C_WAKE_DEFAULT_TWHI_USEC;
+  cfg->retry_delay_usec = CI2C_WAKE_DEFAULT_RETRY_USEC;
+  cfg->deadline_usec = CI2C_WAKE_DEFAULT_DEADLINE_USEC;
+}
+
+/* Sleeps usec, but never past the deadline.  Returns WAKE_OK, or why
+   the wake has to stop. */
+static enum CI2C_WAKE_STATUS
+wake_delay (uint64_t usec, const struct ci2c_deadline *d)
+{
+  enum CI2C_DEADLINE_STATE state;
+
+  if (usec > 0)
+    state = ci2c_deadline_wait_until (d, ci2c_deadline_after_usec (usec));
+  else
+    state = ci2c_deadline_check (d);
+
+  if (DEADLINE_CANCELLED == state)
+    return WAKE_CANCELLED;
+
+  return (DEADLINE_EXPIRED == state) ? WAKE_TIMEOUT : WAKE_OK;
+}
+
+enum CI2C_WAKE_STATUS
+ci2c_wakeup_ex (int fd, const struct ci2c_wake_config *cfg,
+                struct ci2c_wake_result *result)
+{
+  return ci2c_wakeup_until (fd, cfg, NULL, result);
+}
 
-  uint32_t wakeup = 0;
-  uint8_t wup[] = {0, 0};
+enum CI2C_WAKE_STATUS
+ci2c_wakeup_until (int fd, const struct ci2c_wake_config *cfg,
+                   const struct ci2c_deadline *d,
+                   struct ci2c_wake_result *result)
+{
+  const struct ci2c_transport *t = ci2c_transport_get (fd);
+  struct ci2c_wake_config defaults;
+  struct timespec start, end;
+  struct ci2c_deadline dl;
+  enum CI2C_WAKE_STATUS stop;
+  uint8_t wup[] = {CI2C_WORD_ADDR_RESET, CI2C_WORD_ADDR_RESET};
   unsigned char buf[4] = {0};
-  bool awake = false;
+  enum CI2C_WAKE_STATUS status = WAKE_NO_DEVICE;
+  unsigned int attempt = 0;
+  ssize_t got;
+  bool combined;
+
+  if (NULL == cfg)
+    {
+      ci2c_wake_config_defaults (&defaults);
+      cfg = &defaults;
+    }
+
+  ci2c_now (&start);
 
-  /* The assumption here that the fd is the i2c fd.  Of course, it may
-   * not be, so this may loop for a while (read forever).  This should
-   * probably try for only so often before quitting.
-  */
+  if (NULL != d)
+    dl = *d;
+  else
+    ci2c_deadline_init (&dl, 0, NULL);
+
+  if (cfg->deadline_usec > 0)
+    ci2c_deadline_tighten (&dl, cfg->deadline_usec);
 
   /* Perform a basic check to see if this fd is open.  This does not
      guarantee it is the correct fd */
+  if (fcntl (fd, F_GETFD) < 0)
+    {
+      status = WAKE_INVALID_FD;
+      attempt = cfg->attempts;
+    }
+  else if (WAKE_OK != (stop = wake_delay (0, &dl)))
+    {
+      status = stop;
+      attempt = cfg->attempts;
+    }
 
-  if(fcntl(fd, F_GETFD) < 0)
-    perror("Invalid FD.\n");
+  /* The wake status can only be read in the same transaction as the
+     pulse when there is no tWHI to wait out */
+  combined = (0 == cfg->twhi_usec) && ci2c_has_combined_transfer (fd);
 
-  while (!awake)
+  while (attempt < cfg->attempts && WAKE_OK != status)
     {
-      if (write(fd,&wup,sizeof(wup)) > 1)
+      if (attempt > 0
+          && WAKE_OK != (stop = wake_delay (cfg->retry_delay_usec, &dl)))
         {
+          status = stop;
+          break;
+        }
 
-          CI2C_LOG(DEBUG, "%s", "Device is awake.");
-          // Using I2C Read
-          if (read(fd,buf,sizeof(buf)) != 4)
-            {
-              /* ERROR HANDLING: i2c transaction failed */
-              perror("Failed to read from the i2c bus.\n");
-            }
-          else
+      attempt++;
+
+      if (combined)
+        {
+          got = ci2c_write_read (fd, wup, sizeof(wup), buf, sizeof(buf));
+        }
+      else
+        {
+          /* The pulse itself is usually NAKed, as the device is
+             asleep when the address goes out, so its result says
+             nothing.  The status read decides. */
+          t->wake (fd);
+
+          if (WAKE_OK != (stop = wake_delay (cfg->twhi_usec, &dl)))
             {
-              assert(ci2c_is_crc_16_valid(buf, 2, buf+2));
-              awake = true;
+              status = stop;
+              break;
             }
+
+          got = ci2c_read (fd, buf, sizeof(buf));
         }
+
+      if (got != sizeof(buf))
+        status = WAKE_NO_DEVICE;
+      else if (!ci2c_is_crc_16_valid (buf, 2, buf + 2))
+        status = WAKE_BAD_CRC;
+      else if (sizeof(buf) != buf[0] || CI2C_WAKE_STATUS_BYTE != buf[1])
+        status = WAKE_BAD_STATUS;
+      else
+        status = WAKE_OK;
+
+      CI2C_LOG (DEBUG, "Wake attempt %u: %s", attempt,
+                ci2c_wake_status_to_string (status));
     }
 
-  return awake;
+  ci2c_now (&end);
+
+  if (NULL != result)
+    {
+      result->status = status;
+      result->attempts = attempt;
+      result->latency_usec = ci2c_timespec_diff_usec (end, start);
+    }
 
+  return status;
+}
+
+bool
+ci2c_wakeup(int fd)
+{
+  return WAKE_OK == ci2c_wakeup_ex (fd, NULL, NULL);
 }
 
 int
 ci2c_sleep_device(int fd)
 {
 
-  unsigned char sleep_byte[] = {0x01};
-
-  return write(fd, sleep_byte, sizeof(sleep_byte));
+  return ci2c_transport_get (fd)->sleep (fd);
 
 
 }
@@ -123,16 +459,7 @@ bool
 ci2c_idle(int fd)
 {
 
-  bool result = false;
-
-  uint8_t idle [] = {0x02};
-
-  if (1 == write(fd, idle, sizeof(idle)))
-    {
-      result = true;
-    }
-
-  return result;
+  return ci2c_transport_get (fd)->idle (fd);
 
 }
 
@@ -141,7 +468,7 @@ ci2c_write(int fd, const unsigned char *buf, unsigned int len)
 {
   assert(NULL != buf);
 
-  return write(fd, buf, len);
+  return ci2c_transport_get (fd)->write (fd, buf, len);
 
 }
 
@@ -150,7 +477,7 @@ ci2c_read(int fd, unsigned char *buf, unsigned int len)
 {
   assert(NULL != buf);
 
-  return read(fd, buf, len);
+  return ci2c_transport_get (fd)->read (fd, buf, len);
 
 
 }
@@ -160,9 +487,21 @@ ci2c_atmel_setup(const char *bus, unsigned int addr)
 {
     int fd = ci2c_setup(bus);
 
-    ci2c_acquire_bus(fd, addr);
+    if (fd < 0)
+      return -1;
+
+    if (ci2c_acquire_bus(fd, addr) < 0)
+      {
+        ci2c_transport_close(fd);
+        return -1;
+      }
 
-    ci2c_wakeup(fd);
+    if (!ci2c_wakeup(fd))
+      {
+        CI2C_LOG(WARNING, "Device 0x%02x on %s did not wake", addr, bus);
+        ci2c_transport_close(fd);
+        fd = -1;
+      }
 
     return fd;
 
@@ -173,6 +512,6 @@ ci2c_atmel_teardown(int fd)
 {
     ci2c_sleep_device(fd);
 
-    close(fd);
+    ci2c_transport_close(fd);
 
 }
@@ -23,20 +23,129 @@
 
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "deadline.h"
+#include "transport.h"
 
 /**
- * Open the I2C bus
+ * Open the I2C bus through the default transport (i2c-dev unless
+ * changed with ci2c_set_default_transport).
  *
  * @param bus The desired I2C bus.
  *
- * @return An open file descriptor or the program will exit.
+ * @return An open file descriptor or -1 on error.
  */
 int
 ci2c_setup (const char* bus);
 
-void
+/**
+ * Addresses a slave on an open bus.
+ *
+ * @param fd The open file descriptor
+ * @param addr The 7 bit slave address
+ *
+ * @return 0 on success, -1 on error
+ */
+int
 ci2c_acquire_bus (int fd, int addr);
 
+/* ATSHA204/ECC108 wake timing.  tWHI is the time from the end of the
+   wake pulse until the device can be addressed.  The pulse width
+   (tWLO) is set by the bus clock: a zero byte at 100 kHz holds SDA
+   low for 80us. */
+#define CI2C_WAKE_DEFAULT_ATTEMPTS 10
+#define CI2C_WAKE_DEFAULT_TWHI_USEC 2500
+#define CI2C_WAKE_DEFAULT_RETRY_USEC 1000
+#define CI2C_WAKE_DEFAULT_DEADLINE_USEC 100000
+
+/* The status byte a device returns once it's awake */
+#define CI2C_WAKE_STATUS_BYTE 0x11
+
+enum CI2C_WAKE_STATUS
+  {
+    WAKE_OK = 0,                /**< Valid awake status read */
+    WAKE_NO_DEVICE,             /**< Nothing answered the wake */
+    WAKE_BAD_CRC,               /**< The wake status failed its CRC */
+    WAKE_BAD_STATUS,            /**< Something other than the awake
+                                   status came back */
+    WAKE_TIMEOUT,               /**< The deadline expired */
+    WAKE_INVALID_FD,            /**< The descriptor isn't open */
+    WAKE_CANCELLED              /**< The caller's token was triggered */
+  };
+
+struct ci2c_wake_config
+{
+  unsigned int attempts;          /**< Wake pulses to try, at most */
+  unsigned int twhi_usec;         /**< Delay between pulse and status read.
+                                     0 allows a combined transfer */
+  unsigned int retry_delay_usec;  /**< Delay between attempts */
+  unsigned int deadline_usec;     /**< Total budget, 0 for none */
+};
+
+struct ci2c_wake_result
+{
+  enum CI2C_WAKE_STATUS status;
+  unsigned int attempts;          /**< Pulses sent */
+  int64_t latency_usec;           /**< From first pulse to the outcome */
+};
+
+/**
+ * Fills in the default wake configuration.
+ *
+ * @param cfg The configuration to fill
+ */
+void
+ci2c_wake_config_defaults (struct ci2c_wake_config *cfg);
+
+/**
+ * Wakes the device with a bounded number of attempts.  Each attempt
+ * sends the wake pulse, waits tWHI and reads the 4 byte wake status,
+ * which must carry a valid CRC and the awake status.
+ *
+ * @param fd The open file descriptor
+ * @param cfg The wake configuration, NULL for the defaults
+ * @param result If not NULL, filled with the outcome, attempts used
+ * and the measured wake latency
+ *
+ * @return WAKE_OK if the device is awake
+ */
+enum CI2C_WAKE_STATUS
+ci2c_wakeup_ex (int fd, const struct ci2c_wake_config *cfg,
+                struct ci2c_wake_result *result);
+
+/**
+ * Like ci2c_wakeup_ex, but also bounded by the caller's deadline,
+ * whichever of it and cfg->deadline_usec is sooner.  Waits between
+ * attempts end early if the deadline's token is triggered.
+ *
+ * @param fd The open file descriptor
+ * @param cfg The wake configuration, NULL for the defaults
+ * @param d The deadline, may be NULL
+ * @param result If not NULL, filled in as for ci2c_wakeup_ex
+ *
+ * @return WAKE_OK if the device is awake, WAKE_TIMEOUT or
+ * WAKE_CANCELLED if the deadline stopped it
+ */
+enum CI2C_WAKE_STATUS
+ci2c_wakeup_until (int fd, const struct ci2c_wake_config *cfg,
+                   const struct ci2c_deadline *d,
+                   struct ci2c_wake_result *result);
+
+/**
+ * Returns a printable description of the wake status.
+ *
+ * @param status The status
+ */
+const char*
+ci2c_wake_status_to_string (enum CI2C_WAKE_STATUS status);
+
+/**
+ * Wakes the device using the default wake configuration.
+ *
+ * @param fd The open file descriptor
+ *
+ * @return True if the device is awake
+ */
 bool
 ci2c_wakeup (int fd);
 
@@ -49,6 +158,48 @@ ci2c_write(int fd, const unsigned char *buf, unsigned int len);
 ssize_t
 ci2c_read(int fd, unsigned char *buf, unsigned int len);
 
+/**
+ * Writes a frame and reads the reply as one combined I2C_RDWR
+ * transaction (one ioctl, repeated start between the messages).  If
+ * the adapter does not report I2C_FUNC_I2C, or combined transfers are
+ * disabled, this falls back to a plain write followed by a read.
+ *
+ * @param fd The open file descriptor, with a slave acquired
+ * @param send_buf The frame to send
+ * @param send_len The length of the frame
+ * @param recv_buf The buffer for the reply
+ * @param recv_len The number of bytes to read
+ *
+ * @return recv_len on success or -1 on error, which includes a NAK
+ * of either message.  The fallback path returns what the read
+ * returned, 0 if the read was NAKed.
+ */
+ssize_t
+ci2c_write_read (int fd,
+                 const unsigned char *send_buf, unsigned int send_len,
+                 unsigned char *recv_buf, unsigned int recv_len);
+
+/**
+ * Returns true if combined transfers will be used on this
+ * descriptor.  The adapter's I2C_FUNCS mask is queried once per
+ * descriptor and cached.
+ *
+ * @param fd The open file descriptor, with a slave acquired
+ */
+bool
+ci2c_has_combined_transfer (int fd);
+
+/**
+ * Enables or disables combined I2C_RDWR transfers globally.  They are
+ * enabled by default, but ci2c_send_and_receive only uses one for a
+ * command with no execution time to wait out, which no command in the
+ * catalog has, so by default it never takes that path.
+ *
+ * @param enable True to use combined transfers when available
+ */
+void
+ci2c_set_combined_transfer (bool enable);
+
 /**
  * Idle the device. It will only respond to a wakeup after
  * this. However, internal volatile memory is preserved. Returns true
@@ -71,7 +222,8 @@ int
 ci2c_atmel_setup(const char *bus, unsigned int addr);
 
 /**
- * Sleeps the device and closes the file descriptor.
+ * Sleeps the device and closes the file descriptor through its
+ * transport.
  *
  * @param fd The open file descriptor
  *
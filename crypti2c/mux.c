@@ -0,0 +1,213 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mux.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "i2c.h"
+#include "log.h"
+
+/* Packed layout: the slave in bits 0-6, channel + 1 in bits 8-11 and
+   the mux in bits 16-22.  A zero channel field means the root. */
+#define ADDR_MASK 0x7F
+#define CHANNEL_SHIFT 8
+#define CHANNEL_MASK 0x0F
+#define MUX_SHIFT 16
+
+/* The state after a failed transfer: nothing matches */
+#define MUX_UNKNOWN -2
+
+#define KNOWN_BITS 32
+
+int
+ci2c_mux_encode (const struct ci2c_mux_route *route)
+{
+  assert (NULL != route);
+
+  if (route->addr < 0 || route->addr > ADDR_MASK)
+    return -1;
+
+  if (CI2C_MUX_NONE == route->mux_addr)
+    return route->addr;
+
+  if (route->mux_addr < 0 || route->mux_addr > ADDR_MASK
+      || route->channel < 0 || route->channel >= CI2C_MUX_CHANNELS)
+    return -1;
+
+  return (route->mux_addr << MUX_SHIFT)
+    | ((route->channel + 1) << CHANNEL_SHIFT)
+    | route->addr;
+}
+
+void
+ci2c_mux_decode (int addr, struct ci2c_mux_route *route)
+{
+  int channel = (addr >> CHANNEL_SHIFT) & CHANNEL_MASK;
+
+  assert (NULL != route);
+
+  route->addr = addr & ADDR_MASK;
+
+  if (addr < 0 || 0 == channel)
+    {
+      route->mux_addr = CI2C_MUX_NONE;
+      route->channel = 0;
+    }
+  else
+    {
+      route->mux_addr = (addr >> MUX_SHIFT) & ADDR_MASK;
+      route->channel = channel - 1;
+    }
+}
+
+bool
+ci2c_mux_same_channel (int a, int b)
+{
+  return (a & ~ADDR_MASK) == (b & ~ADDR_MASK);
+}
+
+void
+ci2c_mux_state_init (struct ci2c_mux_state *state, int addr)
+{
+  assert (NULL != state);
+
+  memset (state, 0, sizeof (*state));
+  state->mux_addr = CI2C_MUX_NONE;
+  state->addr = addr;
+}
+
+/* Other threads read the counters while the bus is in use */
+static void
+count (unsigned long *counter)
+{
+  __atomic_add_fetch (counter, 1, __ATOMIC_RELAXED);
+}
+
+/* Writes a channel mask to a mux */
+static int
+mux_write (int fd, struct ci2c_mux_state *state, int mux_addr, uint8_t mask)
+{
+  state->addr = -1;
+  count (&state->stats.acquires);
+
+  if (ci2c_acquire_bus (fd, mux_addr) < 0
+      || 1 != ci2c_write (fd, &mask, sizeof (mask)))
+    {
+      CI2C_LOG (WARNING, "Mux 0x%02x didn't take channel mask 0x%02x",
+                mux_addr, mask);
+      return -1;
+    }
+
+  state->addr = mux_addr;
+
+  return 0;
+}
+
+/* Turns off every mux the bus has selected except keep, when which
+   one is on isn't known */
+static int
+mux_reset (int fd, struct ci2c_mux_state *state, int keep)
+{
+  int mux;
+
+  for (mux = 0; mux <= ADDR_MASK; mux++)
+    {
+      if (mux == keep
+          || 0 == (state->known[mux / KNOWN_BITS] & (1u << mux % KNOWN_BITS)))
+        continue;
+
+      count (&state->stats.deselects);
+
+      if (mux_write (fd, state, mux, 0) < 0)
+        return -1;
+    }
+
+  return 0;
+}
+
+int
+ci2c_mux_acquire (int fd, struct ci2c_mux_state *state, int addr)
+{
+  struct ci2c_mux_route route;
+
+  assert (NULL != state);
+  assert (addr >= 0);
+
+  ci2c_mux_decode (addr, &route);
+
+  if (state->mux_addr == route.mux_addr
+      && (CI2C_MUX_NONE == route.mux_addr || state->channel == route.channel))
+    {
+      if (CI2C_MUX_NONE != route.mux_addr)
+        count (&state->stats.saved);
+    }
+  else
+    {
+      /* Turn the old mux off.  After an error which one that was
+         isn't known, so turn them all off; selecting the new mux
+         sets its whole channel mask anyway. */
+      if (MUX_UNKNOWN == state->mux_addr)
+        {
+          if (mux_reset (fd, state, route.mux_addr) < 0)
+            goto fail;
+        }
+      else if (state->mux_addr >= 0 && state->mux_addr != route.mux_addr)
+        {
+          count (&state->stats.deselects);
+
+          if (mux_write (fd, state, state->mux_addr, 0) < 0)
+            goto fail;
+        }
+
+      if (CI2C_MUX_NONE != route.mux_addr)
+        {
+          count (&state->stats.selects);
+          state->known[route.mux_addr / KNOWN_BITS] |=
+            1u << route.mux_addr % KNOWN_BITS;
+
+          if (mux_write (fd, state, route.mux_addr, 1 << route.channel) < 0)
+            goto fail;
+        }
+
+      state->mux_addr = route.mux_addr;
+      state->channel = route.channel;
+    }
+
+  if (state->addr == route.addr)
+    count (&state->stats.reuses);
+  else
+    {
+      count (&state->stats.acquires);
+
+      if (ci2c_acquire_bus (fd, route.addr) < 0)
+        goto fail;
+
+      state->addr = route.addr;
+    }
+
+  return 0;
+
+ fail:
+  state->mux_addr = MUX_UNKNOWN;
+  state->addr = -1;
+
+  return -1;
+}
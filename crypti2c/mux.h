@@ -0,0 +1,126 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MUX_H
+#define MUX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* PCA9548 style muxes: writing a byte to the mux enables the
+   channels whose bits are set.  Muxes are assumed to sit on the root
+   segment; cascades aren't described. */
+#define CI2C_MUX_CHANNELS 8
+#define CI2C_MUX_NONE -1
+
+/**
+ * Where a device sits.  Devices on the root segment have mux_addr
+ * CI2C_MUX_NONE; the channel is then ignored.
+ */
+struct ci2c_mux_route
+{
+  int mux_addr;                 /**< 7 bit address of the mux */
+  int channel;                  /**< 0 to CI2C_MUX_CHANNELS - 1 */
+  int addr;                     /**< 7 bit address of the device */
+};
+
+/* Address and channel switching on one bus */
+struct ci2c_mux_stats
+{
+  unsigned long acquires;       /**< Slave address ioctls issued */
+  unsigned long reuses;         /**< Acquires of the slave already
+                                   addressed, which issue nothing */
+  unsigned long selects;        /**< Channel select writes */
+  unsigned long deselects;      /**< Writes turning a mux off */
+  unsigned long saved;          /**< Muxed acquires that found their
+                                   channel already selected */
+  unsigned long regrouped;      /**< Jobs run early by the scheduler to
+                                   stay on the selected channel */
+};
+
+/* What one bus currently has selected */
+struct ci2c_mux_state
+{
+  int mux_addr;                 /**< The enabled mux, CI2C_MUX_NONE */
+  int channel;
+  int addr;                     /**< The slave address, -1 if unknown */
+  uint32_t known[4];            /**< Muxes ever selected, by address,
+                                   to turn off after an error */
+  struct ci2c_mux_stats stats;
+};
+
+/**
+ * Packs a route into a single slave address that can be used
+ * wherever the library takes one, e.g. ci2c_job.addr or
+ * ci2c_pool_add_device.  Root routes pack to the plain 7 bit
+ * address.  Packed addresses must be acquired with ci2c_mux_acquire.
+ *
+ * @param route The route
+ *
+ * @return The packed address, or -1 if the route is invalid
+ */
+int
+ci2c_mux_encode (const struct ci2c_mux_route *route);
+
+/**
+ * Unpacks an address made by ci2c_mux_encode.  Plain addresses
+ * decode to root routes.
+ *
+ * @param addr The packed address
+ * @param route Filled in with the route
+ */
+void
+ci2c_mux_decode (int addr, struct ci2c_mux_route *route);
+
+/**
+ * Returns true if two packed addresses sit behind the same mux
+ * channel, or are both on the root segment.
+ */
+bool
+ci2c_mux_same_channel (int a, int b);
+
+/**
+ * Initializes the state of a bus whose muxes are all off, as they
+ * are after power up.
+ *
+ * @param state The state
+ * @param addr The slave address currently acquired, -1 if none
+ */
+void
+ci2c_mux_state_init (struct ci2c_mux_state *state, int addr);
+
+/**
+ * Addresses a device, switching mux channels only when needed.
+ * Reaching a different mux turns the previous one off first, and so
+ * does reaching the root segment, so that devices with the same
+ * address on different channels never answer together.
+ *
+ * @param fd The open file descriptor
+ * @param state The bus's state
+ * @param addr A packed address
+ *
+ * @return 0 on success, -1 on error.  After an error the state is
+ * forgotten, so the next acquire turns off every mux the bus has
+ * selected before addressing the device.
+ */
+int
+ci2c_mux_acquire (int fd, struct ci2c_mux_state *state, int addr);
+
+#endif /* MUX_H */
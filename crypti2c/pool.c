@@ -0,0 +1,692 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "pool.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include "catalog.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+/* EWMA weight of a new service time, 1/8 */
+#define EWMA_SHIFT 3
+
+/* Latency histogram bucket i counts times up to 100us * 1.25^i;
+   counts are halved once HISTORY samples are held */
+#define BUCKETS 40
+#define BUCKET_BASE_USEC 100
+#define HISTORY 1024
+
+/* Hedge threshold for an opcode without enough history and without a
+   catalog entry */
+#define HEDGE_FALLBACK_USEC 50000
+
+struct hedge_leg
+{
+  struct ci2c_pool_request req;
+  struct ci2c_pool *pool;
+  bool in_use;
+  bool finished;
+  bool orphaned;                /* Lost the race, freed on completion */
+  /* Private copies, since a loser can outlive the caller's command and
+     the legs serialize concurrently */
+  struct Command_ATSHA204 cmd;
+  uint8_t data[CI2C_MAX_FRAME_LEN];
+  uint8_t rsp[CI2C_MAX_FRAME_LEN];
+};
+
+struct latency_hist
+{
+  unsigned int total;
+  unsigned int counts[BUCKETS];
+};
+
+struct pool_device
+{
+  unsigned int bus;
+  int addr;
+  unsigned int families;
+  uint16_t slots;
+
+  unsigned int in_flight;
+  unsigned long completed;
+  uint64_t ewma_usec;
+};
+
+struct ci2c_pool
+{
+  struct ci2c_sched *sched;
+  struct pool_device devices[CI2C_POOL_MAX_DEVICES];
+  unsigned int ndevices;
+
+  /* Jobs queued per bus, across every device on it.  A bus worker
+     runs one job at a time, so this is what a new job waits behind. */
+  unsigned int bus_load[CI2C_SCHED_MAX_BUSES];
+
+  /* Rotates the scan so ties spread over the devices */
+  unsigned int next;
+
+  /* Submit to completion, per opcode, for the hedge threshold */
+  struct latency_hist latency[256];
+  uint64_t bucket_limit[BUCKETS];
+  unsigned int hedge_pct;
+
+  struct hedge_leg legs[CI2C_POOL_HEDGE_LEGS];
+  struct ci2c_hedge_stats hedge;
+
+  pthread_mutex_t lock;
+  pthread_cond_t done_cond;
+  int waiters;
+};
+
+static unsigned int
+bucket_of (const struct ci2c_pool *pool, uint64_t usec)
+{
+  unsigned int x;
+
+  for (x = 0; x < BUCKETS - 1; x++)
+    if (usec <= pool->bucket_limit[x])
+      break;
+
+  return x;
+}
+
+/* Called with the pool locked */
+static void
+record_latency (struct ci2c_pool *pool, uint8_t opcode, uint64_t usec)
+{
+  struct latency_hist *h = &pool->latency[opcode];
+  unsigned int x;
+
+  h->counts[bucket_of (pool, usec)]++;
+
+  if (++h->total >= HISTORY)
+    {
+      h->total = 0;
+      for (x = 0; x < BUCKETS; x++)
+        {
+          h->counts[x] /= 2;
+          h->total += h->counts[x];
+        }
+    }
+}
+
+static bool
+can_run (const struct pool_device *d, unsigned int families, int slot)
+{
+  if (0 == (d->families & families))
+    return false;
+
+  return slot < 0 || (slot < 16 && (d->slots & (1U << slot)));
+}
+
+/* Expected wait for a new job: everything queued on the bus, plus the
+   job itself, at this device's pace */
+static uint64_t
+expected_usec (const struct ci2c_pool *pool, const struct pool_device *d)
+{
+  uint64_t service = __atomic_load_n (&d->ewma_usec, __ATOMIC_RELAXED);
+  unsigned int load = __atomic_load_n (&pool->bus_load[d->bus],
+                                       __ATOMIC_RELAXED);
+
+  if (0 == service)
+    service = CI2C_POOL_DEFAULT_SERVICE_USEC;
+
+  return (load + 1) * service;
+}
+
+static void
+pool_job_done (struct ci2c_job *job, void *arg)
+{
+  struct ci2c_pool_request *req = arg;
+  struct ci2c_pool *pool = req->pool;
+  struct pool_device *d = &pool->devices[req->device];
+  uint64_t service = ci2c_timespec_diff_usec (job->completed, job->started);
+  uint64_t ewma;
+  ci2c_pool_cb cb = req->cb;
+  void *cb_arg = req->cb_arg;
+
+  /* Only the bus worker updates a device's statistics.  Cancelled
+     jobs never reached the device and say nothing about it. */
+  if (RSP_CANCELLED != job->status)
+    {
+      ewma = d->ewma_usec;
+      ewma = (0 == ewma) ? service : ewma - (ewma >> EWMA_SHIFT)
+        + (service >> EWMA_SHIFT);
+      __atomic_store_n (&d->ewma_usec, ewma, __ATOMIC_RELAXED);
+
+      pthread_mutex_lock (&pool->lock);
+      record_latency (pool, job->cmd->opcode,
+                      ci2c_timespec_diff_usec (job->completed,
+                                               job->submitted));
+      pthread_mutex_unlock (&pool->lock);
+    }
+
+  __atomic_add_fetch (&d->completed, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch (&d->in_flight, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch (&pool->bus_load[d->bus], 1, __ATOMIC_RELAXED);
+
+  __atomic_store_n (&req->done, 1, __ATOMIC_SEQ_CST);
+
+  if (NULL != cb)
+    {
+      cb (req, cb_arg);
+      return;
+    }
+
+  if (__atomic_load_n (&pool->waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+      pthread_mutex_lock (&pool->lock);
+      pthread_cond_broadcast (&pool->done_cond);
+      pthread_mutex_unlock (&pool->lock);
+    }
+}
+
+struct ci2c_pool *
+ci2c_pool_new (struct ci2c_sched *sched)
+{
+  struct ci2c_pool *pool;
+  pthread_condattr_t attr;
+  unsigned int x;
+
+  assert (NULL != sched);
+
+  pool = (struct ci2c_pool *)ci2c_malloc_wipe (sizeof (struct ci2c_pool));
+
+  pool->sched = sched;
+  pool->hedge_pct = CI2C_POOL_HEDGE_PERCENTILE;
+
+  pool->bucket_limit[0] = BUCKET_BASE_USEC;
+  for (x = 1; x < BUCKETS; x++)
+    pool->bucket_limit[x] = pool->bucket_limit[x - 1]
+      + pool->bucket_limit[x - 1] / 4;
+
+  for (x = 0; x < CI2C_POOL_HEDGE_LEGS; x++)
+    pool->legs[x].pool = pool;
+
+  /* Hedging waits with a monotonic timeout */
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->done_cond, &attr);
+  pthread_condattr_destroy (&attr);
+
+  return pool;
+}
+
+int
+ci2c_pool_add_device (struct ci2c_pool *pool, unsigned int bus, int addr,
+                      unsigned int families, uint16_t slots)
+{
+  struct pool_device *d;
+  int index = -1;
+
+  assert (NULL != pool);
+
+  if (bus >= ci2c_sched_bus_count (pool->sched) || addr < 0)
+    return -1;
+
+  pthread_mutex_lock (&pool->lock);
+
+  if (pool->ndevices < CI2C_POOL_MAX_DEVICES)
+    {
+      d = &pool->devices[pool->ndevices];
+      memset (d, 0, sizeof (*d));
+      d->bus = bus;
+      d->addr = addr;
+      d->families = families;
+      d->slots = slots;
+
+      index = pool->ndevices;
+      __atomic_store_n (&pool->ndevices, pool->ndevices + 1,
+                        __ATOMIC_RELEASE);
+    }
+
+  pthread_mutex_unlock (&pool->lock);
+
+  return index;
+}
+
+unsigned int
+ci2c_pool_device_count (const struct ci2c_pool *pool)
+{
+  assert (NULL != pool);
+
+  return __atomic_load_n (&pool->ndevices, __ATOMIC_ACQUIRE);
+}
+
+/* Finds the device expected to finish a new job soonest */
+static int
+pick_device (struct ci2c_pool *pool, unsigned int families, int slot,
+             int exclude)
+{
+  unsigned int n = ci2c_pool_device_count (pool);
+  unsigned int start, x, i;
+  uint64_t best_usec = UINT64_MAX, usec;
+  int best = -1;
+  struct pool_device *d;
+
+  start = __atomic_fetch_add (&pool->next, 1, __ATOMIC_RELAXED);
+
+  for (i = 0; i < n; i++)
+    {
+      x = (start + i) % n;
+      d = &pool->devices[x];
+
+      if (x == exclude || !can_run (d, families, slot))
+        continue;
+
+      if ((usec = expected_usec (pool, d)) < best_usec)
+        {
+          best_usec = usec;
+          best = x;
+        }
+    }
+
+  return best;
+}
+
+static unsigned int
+opcode_families (uint8_t opcode)
+{
+  const struct ci2c_opcode_info *info = ci2c_catalog_lookup (opcode);
+
+  return (NULL != info) ? info->families : ~0U;
+}
+
+int
+ci2c_pool_submit (struct ci2c_pool *pool, struct ci2c_pool_request *req)
+{
+  unsigned int families;
+  int best = -1;
+  struct pool_device *d;
+
+  assert (NULL != req);
+  assert (NULL != req->job.cmd);
+
+  families = opcode_families (req->job.cmd->opcode);
+
+  if (req->device >= 0)
+    {
+      if (req->device < ci2c_pool_device_count (pool)
+          && can_run (&pool->devices[req->device], families, req->slot))
+        best = req->device;
+    }
+  else
+    {
+      best = pick_device (pool, families, req->slot, -1);
+    }
+
+  if (best < 0)
+    {
+      CI2C_LOG (DEBUG, "No pooled device for opcode 0x%02X slot %d",
+                req->job.cmd->opcode, req->slot);
+      return -1;
+    }
+
+  d = &pool->devices[best];
+
+  req->device = best;
+  req->pool = pool;
+  req->done = 0;
+  req->job.addr = d->addr;
+  req->job.cb = pool_job_done;
+  req->job.cb_arg = req;
+
+  __atomic_add_fetch (&d->in_flight, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&pool->bus_load[d->bus], 1, __ATOMIC_RELAXED);
+
+  if (ci2c_sched_submit (pool->sched, d->bus, &req->job) < 0)
+    {
+      __atomic_sub_fetch (&d->in_flight, 1, __ATOMIC_RELAXED);
+      __atomic_sub_fetch (&pool->bus_load[d->bus], 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+
+  return best;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_pool_wait (struct ci2c_pool *pool, struct ci2c_pool_request *req)
+{
+  assert (NULL != pool);
+  assert (NULL != req);
+
+  if (__atomic_load_n (&req->done, __ATOMIC_ACQUIRE))
+    return req->job.status;
+
+  pthread_mutex_lock (&pool->lock);
+  __atomic_add_fetch (&pool->waiters, 1, __ATOMIC_SEQ_CST);
+
+  while (!__atomic_load_n (&req->done, __ATOMIC_SEQ_CST))
+    pthread_cond_wait (&pool->done_cond, &pool->lock);
+
+  __atomic_sub_fetch (&pool->waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock (&pool->lock);
+
+  return req->job.status;
+}
+
+int
+ci2c_pool_device_stats (const struct ci2c_pool *pool, unsigned int device,
+                        struct ci2c_pool_device_stats *stats)
+{
+  const struct pool_device *d;
+
+  assert (NULL != pool);
+  assert (NULL != stats);
+
+  if (device >= ci2c_pool_device_count (pool))
+    return -1;
+
+  d = &pool->devices[device];
+
+  stats->bus = d->bus;
+  stats->addr = d->addr;
+  stats->in_flight = __atomic_load_n (&d->in_flight, __ATOMIC_RELAXED);
+  stats->completed = __atomic_load_n (&d->completed, __ATOMIC_RELAXED);
+  stats->ewma_service_usec = __atomic_load_n (&d->ewma_usec,
+                                              __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+void
+ci2c_pool_set_hedge_percentile (struct ci2c_pool *pool, unsigned int pct)
+{
+  assert (NULL != pool);
+  assert (pct > 0 && pct < 100);
+
+  pthread_mutex_lock (&pool->lock);
+  pool->hedge_pct = pct;
+  pthread_mutex_unlock (&pool->lock);
+}
+
+uint64_t
+ci2c_pool_hedge_threshold_usec (struct ci2c_pool *pool, uint8_t opcode)
+{
+  const struct ci2c_opcode_info *info;
+  struct latency_hist *h;
+  unsigned int x, sum = 0, want;
+  uint64_t usec = 0;
+
+  assert (NULL != pool);
+
+  pthread_mutex_lock (&pool->lock);
+
+  h = &pool->latency[opcode];
+
+  if (h->total >= CI2C_POOL_HEDGE_MIN_SAMPLES)
+    {
+      want = (h->total * pool->hedge_pct + 99) / 100;
+
+      for (x = 0; x < BUCKETS; x++)
+        if ((sum += h->counts[x]) >= want)
+          break;
+
+      usec = pool->bucket_limit[x < BUCKETS ? x : BUCKETS - 1];
+    }
+
+  pthread_mutex_unlock (&pool->lock);
+
+  if (0 == usec)
+    usec = (NULL != (info = ci2c_catalog_lookup (opcode))) ?
+      info->max_usec : HEDGE_FALLBACK_USEC;
+
+  return usec;
+}
+
+/* Called with the pool locked */
+static struct hedge_leg *
+leg_alloc (struct ci2c_pool *pool)
+{
+  unsigned int x;
+
+  for (x = 0; x < CI2C_POOL_HEDGE_LEGS; x++)
+    if (!pool->legs[x].in_use)
+      {
+        pool->legs[x].in_use = true;
+        pool->legs[x].finished = false;
+        pool->legs[x].orphaned = false;
+        return &pool->legs[x];
+      }
+
+  return NULL;
+}
+
+/* Called with the pool locked */
+static void
+leg_free (struct hedge_leg *leg)
+{
+  ci2c_wipe (leg->data, sizeof (leg->data));
+  ci2c_wipe (leg->rsp, sizeof (leg->rsp));
+  leg->in_use = false;
+}
+
+static void
+hedge_leg_done (struct ci2c_pool_request *req, void *arg)
+{
+  struct hedge_leg *leg = arg;
+  struct ci2c_pool *pool = leg->pool;
+
+  pthread_mutex_lock (&pool->lock);
+
+  leg->finished = true;
+
+  if (leg->orphaned)
+    {
+      if (RSP_CANCELLED == req->job.status)
+        pool->hedge.cancelled++;
+      else
+        pool->hedge.wasted++;
+
+      leg_free (leg);
+    }
+
+  pthread_cond_broadcast (&pool->done_cond);
+
+  pthread_mutex_unlock (&pool->lock);
+}
+
+static void
+leg_init (struct hedge_leg *leg, struct Command_ATSHA204 *cmd,
+          unsigned int rsp_len, int slot, int device)
+{
+  leg->cmd = *cmd;
+  if (cmd->data_len > 0)
+    {
+      memcpy (leg->data, cmd->data, cmd->data_len);
+      leg->cmd.data = leg->data;
+    }
+
+  memset (&leg->req, 0, sizeof (leg->req));
+  leg->req.job.cmd = &leg->cmd;
+  leg->req.job.rsp = leg->rsp;
+  leg->req.job.rsp_len = rsp_len;
+  leg->req.slot = slot;
+  leg->req.device = device;
+  leg->req.cb = hedge_leg_done;
+  leg->req.cb_arg = leg;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_pool_process_hedged (struct ci2c_pool *pool,
+                          struct Command_ATSHA204 *cmd, int slot,
+                          uint8_t *rsp, unsigned int rsp_len, int *device)
+{
+  struct ci2c_pool_request plain;
+  struct hedge_leg *a, *b = NULL, *winner, *loser;
+  struct timespec deadline;
+  enum CI2C_STATUS_RESPONSE status;
+  int backup;
+
+  assert (NULL != pool);
+  assert (NULL != cmd);
+  assert (NULL != rsp);
+
+  pthread_mutex_lock (&pool->lock);
+  a = (rsp_len <= sizeof (a->rsp) && cmd->data_len <= sizeof (a->data)) ?
+    leg_alloc (pool) : NULL;
+  pthread_mutex_unlock (&pool->lock);
+
+  /* Out of legs: run it unhedged */
+  if (NULL == a)
+    {
+      memset (&plain, 0, sizeof (plain));
+      plain.job.cmd = cmd;
+      plain.job.rsp = rsp;
+      plain.job.rsp_len = rsp_len;
+      plain.slot = slot;
+      plain.device = -1;
+
+      if (ci2c_pool_submit (pool, &plain) < 0)
+        return RSP_COMM_ERROR;
+
+      status = ci2c_pool_wait (pool, &plain);
+
+      if (NULL != device)
+        *device = plain.device;
+
+      return status;
+    }
+
+  leg_init (a, cmd, rsp_len, slot, -1);
+
+  deadline = ci2c_deadline_after_usec
+    (ci2c_pool_hedge_threshold_usec (pool, cmd->opcode));
+
+  if (ci2c_pool_submit (pool, &a->req) < 0)
+    {
+      pthread_mutex_lock (&pool->lock);
+      leg_free (a);
+      pthread_mutex_unlock (&pool->lock);
+      return RSP_COMM_ERROR;
+    }
+
+  pthread_mutex_lock (&pool->lock);
+
+  pool->hedge.requests++;
+
+  while (!a->finished
+         && ETIMEDOUT != pthread_cond_timedwait (&pool->done_cond,
+                                                 &pool->lock, &deadline))
+    ;
+
+  if (!a->finished && NULL != (b = leg_alloc (pool)))
+    {
+      pthread_mutex_unlock (&pool->lock);
+
+      backup = pick_device (pool, opcode_families (cmd->opcode), slot,
+                            a->req.device);
+
+      if (backup >= 0)
+        {
+          leg_init (b, cmd, rsp_len, slot, backup);
+          if (ci2c_pool_submit (pool, &b->req) < 0)
+            backup = -1;
+        }
+
+      pthread_mutex_lock (&pool->lock);
+
+      if (backup < 0)
+        {
+          leg_free (b);
+          b = NULL;
+        }
+      else
+        {
+          pool->hedge.hedges++;
+        }
+    }
+
+  while (!a->finished && !(NULL != b && b->finished))
+    pthread_cond_wait (&pool->done_cond, &pool->lock);
+
+  winner = a->finished ? a : b;
+  loser = (winner == a) ? b : a;
+
+  status = winner->req.job.status;
+  memcpy (rsp, winner->rsp, rsp_len);
+
+  if (NULL != device)
+    *device = winner->req.device;
+
+  if (NULL != loser)
+    {
+      if (winner == a)
+        pool->hedge.primary_wins++;
+      else
+        pool->hedge.backup_wins++;
+
+      if (loser->finished)
+        {
+          pool->hedge.wasted++;
+          leg_free (loser);
+        }
+      else
+        {
+          /* Stop it at the next command boundary; its completion
+             frees the leg */
+          loser->orphaned = true;
+          ci2c_job_cancel (&loser->req.job);
+        }
+    }
+
+  leg_free (winner);
+
+  pthread_mutex_unlock (&pool->lock);
+
+  return status;
+}
+
+void
+ci2c_pool_hedge_stats (struct ci2c_pool *pool, struct ci2c_hedge_stats *stats)
+{
+  assert (NULL != pool);
+  assert (NULL != stats);
+
+  pthread_mutex_lock (&pool->lock);
+  *stats = pool->hedge;
+  pthread_mutex_unlock (&pool->lock);
+}
+
+void
+ci2c_pool_free (struct ci2c_pool *pool)
+{
+  unsigned int x;
+
+  if (NULL == pool)
+    return;
+
+  /* Hedge losers may still be queued */
+  pthread_mutex_lock (&pool->lock);
+  for (x = 0; x < CI2C_POOL_HEDGE_LEGS; x++)
+    while (pool->legs[x].in_use)
+      pthread_cond_wait (&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+
+  pthread_cond_destroy (&pool->done_cond);
+  pthread_mutex_destroy (&pool->lock);
+
+  ci2c_free_wipe ((uint8_t *)pool, sizeof (struct ci2c_pool));
+}
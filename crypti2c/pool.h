@@ -0,0 +1,236 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+#define CI2C_POOL_MAX_DEVICES 32
+
+/* Dispatch estimate for a device that hasn't completed anything yet */
+#define CI2C_POOL_DEFAULT_SERVICE_USEC 1000
+
+/* A hedged request goes to a second device once it has taken longer
+   than this percentile of its opcode's recent latencies.  Until
+   enough have been seen the catalog's maximum execution time is
+   used. */
+#define CI2C_POOL_HEDGE_PERCENTILE 95
+#define CI2C_POOL_HEDGE_MIN_SAMPLES 32
+
+/* Hedged requests in flight at once, two legs each.  Beyond that
+   requests run unhedged. */
+#define CI2C_POOL_HEDGE_LEGS 64
+
+struct ci2c_pool;
+struct ci2c_pool_request;
+
+/* Called on the bus worker thread once a request has finished */
+typedef void (*ci2c_pool_cb) (struct ci2c_pool_request *req, void *arg);
+
+/**
+ * A command for whichever pooled device can run it soonest.  The
+ * caller fills in job.cmd, job.rsp and job.rsp_len; the pool sets the
+ * rest of the job.  Requests stay owned by the caller until they
+ * complete.
+ */
+struct ci2c_pool_request
+{
+  struct ci2c_job job;
+  int slot;                     /**< Key slot the command needs, -1 if
+                                   none */
+  int device;                   /**< In: the device to use, -1 for any.
+                                   Out: the device used.  Pass it back
+                                   in for the next step of a flow that
+                                   relies on TempKey. */
+  ci2c_pool_cb cb;
+  void *cb_arg;
+
+  /* Internal */
+  struct ci2c_pool *pool;
+  int done;
+};
+
+/* Load and latency of one pooled device */
+struct ci2c_pool_device_stats
+{
+  unsigned int bus;
+  int addr;
+  unsigned int in_flight;
+  unsigned long completed;
+  uint64_t ewma_service_usec;   /**< Start to finish of a command */
+};
+
+/**
+ * Creates a pool of devices on a scheduler's buses.  The scheduler
+ * must outlive the pool.
+ *
+ * @param sched The scheduler
+ *
+ * @return The pool, NULL on error
+ */
+struct ci2c_pool *
+ci2c_pool_new (struct ci2c_sched *sched);
+
+/**
+ * Adds a device.  Devices should be added before requests are
+ * submitted.
+ *
+ * @param pool The pool
+ * @param bus The scheduler bus index
+ * @param addr The slave address
+ * @param families The CI2C_FAMILY_* mask of the part, which decides
+ * the opcodes it is given
+ * @param slots Bit n set if key slot n is provisioned on this part
+ *
+ * @return The device index, or -1 if the pool is full or the bus
+ * doesn't exist
+ */
+int
+ci2c_pool_add_device (struct ci2c_pool *pool, unsigned int bus, int addr,
+                      unsigned int families, uint16_t slots);
+
+/**
+ * Queues a request on the device expected to finish it soonest: the
+ * one whose bus backlog times its observed service time is smallest,
+ * among those that implement the opcode and hold the slot.  Safe to
+ * call from any thread.
+ *
+ * @param pool The pool
+ * @param req The request
+ *
+ * @return The device index, -1 if no device can run the request
+ */
+int
+ci2c_pool_submit (struct ci2c_pool *pool, struct ci2c_pool_request *req);
+
+/**
+ * Blocks until a request without a callback completes.
+ *
+ * @param pool The pool
+ * @param req The request
+ *
+ * @return The request's status
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_pool_wait (struct ci2c_pool *pool, struct ci2c_pool_request *req);
+
+/**
+ * Returns the number of devices.
+ *
+ * @param pool The pool
+ */
+unsigned int
+ci2c_pool_device_count (const struct ci2c_pool *pool);
+
+/**
+ * Copies out one device's load and latency.
+ *
+ * @param pool The pool
+ * @param device The device index
+ * @param stats Filled in with the statistics
+ *
+ * @return 0 on success, -1 if the device doesn't exist
+ */
+int
+ci2c_pool_device_stats (const struct ci2c_pool *pool, unsigned int device,
+                        struct ci2c_pool_device_stats *stats);
+
+/* How hedging has gone, across the life of a pool */
+struct ci2c_hedge_stats
+{
+  unsigned long requests;       /**< Hedged requests */
+  unsigned long hedges;         /**< That went to a second device */
+  unsigned long primary_wins;   /**< Hedged, but the first device won */
+  unsigned long backup_wins;    /**< The second device won */
+  unsigned long cancelled;      /**< Losers dropped before they ran */
+  unsigned long wasted;         /**< Losers that ran anyway */
+};
+
+/**
+ * Sets the latency percentile past which hedged requests are sent to
+ * a second device.
+ *
+ * @param pool The pool
+ * @param pct The percentile, 1 to 99
+ */
+void
+ci2c_pool_set_hedge_percentile (struct ci2c_pool *pool, unsigned int pct);
+
+/**
+ * Returns how long a hedged request for an opcode waits before it is
+ * hedged.
+ *
+ * @param pool The pool
+ * @param opcode The opcode
+ */
+uint64_t
+ci2c_pool_hedge_threshold_usec (struct ci2c_pool *pool, uint8_t opcode);
+
+/**
+ * Runs a command on the pool and blocks for its result, hedging it:
+ * if the first device hasn't answered by the hedge threshold, the
+ * same command is sent to another device that can run it, and the
+ * first answer wins.  The loser is cancelled before it reaches its
+ * device if it hasn't started yet.  Only use this for commands that
+ * can safely run twice, e.g. Random, MAC over a replicated key or
+ * Verify.  Each device gets its own copy of the command, so it may be
+ * freed as soon as this returns, even while the loser is running.
+ *
+ * @param pool The pool
+ * @param cmd The command
+ * @param slot The key slot the command needs, -1 if none
+ * @param rsp The response buffer
+ * @param rsp_len The expected response length
+ * @param device Set to the device that answered.  May be NULL.
+ *
+ * @return The winning response's status, RSP_COMM_ERROR if no device
+ * can run the command
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_pool_process_hedged (struct ci2c_pool *pool,
+                          struct Command_ATSHA204 *cmd,
+                          int slot,
+                          uint8_t *rsp,
+                          unsigned int rsp_len,
+                          int *device);
+
+/**
+ * Copies out the hedging statistics.
+ *
+ * @param pool The pool
+ * @param stats Filled in with the statistics
+ */
+void
+ci2c_pool_hedge_stats (struct ci2c_pool *pool,
+                       struct ci2c_hedge_stats *stats);
+
+/**
+ * Frees the pool, after waiting for the losers of hedged requests.
+ * Every other request must have completed.
+ *
+ * @param pool The pool
+ */
+void
+ci2c_pool_free (struct ci2c_pool *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,89 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "queue.h"
+#include <assert.h>
+#include <stddef.h>
+
+void
+ci2c_mpsc_init (struct ci2c_mpsc *q)
+{
+  assert (NULL != q);
+
+  q->stub.next = NULL;
+  q->head = &q->stub;
+  q->tail = &q->stub;
+}
+
+void
+ci2c_mpsc_push (struct ci2c_mpsc *q, struct ci2c_mpsc_node *n)
+{
+  struct ci2c_mpsc_node *prev;
+
+  assert (NULL != q);
+  assert (NULL != n);
+
+  __atomic_store_n (&n->next, NULL, __ATOMIC_RELAXED);
+
+  prev = __atomic_exchange_n (&q->head, n, __ATOMIC_ACQ_REL);
+
+  /* Between the exchange and this store the consumer can't see n */
+  __atomic_store_n (&prev->next, n, __ATOMIC_RELEASE);
+}
+
+struct ci2c_mpsc_node *
+ci2c_mpsc_pop (struct ci2c_mpsc *q)
+{
+  struct ci2c_mpsc_node *tail = q->tail;
+  struct ci2c_mpsc_node *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+
+  if (&q->stub == tail)
+    {
+      if (NULL == next)
+        return NULL;
+
+      q->tail = next;
+      tail = next;
+      next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+
+  if (NULL != next)
+    {
+      q->tail = next;
+      return tail;
+    }
+
+  /* tail is the last node.  Put the stub behind it so it can be
+     handed out, unless a producer is mid-push. */
+  if (tail != __atomic_load_n (&q->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  ci2c_mpsc_push (q, &q->stub);
+
+  next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+
+  if (NULL != next)
+    {
+      q->tail = next;
+      return tail;
+    }
+
+  return NULL;
+}
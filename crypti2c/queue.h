@@ -0,0 +1,75 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdbool.h>
+
+/* An intrusive, lock-free, multi-producer single-consumer FIFO
+   (Vyukov).  Nodes are embedded in the caller's structs, so pushing
+   never allocates. */
+
+struct ci2c_mpsc_node
+{
+  struct ci2c_mpsc_node *next;
+};
+
+struct ci2c_mpsc
+{
+  struct ci2c_mpsc_node *head;  /* Producers swap in here */
+  struct ci2c_mpsc_node *tail;  /* The consumer pops from here */
+  struct ci2c_mpsc_node stub;
+};
+
+/**
+ * Initializes an empty queue.
+ *
+ * @param q The queue
+ */
+void
+ci2c_mpsc_init (struct ci2c_mpsc *q);
+
+/**
+ * Appends a node.  Safe to call from any number of threads.
+ *
+ * @param q The queue
+ * @param n The node, which must not already be queued
+ */
+void
+ci2c_mpsc_push (struct ci2c_mpsc *q, struct ci2c_mpsc_node *n);
+
+/**
+ * Removes the oldest node.  Only one thread may pop.  This can return
+ * NULL while a push is half way through, so callers that know a node
+ * is coming should retry.
+ *
+ * @param q The queue
+ *
+ * @return The node or NULL
+ */
+struct ci2c_mpsc_node *
+ci2c_mpsc_pop (struct ci2c_mpsc *q);
+
+/* Recovers the containing struct from an embedded node */
+#define CI2C_CONTAINER_OF(ptr, type, member)                    \
+  ((type *)((char *)(ptr) - __builtin_offsetof (type, member)))
+
+#endif /* QUEUE_H */
@@ -0,0 +1,454 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "random_pool.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <string.h>
+#include "catalog.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+#define RING_MASK (CI2C_RANDOM_POOL_CHUNKS - 1)
+
+/* Random mode bits */
+#define RANDOM_MODE_SEED 0x00
+#define RANDOM_MODE_NO_SEED 0x01
+
+/* A slot of the ring.  seq says whose turn it is (Vyukov's bounded
+   queue): equal to the position, the producer may fill it; one past
+   it, a consumer may take it. */
+struct chunk
+{
+  uint64_t seq;
+  uint8_t bytes[CI2C_RANDOM_CHUNK_LEN];
+};
+
+struct ci2c_random_pool
+{
+  struct chunk ring[CI2C_RANDOM_POOL_CHUNKS];
+  uint64_t head __attribute__ ((aligned (64))); /* Consumers */
+  uint64_t tail __attribute__ ((aligned (64))); /* The refill thread */
+  unsigned long id;
+
+  struct ci2c_sched *sched;
+  unsigned int bus;
+  int addr;
+  struct ci2c_random_config cfg;
+
+  pthread_t thread;
+  sem_t kick;
+  int kicked;
+  int stopping;
+  int failing;
+
+  /* Only used when the ring runs dry */
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  int waiters;
+
+  struct ci2c_random_stats stats;
+};
+
+/* What this thread took off a ring and hasn't handed out yet */
+struct slice
+{
+  unsigned long pool_id;
+  uint8_t bytes[CI2C_RANDOM_CHUNK_LEN];
+  unsigned int left;            /**< Unserved bytes, at the end */
+};
+
+static __thread struct slice slice;
+static unsigned long next_pool_id = 1;
+
+#define STAT_ADD(pool, field, n)                                        \
+  __atomic_add_fetch (&(pool)->stats.field, (n), __ATOMIC_RELAXED)
+
+static unsigned int
+ring_level (struct ci2c_random_pool *pool)
+{
+  /* Head first: the tail only grows, so this can't go negative */
+  uint64_t head = __atomic_load_n (&pool->head, __ATOMIC_ACQUIRE);
+
+  return __atomic_load_n (&pool->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+/* Takes the oldest chunk, wiping it from the ring */
+static bool
+ring_take (struct ci2c_random_pool *pool, uint8_t *out)
+{
+  struct chunk *c;
+  uint64_t pos, seq;
+
+  pos = __atomic_load_n (&pool->head, __ATOMIC_RELAXED);
+
+  for (;;)
+    {
+      c = &pool->ring[pos & RING_MASK];
+      seq = __atomic_load_n (&c->seq, __ATOMIC_ACQUIRE);
+
+      if (seq == pos + 1)
+        {
+          if (__atomic_compare_exchange_n (&pool->head, &pos, pos + 1, true,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+            break;
+        }
+      else if ((int64_t)(seq - (pos + 1)) < 0)
+        return false;
+      else
+        pos = __atomic_load_n (&pool->head, __ATOMIC_RELAXED);
+    }
+
+  memcpy (out, c->bytes, sizeof (c->bytes));
+  ci2c_wipe (c->bytes, sizeof (c->bytes));
+
+  /* Hand the slot back to the producer for the next lap */
+  __atomic_store_n (&c->seq, pos + CI2C_RANDOM_POOL_CHUNKS, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static void
+maybe_kick (struct ci2c_random_pool *pool)
+{
+  if (ring_level (pool) > pool->cfg.low)
+    return;
+
+  if (0 == __atomic_exchange_n (&pool->kicked, 1, __ATOMIC_ACQ_REL))
+    {
+      STAT_ADD (pool, kicks, 1);
+      sem_post (&pool->kick);
+    }
+}
+
+/* Runs n Randoms as one batch straight into the next free slots and
+   publishes the ones that succeeded.  Returns how many did. */
+static unsigned int
+refill_batch (struct ci2c_random_pool *pool, struct Command_ATSHA204 *cmd,
+              unsigned int n)
+{
+  struct ci2c_batch_cmd cmds[CI2C_RANDOM_REFILL_BATCH];
+  struct ci2c_job job;
+  struct chunk *c;
+  unsigned int x, done = 0;
+
+  assert (n > 0 && n <= CI2C_RANDOM_REFILL_BATCH);
+
+  for (x = 0; x < n; x++)
+    {
+      c = &pool->ring[(pool->tail + x) & RING_MASK];
+
+      /* A consumer that just claimed the slot may still be copying */
+      while (__atomic_load_n (&c->seq, __ATOMIC_ACQUIRE) != pool->tail + x)
+        sched_yield ();
+
+      memset (&cmds[x], 0, sizeof (cmds[x]));
+      cmds[x].cmd = cmd;
+      cmds[x].rsp = c->bytes;
+      cmds[x].rsp_len = sizeof (c->bytes);
+    }
+
+  memset (&job, 0, sizeof (job));
+  job.addr = pool->addr;
+  job.priority = PRIO_BULK;
+
+  if (0 == ci2c_sched_submit_batch (pool->sched, pool->bus, &job, cmds, n))
+    ci2c_job_wait (pool->sched, &job);
+
+  /* The batch stops at the first failure */
+  for (x = 0; x < n; x++)
+    {
+      if (x == done && cmds[x].ran && RSP_SUCCESS == cmds[x].status)
+        {
+          done++;
+          continue;
+        }
+
+      ci2c_wipe (cmds[x].rsp, cmds[x].rsp_len);
+    }
+
+  for (x = 0; x < done; x++)
+    {
+      c = &pool->ring[pool->tail & RING_MASK];
+      __atomic_store_n (&c->seq, pool->tail + 1, __ATOMIC_RELEASE);
+      /* Sequentially consistent so wake_waiters' load of waiters can't
+         be ordered before it, see take_chunk */
+      __atomic_store_n (&pool->tail, pool->tail + 1, __ATOMIC_SEQ_CST);
+    }
+
+  return done;
+}
+
+static void
+wake_waiters (struct ci2c_random_pool *pool)
+{
+  if (__atomic_load_n (&pool->waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+      pthread_mutex_lock (&pool->lock);
+      pthread_cond_broadcast (&pool->filled);
+      pthread_mutex_unlock (&pool->lock);
+    }
+}
+
+static void *
+refill_main (void *arg)
+{
+  struct ci2c_random_pool *pool = arg;
+  struct Command_ATSHA204 cmd;
+  unsigned int level, want, got;
+
+  ci2c_command_init (&cmd, CI2C_OP_RANDOM,
+                     pool->cfg.update_seed ?
+                     RANDOM_MODE_SEED : RANDOM_MODE_NO_SEED,
+                     0, NULL, 0);
+
+  for (;;)
+    {
+      while (sem_wait (&pool->kick) < 0 && EINTR == errno)
+        ;
+
+      if (__atomic_load_n (&pool->stopping, __ATOMIC_ACQUIRE))
+        break;
+
+      /* Consumers may kick again from here on */
+      __atomic_store_n (&pool->kicked, 0, __ATOMIC_RELEASE);
+
+      while ((level = ring_level (pool)) < pool->cfg.high
+             && !__atomic_load_n (&pool->stopping, __ATOMIC_ACQUIRE))
+        {
+          want = pool->cfg.high - level;
+          if (want > CI2C_RANDOM_REFILL_BATCH)
+            want = CI2C_RANDOM_REFILL_BATCH;
+
+          if ((got = refill_batch (pool, &cmd, want)) > 0)
+            {
+              STAT_ADD (pool, refills, got);
+              __atomic_store_n (&pool->failing, 0, __ATOMIC_RELEASE);
+              wake_waiters (pool);
+            }
+
+          if (got == want)
+            continue;
+
+          STAT_ADD (pool, failures, 1);
+          CI2C_LOG (WARNING, "Random pool refill failed");
+
+          __atomic_store_n (&pool->failing, 1, __ATOMIC_SEQ_CST);
+          wake_waiters (pool);
+          ci2c_sleep_usec (CI2C_RANDOM_FAILURE_BACKOFF_USEC);
+          break;
+        }
+    }
+
+  return NULL;
+}
+
+/* Takes a chunk, waiting for the refill thread if the ring is dry */
+static bool
+take_chunk (struct ci2c_random_pool *pool, uint8_t *out)
+{
+  bool waited = false;
+
+  for (;;)
+    {
+      if (ring_take (pool, out))
+        {
+          STAT_ADD (pool, chunks_served, 1);
+          maybe_kick (pool);
+          return true;
+        }
+
+      maybe_kick (pool);
+
+      if (waited && __atomic_load_n (&pool->failing, __ATOMIC_ACQUIRE))
+        return false;
+
+      if (!waited)
+        STAT_ADD (pool, empty_waits, 1);
+
+      pthread_mutex_lock (&pool->lock);
+      __atomic_add_fetch (&pool->waiters, 1, __ATOMIC_SEQ_CST);
+
+      /* Either the refill thread sees us waiting or we see its chunks */
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+      while (0 == ring_level (pool)
+             && !__atomic_load_n (&pool->failing, __ATOMIC_SEQ_CST))
+        pthread_cond_wait (&pool->filled, &pool->lock);
+
+      __atomic_sub_fetch (&pool->waiters, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock (&pool->lock);
+
+      waited = true;
+    }
+}
+
+void
+ci2c_random_config_defaults (struct ci2c_random_config *cfg)
+{
+  assert (NULL != cfg);
+
+  cfg->low = CI2C_RANDOM_DEFAULT_LOW;
+  cfg->high = CI2C_RANDOM_DEFAULT_HIGH;
+  cfg->update_seed = true;
+}
+
+struct ci2c_random_pool *
+ci2c_random_pool_new (struct ci2c_sched *sched, unsigned int bus, int addr,
+                      const struct ci2c_random_config *cfg)
+{
+  struct ci2c_random_pool *pool;
+  unsigned int x;
+
+  assert (NULL != sched);
+
+  if (NULL != cfg
+      && (cfg->high > CI2C_RANDOM_POOL_CHUNKS || cfg->low >= cfg->high))
+    return NULL;
+
+  pool = (struct ci2c_random_pool *)
+    ci2c_malloc_wipe (sizeof (struct ci2c_random_pool));
+
+  for (x = 0; x < CI2C_RANDOM_POOL_CHUNKS; x++)
+    pool->ring[x].seq = x;
+
+  pool->id = __atomic_fetch_add (&next_pool_id, 1, __ATOMIC_RELAXED);
+  pool->sched = sched;
+  pool->bus = bus;
+  pool->addr = addr;
+
+  if (NULL != cfg)
+    pool->cfg = *cfg;
+  else
+    ci2c_random_config_defaults (&pool->cfg);
+
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->filled, NULL);
+
+  /* Start out filling */
+  pool->kicked = 1;
+  sem_init (&pool->kick, 0, 1);
+
+  if (0 != pthread_create (&pool->thread, NULL, refill_main, pool))
+    {
+      CI2C_LOG (SEVERE, "Failed to start the random pool refill thread");
+      sem_destroy (&pool->kick);
+      pthread_cond_destroy (&pool->filled);
+      pthread_mutex_destroy (&pool->lock);
+      ci2c_free_wipe ((uint8_t *)pool, sizeof (*pool));
+      return NULL;
+    }
+
+  return pool;
+}
+
+void
+ci2c_random_forget (void)
+{
+  ci2c_wipe (slice.bytes, sizeof (slice.bytes));
+  slice.left = 0;
+  slice.pool_id = 0;
+}
+
+int
+ci2c_random_bytes (struct ci2c_random_pool *pool, uint8_t *buf,
+                   unsigned int len)
+{
+  unsigned int n, offset, total = len;
+
+  assert (NULL != pool);
+  assert (NULL != buf || 0 == len);
+
+  while (len > 0)
+    {
+      if (slice.pool_id != pool->id || 0 == slice.left)
+        {
+          ci2c_random_forget ();
+
+          if (!take_chunk (pool, slice.bytes))
+            {
+              STAT_ADD (pool, bytes_served, total - len);
+              return -1;
+            }
+
+          slice.pool_id = pool->id;
+          slice.left = sizeof (slice.bytes);
+        }
+
+      n = (len < slice.left) ? len : slice.left;
+      offset = sizeof (slice.bytes) - slice.left;
+
+      memcpy (buf, &slice.bytes[offset], n);
+      ci2c_wipe (&slice.bytes[offset], n);
+
+      slice.left -= n;
+      buf += n;
+      len -= n;
+    }
+
+  STAT_ADD (pool, bytes_served, total);
+
+  return 0;
+}
+
+void
+ci2c_random_pool_stats (struct ci2c_random_pool *pool,
+                        struct ci2c_random_stats *stats)
+{
+  assert (NULL != pool);
+  assert (NULL != stats);
+
+  stats->refills = __atomic_load_n (&pool->stats.refills, __ATOMIC_RELAXED);
+  stats->failures = __atomic_load_n (&pool->stats.failures,
+                                     __ATOMIC_RELAXED);
+  stats->kicks = __atomic_load_n (&pool->stats.kicks, __ATOMIC_RELAXED);
+  stats->chunks_served = __atomic_load_n (&pool->stats.chunks_served,
+                                          __ATOMIC_RELAXED);
+  stats->bytes_served = __atomic_load_n (&pool->stats.bytes_served,
+                                         __ATOMIC_RELAXED);
+  stats->empty_waits = __atomic_load_n (&pool->stats.empty_waits,
+                                        __ATOMIC_RELAXED);
+  stats->level = ring_level (pool);
+}
+
+void
+ci2c_random_pool_free (struct ci2c_random_pool *pool)
+{
+  assert (NULL != pool);
+
+  __atomic_store_n (&pool->stopping, 1, __ATOMIC_RELEASE);
+  sem_post (&pool->kick);
+  pthread_join (pool->thread, NULL);
+
+  /* Nobody else may be waiting by now */
+  sem_destroy (&pool->kick);
+  pthread_cond_destroy (&pool->filled);
+  pthread_mutex_destroy (&pool->lock);
+
+  if (slice.pool_id == pool->id)
+    ci2c_random_forget ();
+
+  ci2c_free_wipe ((uint8_t *)pool, sizeof (*pool));
+}
@@ -0,0 +1,135 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RANDOM_POOL_H
+#define RANDOM_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+/* One Random command's worth */
+#define CI2C_RANDOM_CHUNK_LEN 32
+
+/* Ring capacity in chunks, a power of two */
+#define CI2C_RANDOM_POOL_CHUNKS 256
+
+/* Refilling starts when the ring falls to the low watermark and runs
+   until it reaches the high one */
+#define CI2C_RANDOM_DEFAULT_LOW 64
+#define CI2C_RANDOM_DEFAULT_HIGH 224
+
+/* Randoms queued as one batch job, so a refill shares a wake */
+#define CI2C_RANDOM_REFILL_BATCH 8
+
+/* How long the refill thread rests after a failed Random */
+#define CI2C_RANDOM_FAILURE_BACKOFF_USEC 100000
+
+struct ci2c_random_pool;
+
+struct ci2c_random_config
+{
+  unsigned int low;             /**< Chunks */
+  unsigned int high;            /**< Chunks, at most
+                                   CI2C_RANDOM_POOL_CHUNKS */
+  bool update_seed;             /**< Random mode 0 instead of 1 */
+};
+
+struct ci2c_random_stats
+{
+  unsigned long refills;        /**< Random commands that succeeded */
+  unsigned long failures;       /**< And that didn't */
+  unsigned long kicks;          /**< Times the low watermark woke the
+                                   refill thread */
+  unsigned long chunks_served;  /**< Taken off the ring */
+  uint64_t bytes_served;
+  unsigned long empty_waits;    /**< Requests that found the ring
+                                   empty and waited */
+  unsigned int level;           /**< Chunks in the ring now */
+};
+
+/**
+ * Fills in the default configuration.
+ *
+ * @param cfg The configuration
+ */
+void
+ci2c_random_config_defaults (struct ci2c_random_config *cfg);
+
+/**
+ * Creates a pool of device randomness and starts filling it.  Refills
+ * are queued on the scheduler as PRIO_BULK jobs, so they run when the
+ * bus has nothing more urgent to do.
+ *
+ * @param sched The scheduler
+ * @param bus The bus index
+ * @param addr The device's slave address
+ * @param cfg The configuration, NULL for the defaults
+ *
+ * @return The pool or NULL on error
+ */
+struct ci2c_random_pool *
+ci2c_random_pool_new (struct ci2c_sched *sched, unsigned int bus, int addr,
+                      const struct ci2c_random_config *cfg);
+
+/**
+ * Copies out random bytes.  Each thread takes a whole chunk off the
+ * ring at a time and serves later calls from it, so most calls touch
+ * no shared state.  Bytes are wiped from the ring and the thread's
+ * slice as they are handed out.  If the ring is empty this waits for
+ * the refill thread.
+ *
+ * @param pool The pool
+ * @param buf The destination
+ * @param len The number of bytes
+ *
+ * @return 0 on success, -1 if the device stopped delivering
+ */
+int
+ci2c_random_bytes (struct ci2c_random_pool *pool, uint8_t *buf,
+                   unsigned int len);
+
+/**
+ * Wipes and drops whatever the calling thread still holds in its
+ * slice, e.g. before the thread exits.
+ */
+void
+ci2c_random_forget (void);
+
+/**
+ * Copies out the pool's statistics.
+ *
+ * @param pool The pool
+ * @param stats Filled in with the statistics
+ */
+void
+ci2c_random_pool_stats (struct ci2c_random_pool *pool,
+                        struct ci2c_random_stats *stats);
+
+/**
+ * Stops the refill thread, wipes the ring and frees the pool.  No
+ * other thread may be using the pool.
+ *
+ * @param pool The pool
+ */
+void
+ci2c_random_pool_free (struct ci2c_random_pool *pool);
+
+#endif /* RANDOM_POOL_H */
@@ -0,0 +1,352 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "read_cache.h"
+#include <assert.h>
+#include <string.h>
+#include "util.h"
+
+#define ZONE_MASK 0x03
+#define WORDS_PER_BLOCK (CI2C_BLOCK_LEN / CI2C_WORD_LEN)
+
+/* Word addresses: the word within a block in bits 0-2, then the
+   slot (data zone) or block (config and OTP zones) */
+#define ADDR_WORD_MASK 0x07
+#define ADDR_SLOT_SHIFT 3
+#define ADDR_SLOT_MASK 0x0F
+
+/* Lock param1: zero locks the config zone, otherwise data and OTP */
+#define LOCK_ZONE_MASK 0x03
+
+/* UpdateExtra writes config bytes 84 and 85, in word 21, which also
+   holds the lock bytes */
+#define CONFIG_EXTRA_WORD 21
+#define CONFIG_LOCK_VALUE 86
+#define LOCK_LOCKED 0x00
+
+/* Config words 13-20, bytes 52-83, hold the use flags, update and
+   monotonic counters and LastKeyUse, which the device changes itself
+   as keys are used */
+#define CONFIG_VOLATILE_FIRST 13
+#define CONFIG_VOLATILE_LAST 20
+
+/* Each slot's SlotConfig starts at config byte 20 + 2 * slot.  Reads
+   of IsSecret slots fail, and EncryptRead ones return data encrypted
+   under the current TempKey. */
+#define CONFIG_SLOT_CONFIG 20
+#define SLOT_IS_SECRET 0x80
+#define SLOT_ENCRYPT_READ 0x40
+
+#define KEY(zone, addr) ((((uint32_t)(zone) << 16) | (addr)) + 1)
+#define KEY_ZONE(key) (((key) - 1) >> 16)
+#define KEY_ADDR(key) (((key) - 1) & 0xFFFF)
+
+static unsigned int
+hash (uint32_t key)
+{
+  /* Fibonacci hashing; the table size is a power of two */
+  return (key * 2654435769u) >> (32 - 9);
+}
+
+static struct ci2c_read_cache_word *
+find (struct ci2c_read_cache *cache, uint32_t key, bool insert)
+{
+  unsigned int x, n;
+  struct ci2c_read_cache_word *w;
+
+  for (x = hash (key), n = 0; n < CI2C_READ_CACHE_WORDS;
+       x = (x + 1) % CI2C_READ_CACHE_WORDS, n++)
+    {
+      w = &cache->words[x];
+
+      if (w->key == key)
+        return w;
+
+      if (0 == w->key)
+        {
+          /* Entries are never removed, so a free one ends the probe */
+          if (!insert || cache->used >= CI2C_READ_CACHE_WORDS)
+            return NULL;
+
+          w->key = key;
+          cache->used++;
+          return w;
+        }
+    }
+
+  return NULL;
+}
+
+/* Returns a config byte if the word holding it is cached */
+static bool
+config_byte (struct ci2c_read_cache *cache, unsigned int byte, uint8_t *value)
+{
+  struct ci2c_read_cache_word *w;
+
+  w = find (cache, KEY (CI2C_ZONE_CONFIG, byte / CI2C_WORD_LEN), false);
+
+  if (NULL == w || !w->valid)
+    return false;
+
+  *value = w->data[byte % CI2C_WORD_LEN];
+
+  return true;
+}
+
+/* Whether a word reads the same until a command the cache sees
+   changes it.  A data slot qualifies only once the cached config
+   shows the data zone locked and the slot readable in the clear. */
+static bool
+cacheable (struct ci2c_read_cache *cache, uint8_t zone, uint16_t addr)
+{
+  uint8_t lock, slot_config;
+  unsigned int slot;
+
+  switch (zone)
+    {
+    case CI2C_ZONE_CONFIG:
+      return addr < CONFIG_VOLATILE_FIRST || addr > CONFIG_VOLATILE_LAST;
+    case CI2C_ZONE_OTP:
+      return true;
+    case CI2C_ZONE_DATA:
+      slot = (addr >> ADDR_SLOT_SHIFT) & ADDR_SLOT_MASK;
+
+      return config_byte (cache, CONFIG_LOCK_VALUE, &lock)
+        && LOCK_LOCKED == lock
+        && config_byte (cache, CONFIG_SLOT_CONFIG + 2 * slot, &slot_config)
+        && 0 == (slot_config & (SLOT_IS_SECRET | SLOT_ENCRYPT_READ));
+    default:
+      return false;
+    }
+}
+
+void
+ci2c_read_cache_init (struct ci2c_read_cache *cache)
+{
+  assert (NULL != cache);
+
+  memset (cache, 0, sizeof (*cache));
+}
+
+void
+ci2c_read_cache_clear (struct ci2c_read_cache *cache)
+{
+  assert (NULL != cache);
+
+  ci2c_wipe ((uint8_t *)cache->words, sizeof (cache->words));
+  cache->used = 0;
+}
+
+/* The first word address and the word count of an access */
+static bool
+span (uint16_t *addr, unsigned int len, unsigned int *count)
+{
+  if (CI2C_BLOCK_LEN == len)
+    {
+      *addr &= ~ADDR_WORD_MASK;
+      *count = WORDS_PER_BLOCK;
+      return true;
+    }
+
+  *count = 1;
+
+  return CI2C_WORD_LEN == len;
+}
+
+bool
+ci2c_read_cache_get (struct ci2c_read_cache *cache, uint8_t zone,
+                     uint16_t addr, uint8_t *buf, unsigned int len)
+{
+  struct ci2c_read_cache_word *w;
+  unsigned int x, count;
+
+  assert (NULL != cache);
+  assert (NULL != buf);
+
+  if (!span (&addr, len, &count))
+    return false;
+
+  for (x = 0; x < count; x++)
+    if (NULL == (w = find (cache, KEY (zone, addr + x), false)) || !w->valid)
+      return false;
+
+  for (x = 0; x < count; x++)
+    {
+      w = find (cache, KEY (zone, addr + x), false);
+      memcpy (&buf[x * CI2C_WORD_LEN], w->data, CI2C_WORD_LEN);
+    }
+
+  return true;
+}
+
+void
+ci2c_read_cache_put (struct ci2c_read_cache *cache, uint8_t zone,
+                     uint16_t addr, const uint8_t *data, unsigned int len)
+{
+  struct ci2c_read_cache_word *w;
+  unsigned int x, count;
+
+  assert (NULL != cache);
+  assert (NULL != data);
+
+  if (!span (&addr, len, &count))
+    return;
+
+  for (x = 0; x < count; x++)
+    {
+      if (!cacheable (cache, zone, addr + x))
+        continue;
+
+      if (NULL == (w = find (cache, KEY (zone, addr + x), true)))
+        {
+          cache->stats.full++;
+          continue;
+        }
+
+      memcpy (w->data, &data[x * CI2C_WORD_LEN], CI2C_WORD_LEN);
+      w->valid = true;
+      cache->stats.fills++;
+    }
+}
+
+static void
+drop (struct ci2c_read_cache *cache, struct ci2c_read_cache_word *w)
+{
+  if (!w->valid)
+    return;
+
+  ci2c_wipe (w->data, sizeof (w->data));
+  w->valid = false;
+  cache->stats.invalidations++;
+}
+
+static void
+drop_span (struct ci2c_read_cache *cache, uint8_t zone, uint16_t addr,
+           unsigned int count)
+{
+  struct ci2c_read_cache_word *w;
+  unsigned int x;
+
+  for (x = 0; x < count; x++)
+    if (NULL != (w = find (cache, KEY (zone, addr + x), false)))
+      drop (cache, w);
+}
+
+/* Drops every word of a zone, or of one data slot if slot >= 0 */
+static void
+drop_zone (struct ci2c_read_cache *cache, uint8_t zone, int slot)
+{
+  struct ci2c_read_cache_word *w;
+  unsigned int x;
+
+  for (x = 0; x < CI2C_READ_CACHE_WORDS; x++)
+    {
+      w = &cache->words[x];
+
+      if (0 == w->key || KEY_ZONE (w->key) != zone)
+        continue;
+
+      if (slot < 0
+          || ((KEY_ADDR (w->key) >> ADDR_SLOT_SHIFT) & ADDR_SLOT_MASK) == slot)
+        drop (cache, w);
+    }
+}
+
+static uint16_t
+command_addr (const struct Command_ATSHA204 *c)
+{
+  return c->param2[0] | (c->param2[1] << 8);
+}
+
+bool
+ci2c_read_cache_lookup (struct ci2c_read_cache *cache,
+                        const struct Command_ATSHA204 *c,
+                        uint8_t *rsp, unsigned int rsp_len)
+{
+  assert (NULL != cache);
+  assert (NULL != c);
+
+  if (CI2C_OP_READ != c->opcode)
+    return false;
+
+  if (ci2c_read_cache_get (cache, c->param1 & ZONE_MASK, command_addr (c),
+                           rsp, rsp_len))
+    {
+      cache->stats.hits++;
+      return true;
+    }
+
+  cache->stats.misses++;
+
+  return false;
+}
+
+void
+ci2c_read_cache_observe (struct ci2c_read_cache *cache,
+                         const struct Command_ATSHA204 *c,
+                         enum CI2C_STATUS_RESPONSE status,
+                         const uint8_t *rsp, unsigned int rsp_len)
+{
+  uint16_t addr;
+  unsigned int count;
+
+  assert (NULL != cache);
+  assert (NULL != c);
+
+  addr = command_addr (c);
+
+  switch (c->opcode)
+    {
+    case CI2C_OP_READ:
+      if (RSP_SUCCESS == status)
+        ci2c_read_cache_put (cache, c->param1 & ZONE_MASK, addr,
+                             rsp, rsp_len);
+      break;
+    case CI2C_OP_WRITE:
+      count = (c->param1 & CI2C_ZONE_BLOCK) ? WORDS_PER_BLOCK : 1;
+      if (c->param1 & CI2C_ZONE_BLOCK)
+        addr &= ~ADDR_WORD_MASK;
+      drop_span (cache, c->param1 & ZONE_MASK, addr, count);
+      /* Slot configs decide which data words may be kept */
+      if (CI2C_ZONE_CONFIG == (c->param1 & ZONE_MASK))
+        drop_zone (cache, CI2C_ZONE_DATA, -1);
+      break;
+    case CI2C_OP_LOCK:
+      /* Locking also sets a lock byte in the config zone */
+      drop_zone (cache, CI2C_ZONE_CONFIG, -1);
+      if (0 != (c->param1 & LOCK_ZONE_MASK))
+        {
+          drop_zone (cache, CI2C_ZONE_OTP, -1);
+          drop_zone (cache, CI2C_ZONE_DATA, -1);
+        }
+      break;
+    case CI2C_OP_UPDATEEXTRA:
+      drop_span (cache, CI2C_ZONE_CONFIG, CONFIG_EXTRA_WORD, 1);
+      break;
+    case CI2C_OP_DERIVEKEY:
+    case CI2C_OP_PRIVWRITE:
+    case CI2C_OP_GENKEY:
+      /* The target slot is in param2 */
+      drop_zone (cache, CI2C_ZONE_DATA, addr & ADDR_SLOT_MASK);
+      break;
+    default:
+      break;
+    }
+}
@@ -0,0 +1,144 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef READ_CACHE_H
+#define READ_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "catalog.h"
+#include "command_adaptation.h"
+
+/* Words the cache can hold.  Enough for the config and OTP zones and
+   every data slot of either family, read as blocks. */
+#define CI2C_READ_CACHE_WORDS 512
+
+struct ci2c_read_cache_stats
+{
+  unsigned long hits;           /**< Reads answered from the cache */
+  unsigned long misses;         /**< Reads that went to the device */
+  unsigned long fills;          /**< Words stored */
+  unsigned long invalidations;  /**< Words dropped by writes and locks */
+  unsigned long full;           /**< Words not stored for want of room */
+};
+
+struct ci2c_read_cache_word
+{
+  uint32_t key;                 /**< 0 for a free entry */
+  bool valid;
+  uint8_t data[CI2C_WORD_LEN];
+};
+
+/**
+ * Device data that only changes through commands the library sends,
+ * kept as 4 byte words keyed by zone and word address.  That is the
+ * config zone without its counters and LastKeyUse, the OTP zone, and
+ * the data slots that the cached config shows to be locked and
+ * readable in the clear; anything else is never stored.  A 32 byte
+ * read is a hit only if all its words are present.  Not thread safe;
+ * the owner serializes access.
+ */
+struct ci2c_read_cache
+{
+  struct ci2c_read_cache_word words[CI2C_READ_CACHE_WORDS];
+  unsigned int used;
+  struct ci2c_read_cache_stats stats;
+};
+
+/**
+ * Initializes an empty cache.
+ *
+ * @param cache The cache
+ */
+void
+ci2c_read_cache_init (struct ci2c_read_cache *cache);
+
+/**
+ * Wipes and empties the cache.
+ *
+ * @param cache The cache
+ */
+void
+ci2c_read_cache_clear (struct ci2c_read_cache *cache);
+
+/**
+ * Looks up a word or a block.
+ *
+ * @param cache The cache
+ * @param zone The zone
+ * @param addr The word address, as in Read param2.  Blocks are
+ * aligned down.
+ * @param buf Filled in on a hit
+ * @param len CI2C_WORD_LEN or CI2C_BLOCK_LEN
+ *
+ * @return True on a hit
+ */
+bool
+ci2c_read_cache_get (struct ci2c_read_cache *cache, uint8_t zone,
+                     uint16_t addr, uint8_t *buf, unsigned int len);
+
+/**
+ * Stores a word or a block, e.g. from discovery, leaving out the
+ * words that may not be cached.
+ *
+ * @param cache The cache
+ * @param zone The zone
+ * @param addr The word address
+ * @param data The data
+ * @param len CI2C_WORD_LEN or CI2C_BLOCK_LEN
+ */
+void
+ci2c_read_cache_put (struct ci2c_read_cache *cache, uint8_t zone,
+                     uint16_t addr, const uint8_t *data, unsigned int len);
+
+/**
+ * Answers a Read command from the cache if it can.
+ *
+ * @param cache The cache
+ * @param c The command
+ * @param rsp The response buffer
+ * @param rsp_len The expected response length
+ *
+ * @return True if rsp was filled in and the command needn't be sent
+ */
+bool
+ci2c_read_cache_lookup (struct ci2c_read_cache *cache,
+                        const struct Command_ATSHA204 *c,
+                        uint8_t *rsp, unsigned int rsp_len);
+
+/**
+ * Updates the cache after a command went to the device: successful
+ * Reads are stored, and Write, Lock, UpdateExtra, DeriveKey,
+ * PrivWrite and GenKey drop what they may have changed, whatever
+ * their status.
+ *
+ * @param cache The cache
+ * @param c The command
+ * @param status Its status
+ * @param rsp The response
+ * @param rsp_len The response length
+ */
+void
+ci2c_read_cache_observe (struct ci2c_read_cache *cache,
+                         const struct Command_ATSHA204 *c,
+                         enum CI2C_STATUS_RESPONSE status,
+                         const uint8_t *rsp, unsigned int rsp_len);
+
+#endif /* READ_CACHE_H */
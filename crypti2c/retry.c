@@ -0,0 +1,211 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "retry.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include "catalog.h"
+#include "timing.h"
+
+#define OPCODES 256
+
+static struct ci2c_retry_policy default_policy =
+  {
+    .max_attempts = CI2C_RETRY_DEFAULT_ATTEMPTS,
+    .max_polls = 0,
+    .backoff = BACKOFF_EXPONENTIAL,
+    .base_delay_usec = CI2C_RETRY_DEFAULT_BASE_USEC,
+    .max_delay_usec = CI2C_RETRY_DEFAULT_MAX_DELAY_USEC,
+    .deadline_usec = CI2C_RETRY_DEFAULT_DEADLINE_USEC,
+    .rewake = true
+  };
+
+static struct ci2c_retry_policy opcode_policy[OPCODES];
+static bool opcode_has_policy[OPCODES];
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct ci2c_retry_stats stats;
+
+/* Per thread xorshift state for jitter.  Zero means unseeded. */
+static __thread uint32_t jitter_state;
+
+static uint32_t
+jitter_next (void)
+{
+  struct timespec now;
+  uint32_t x = jitter_state;
+
+  if (0 == x)
+    {
+      ci2c_now (&now);
+      x = (uint32_t)now.tv_nsec ^ (uint32_t)(uintptr_t)&jitter_state;
+      if (0 == x)
+        x = 1;
+    }
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  jitter_state = x;
+
+  return x;
+}
+
+static bool
+policy_valid (const struct ci2c_retry_policy *policy)
+{
+  return NULL != policy
+    && policy->max_attempts > 0
+    && policy->backoff <= BACKOFF_JITTER
+    && policy->base_delay_usec <= policy->max_delay_usec;
+}
+
+void
+ci2c_retry_policy_defaults (struct ci2c_retry_policy *policy)
+{
+  assert (NULL != policy);
+
+  policy->max_attempts = CI2C_RETRY_DEFAULT_ATTEMPTS;
+  policy->max_polls = 0;
+  policy->backoff = BACKOFF_EXPONENTIAL;
+  policy->base_delay_usec = CI2C_RETRY_DEFAULT_BASE_USEC;
+  policy->max_delay_usec = CI2C_RETRY_DEFAULT_MAX_DELAY_USEC;
+  policy->deadline_usec = CI2C_RETRY_DEFAULT_DEADLINE_USEC;
+  policy->rewake = true;
+}
+
+int
+ci2c_retry_set_policy (const struct ci2c_retry_policy *policy)
+{
+  if (!policy_valid (policy))
+    return -1;
+
+  pthread_mutex_lock (&policy_lock);
+  default_policy = *policy;
+  pthread_mutex_unlock (&policy_lock);
+
+  return 0;
+}
+
+int
+ci2c_retry_set_opcode_policy (uint8_t opcode,
+                              const struct ci2c_retry_policy *policy)
+{
+  if (NULL != policy && !policy_valid (policy))
+    return -1;
+
+  pthread_mutex_lock (&policy_lock);
+
+  if (NULL != policy)
+    opcode_policy[opcode] = *policy;
+
+  opcode_has_policy[opcode] = (NULL != policy);
+
+  pthread_mutex_unlock (&policy_lock);
+
+  return 0;
+}
+
+void
+ci2c_retry_policy_for (uint8_t opcode, struct ci2c_retry_policy *policy)
+{
+  const struct ci2c_opcode_info *info;
+  bool has_policy;
+
+  assert (NULL != policy);
+
+  pthread_mutex_lock (&policy_lock);
+
+  has_policy = opcode_has_policy[opcode];
+  *policy = has_policy ? opcode_policy[opcode] : default_policy;
+
+  pthread_mutex_unlock (&policy_lock);
+
+  /* A bad response CRC doesn't mean the device didn't run the
+     command, so never resend one whose effects would repeat unless
+     the caller asked for it */
+  if (!has_policy && NULL != (info = ci2c_catalog_lookup (opcode))
+      && info->once)
+    policy->max_attempts = 1;
+}
+
+uint64_t
+ci2c_retry_backoff_usec (const struct ci2c_retry_policy *policy,
+                         unsigned int attempt)
+{
+  uint64_t delay;
+
+  assert (NULL != policy);
+
+  if (0 == attempt)
+    return 0;
+
+  delay = policy->base_delay_usec;
+
+  if (BACKOFF_FIXED != policy->backoff)
+    {
+      /* Doubling past 2^16 can only overflow, the cap is far below */
+      if (attempt - 1 < 16)
+        delay <<= attempt - 1;
+      else
+        delay = policy->max_delay_usec;
+    }
+
+  if (delay > policy->max_delay_usec)
+    delay = policy->max_delay_usec;
+
+  if (BACKOFF_JITTER == policy->backoff && delay > 0)
+    delay = jitter_next () % (delay + 1);
+
+  return delay;
+}
+
+void
+ci2c_retry_count (size_t offset)
+{
+  unsigned long *counter = (unsigned long *)((char *)&stats + offset);
+
+  __atomic_add_fetch (counter, 1, __ATOMIC_RELAXED);
+}
+
+void
+ci2c_retry_stats_get (struct ci2c_retry_stats *out)
+{
+  unsigned long *from = (unsigned long *)&stats;
+  unsigned long *to = (unsigned long *)out;
+  unsigned int x;
+
+  assert (NULL != out);
+
+  for (x = 0; x < sizeof (stats) / sizeof (unsigned long); x++)
+    to[x] = __atomic_load_n (&from[x], __ATOMIC_RELAXED);
+}
+
+void
+ci2c_retry_stats_reset (void)
+{
+  unsigned long *counters = (unsigned long *)&stats;
+  unsigned int x;
+
+  for (x = 0; x < sizeof (stats) / sizeof (unsigned long); x++)
+    __atomic_store_n (&counters[x], 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,154 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RETRY_H
+#define RETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defaults.  The device's watchdog puts it to sleep within 1.3s of a
+   wake, after which it NAKs forever, so no command can take longer
+   than the default deadline. */
+#define CI2C_RETRY_DEFAULT_ATTEMPTS 10
+#define CI2C_RETRY_DEFAULT_BASE_USEC 1000
+#define CI2C_RETRY_DEFAULT_MAX_DELAY_USEC 50000
+#define CI2C_RETRY_DEFAULT_DEADLINE_USEC 1500000
+
+enum CI2C_BACKOFF
+  {
+    BACKOFF_FIXED = 0,          /**< base_delay_usec every time */
+    BACKOFF_EXPONENTIAL,        /**< Doubles each attempt */
+    BACKOFF_JITTER              /**< Random, up to the exponential delay */
+  };
+
+/**
+ * How hard ci2c_send_and_receive tries before giving up.  An attempt
+ * is one send of the command.  The command is sent again when the
+ * device answers RSP_AWAKE (it lost the command while waking), when
+ * the response fails its CRC or reports a communication error, and
+ * when the write itself fails.  Commands with side effects that must
+ * not run twice should get an attempt limit of 1, which is the
+ * default for the ones in the catalog.
+ */
+struct ci2c_retry_policy
+{
+  unsigned int max_attempts;    /**< Sends, at least 1 */
+  unsigned int max_polls;       /**< NAKed reads per send, 0 for no limit */
+  enum CI2C_BACKOFF backoff;
+  unsigned int base_delay_usec; /**< Delay before the second send */
+  unsigned int max_delay_usec;  /**< Cap on any one delay */
+  uint64_t deadline_usec;       /**< For the whole command, 0 for none */
+  bool rewake;                  /**< Wake the device before resending
+                                   after a CRC or write failure */
+};
+
+/* Counters across all commands */
+struct ci2c_retry_stats
+{
+  unsigned long commands;
+  unsigned long resends;        /**< Sends after the first */
+  unsigned long resyncs;        /**< Resends caused by RSP_AWAKE */
+  unsigned long crc_failures;   /**< Bad CRCs and device comm errors */
+  unsigned long write_failures;
+  unsigned long rewakes;
+  unsigned long polls;          /**< NAKed reads */
+  unsigned long timeouts;       /**< Commands that hit a limit */
+};
+
+/**
+ * Fills in the default policy: 10 attempts, exponential backoff from
+ * 1ms up to 50ms, unlimited polls within a 1.5s deadline, re-waking
+ * on failure.
+ *
+ * @param policy The policy to fill in
+ */
+void
+ci2c_retry_policy_defaults (struct ci2c_retry_policy *policy);
+
+/**
+ * Sets the policy used for opcodes without one of their own.  Opcodes
+ * the catalog marks as not safe to resend, e.g. DeriveKey, GenKey and
+ * Lock, still get only one attempt unless given their own policy.
+ *
+ * @param policy The policy, copied
+ *
+ * @return 0 on success, -1 if the policy is invalid
+ */
+int
+ci2c_retry_set_policy (const struct ci2c_retry_policy *policy);
+
+/**
+ * Sets the policy for one opcode, overriding the default.
+ *
+ * @param opcode The command opcode
+ * @param policy The policy, copied.  NULL reverts the opcode to the
+ * default policy.
+ *
+ * @return 0 on success, -1 if the policy is invalid
+ */
+int
+ci2c_retry_set_opcode_policy (uint8_t opcode,
+                              const struct ci2c_retry_policy *policy);
+
+/**
+ * Gets the policy that applies to an opcode.
+ *
+ * @param opcode The command opcode
+ * @param policy Filled in with the policy
+ */
+void
+ci2c_retry_policy_for (uint8_t opcode, struct ci2c_retry_policy *policy);
+
+/**
+ * Returns the delay before the given resend.
+ *
+ * @param policy The policy
+ * @param attempt The attempt about to be made, 1 for the first resend
+ *
+ * @return The delay in microseconds
+ */
+uint64_t
+ci2c_retry_backoff_usec (const struct ci2c_retry_policy *policy,
+                         unsigned int attempt);
+
+/**
+ * Copies out the retry counters.
+ *
+ * @param stats Filled in with the counters
+ */
+void
+ci2c_retry_stats_get (struct ci2c_retry_stats *stats);
+
+/**
+ * Zeroes the retry counters.
+ */
+void
+ci2c_retry_stats_reset (void);
+
+/* Used by ci2c_send_and_receive to bump a counter */
+#define CI2C_RETRY_COUNT(field) \
+  ci2c_retry_count (offsetof (struct ci2c_retry_stats, field))
+
+void
+ci2c_retry_count (size_t offset);
+
+#endif /* RETRY_H */
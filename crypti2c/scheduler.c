@@ -0,0 +1,821 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "scheduler.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include "i2c.h"
+#include "mux.h"
+#include "session.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+/* A worker that was posted but can't see the job yet yields this many
+   times, then sleeps between looks */
+#define SPIN_TRIES 64
+#define SPIN_SLEEP_USEC 50
+
+struct ci2c_worker
+{
+  struct ci2c_sched *sched;
+  unsigned int index;
+  int fd;
+  pthread_t thread;
+  sem_t pending;
+  struct ci2c_mpsc queues[PRIO_COUNT];
+  int stopping;
+
+  /* Only touched by the worker thread */
+  struct ci2c_job *head[PRIO_COUNT];
+  struct ci2c_job *tail[PRIO_COUNT];
+  struct ci2c_class_stats stats[PRIO_COUNT];
+  struct ci2c_mux_state mux;
+  unsigned int bypassed;
+  int addr;
+  struct ci2c_session sessions[CI2C_SCHED_MAX_DEVICES];
+  int session_addr[CI2C_SCHED_MAX_DEVICES];
+  unsigned int nsessions;
+};
+
+struct ci2c_sched
+{
+  struct ci2c_worker workers[CI2C_SCHED_MAX_BUSES];
+  unsigned int nbuses;
+  uint64_t aging_usec[PRIO_COUNT];
+
+  pthread_mutex_t lock;
+  pthread_cond_t done_cond;
+  int waiters;
+};
+
+/* Addresses a slave.  The mux state remembers what is selected, so
+   neither the ioctl nor a channel select is repeated. */
+static bool
+worker_select (struct ci2c_worker *w, int addr)
+{
+  if (addr < 0)
+    return true;
+
+  if (ci2c_mux_acquire (w->fd, &w->mux, addr) < 0)
+    {
+      w->addr = -1;
+      return false;
+    }
+
+  w->addr = addr;
+
+  return true;
+}
+
+static struct ci2c_session *
+worker_session (struct ci2c_worker *w, int addr)
+{
+  unsigned int x;
+  struct ci2c_session *s;
+
+  if (!worker_select (w, addr))
+    return NULL;
+
+  for (x = 0; x < w->nsessions; x++)
+    if (w->session_addr[x] == w->addr)
+      return &w->sessions[x];
+
+  /* Out of slots: sleep the oldest device and reuse its slot */
+  if (w->nsessions < CI2C_SCHED_MAX_DEVICES)
+    x = w->nsessions++;
+  else
+    {
+      x = 0;
+      addr = w->addr;
+      if (w->session_addr[x] != addr)
+        {
+          if (worker_select (w, w->session_addr[x]))
+            ci2c_session_release (&w->sessions[x], false);
+
+          if (!worker_select (w, addr))
+            return NULL;
+        }
+      memmove (&w->sessions[0], &w->sessions[1],
+               sizeof (w->sessions[0]) * (CI2C_SCHED_MAX_DEVICES - 1));
+      memmove (&w->session_addr[0], &w->session_addr[1],
+               sizeof (w->session_addr[0]) * (CI2C_SCHED_MAX_DEVICES - 1));
+      x = CI2C_SCHED_MAX_DEVICES - 1;
+    }
+
+  s = &w->sessions[x];
+  ci2c_session_init (s, w->fd);
+  w->session_addr[x] = w->addr;
+
+  return s;
+}
+
+/* Idles (or sleeps) every device the worker has woken */
+static void
+worker_release (struct ci2c_worker *w, bool more_expected)
+{
+  unsigned int x;
+
+  for (x = 0; x < w->nsessions; x++)
+    {
+      if (SESSION_AWAKE != w->sessions[x].state
+          && (more_expected || SESSION_IDLE != w->sessions[x].state))
+        continue;
+
+      if (!worker_select (w, w->session_addr[x]))
+        continue;
+
+      if (SESSION_IDLE == w->sessions[x].state)
+        {
+          /* Sleeping an idle device takes a wake first */
+          if (WAKE_OK == ci2c_session_ensure_awake (&w->sessions[x], 0))
+            ci2c_session_release (&w->sessions[x], false);
+        }
+      else
+        {
+          ci2c_session_release (&w->sessions[x], more_expected);
+        }
+    }
+}
+
+static void
+complete_job (struct ci2c_sched *sched, struct ci2c_job *job)
+{
+  ci2c_job_cb cb = job->cb;
+  void *cb_arg = job->cb_arg;
+
+  __atomic_store_n (&job->done, 1, __ATOMIC_SEQ_CST);
+
+  if (NULL != cb)
+    {
+      cb (job, cb_arg);
+      return;
+    }
+
+  if (__atomic_load_n (&sched->waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+      pthread_mutex_lock (&sched->lock);
+      pthread_cond_broadcast (&sched->done_cond);
+      pthread_mutex_unlock (&sched->lock);
+    }
+}
+
+/* Highest class first */
+static const enum CI2C_PRIORITY class_order[PRIO_COUNT] =
+  { PRIO_HIGH, PRIO_NORMAL, PRIO_BULK };
+
+/* Moves everything submitted so far onto the worker's class lists */
+static void
+drain_queues (struct ci2c_worker *w)
+{
+  struct ci2c_mpsc_node *node;
+  struct ci2c_job *job;
+  unsigned int c;
+
+  for (c = 0; c < PRIO_COUNT; c++)
+    while (NULL != (node = ci2c_mpsc_pop (&w->queues[c])))
+      {
+        job = CI2C_CONTAINER_OF (node, struct ci2c_job, node);
+        job->next = NULL;
+
+        if (NULL == w->tail[c])
+          w->head[c] = job;
+        else
+          w->tail[c]->next = job;
+
+        w->tail[c] = job;
+      }
+}
+
+static struct ci2c_job *
+take_job (struct ci2c_worker *w, unsigned int c)
+{
+  struct ci2c_job *job = w->head[c];
+
+  if (NULL == (w->head[c] = job->next))
+    w->tail[c] = NULL;
+
+  return job;
+}
+
+/* Prefers a job behind the selected mux channel, so queued work for
+   a channel runs together.  Only the first CI2C_SCHED_MUX_WINDOW jobs
+   are looked at, and the head is passed over that many times in a row
+   at most.  Jobs for one device keep their order, as they share a
+   channel. */
+static struct ci2c_job *
+take_grouped (struct ci2c_worker *w, unsigned int c)
+{
+  struct ci2c_job *prev = w->head[c];
+  struct ci2c_job *job;
+  unsigned int x;
+
+  if (prev->addr < 0 || w->addr < 0
+      || ci2c_mux_same_channel (prev->addr, w->addr)
+      || w->bypassed >= CI2C_SCHED_MUX_WINDOW)
+    {
+      w->bypassed = 0;
+      return take_job (w, c);
+    }
+
+  for (x = 1, job = prev->next; NULL != job && x < CI2C_SCHED_MUX_WINDOW;
+       x++, prev = job, job = job->next)
+    if (job->addr >= 0 && ci2c_mux_same_channel (job->addr, w->addr))
+      {
+        prev->next = job->next;
+
+        if (w->tail[c] == job)
+          w->tail[c] = prev;
+
+        w->bypassed++;
+        __atomic_add_fetch (&w->mux.stats.regrouped, 1, __ATOMIC_RELAXED);
+
+        return job;
+      }
+
+  w->bypassed = 0;
+
+  return take_job (w, c);
+}
+
+/* Strict priority, except that the longest overdue job goes first */
+static struct ci2c_job *
+select_job (struct ci2c_worker *w)
+{
+  const uint64_t *aging = w->sched->aging_usec;
+  struct timespec now;
+  uint64_t wait, oldest = 0;
+  int aged = -1, top = -1;
+  unsigned int x, c;
+
+  ci2c_now (&now);
+
+  for (x = 0; x < PRIO_COUNT; x++)
+    {
+      c = class_order[x];
+
+      if (NULL == w->head[c])
+        continue;
+
+      if (top < 0)
+        top = c;
+
+      if (0 == aging[c])
+        continue;
+
+      wait = ci2c_timespec_diff_usec (now, w->head[c]->submitted);
+
+      if (wait >= aging[c] && wait > oldest)
+        {
+          oldest = wait;
+          aged = c;
+        }
+    }
+
+  if (top < 0)
+    return NULL;
+
+  if (aged >= 0 && aged != top)
+    {
+      __atomic_store_n (&w->stats[aged].aged, w->stats[aged].aged + 1,
+                        __ATOMIC_RELAXED);
+      return take_job (w, aged);
+    }
+
+  return take_grouped (w, top);
+}
+
+static void
+record_wait (struct ci2c_worker *w, const struct ci2c_job *job)
+{
+  struct ci2c_class_stats *stats = &w->stats[job->priority];
+  uint64_t wait = ci2c_timespec_diff_usec (job->started, job->submitted);
+
+  /* Read by other threads, so no torn updates */
+  __atomic_store_n (&stats->jobs, stats->jobs + 1, __ATOMIC_RELAXED);
+  __atomic_store_n (&stats->total_wait_usec, stats->total_wait_usec + wait,
+                    __ATOMIC_RELAXED);
+
+  if (wait > stats->max_wait_usec)
+    __atomic_store_n (&stats->max_wait_usec, wait, __ATOMIC_RELAXED);
+}
+
+static void run_job (struct ci2c_worker *w, struct ci2c_job *job);
+
+/* A higher class job for another device that a batch should let
+   through.  Only the head of each class is considered so a class
+   stays in order. */
+static struct ci2c_job *
+take_preemptor (struct ci2c_worker *w, const struct ci2c_job *batch)
+{
+  struct ci2c_job *job;
+  unsigned int x, c;
+
+  drain_queues (w);
+
+  for (x = 0; x < PRIO_COUNT; x++)
+    {
+      c = class_order[x];
+
+      if (c == batch->priority)
+        break;
+
+      job = w->head[c];
+
+      if (NULL != job && job->addr >= 0 && job->addr != batch->addr)
+        {
+          job = take_job (w, c);
+
+          /* Every job consumes one post; this one's is at most a few
+             instructions behind its push */
+          while (sem_wait (&w->pending) < 0 && EINTR == errno)
+            ;
+
+          return job;
+        }
+    }
+
+  return NULL;
+}
+
+static enum CI2C_STATUS_RESPONSE
+run_batch (struct ci2c_worker *w, struct ci2c_job *job)
+{
+  struct ci2c_batch_cmd *cmds = job->batch;
+  struct ci2c_session *s;
+  struct ci2c_job *other;
+  struct timespec cmd_start, cmd_end;
+  enum CI2C_STATUS_RESPONSE status = RSP_SUCCESS;
+  unsigned int x;
+
+  for (x = 0; x < job->batch_len; x++)
+    {
+      cmds[x].status = RSP_COMM_ERROR;
+      cmds[x].ran = false;
+      cmds[x].start_usec = 0;
+      cmds[x].elapsed_usec = 0;
+    }
+
+  for (x = 0; x < job->batch_len; x++)
+    {
+      if (x > 0)
+        while (NULL != (other = take_preemptor (w, job)))
+          {
+            __atomic_store_n (&w->stats[job->priority].preemptions,
+                              w->stats[job->priority].preemptions + 1,
+                              __ATOMIC_RELAXED);
+            run_job (w, other);
+          }
+
+      if (__atomic_load_n (&job->cancel, __ATOMIC_ACQUIRE))
+        return RSP_CANCELLED;
+
+      /* Re-selected every time, a preemptor may have moved the bus */
+      if (NULL == (s = worker_session (w, job->addr)))
+        return RSP_COMM_ERROR;
+
+      ci2c_now (&cmd_start);
+
+      cmds[x].ran = true;
+      status = ci2c_session_process_command (s, cmds[x].cmd, cmds[x].rsp,
+                                             cmds[x].rsp_len);
+      cmds[x].status = status;
+
+      ci2c_now (&cmd_end);
+      cmds[x].start_usec = ci2c_timespec_diff_usec (cmd_start, job->started);
+      cmds[x].elapsed_usec = ci2c_timespec_diff_usec (cmd_end, cmd_start);
+
+      if (RSP_SUCCESS != status)
+        break;
+    }
+
+  return status;
+}
+
+static void
+run_job (struct ci2c_worker *w, struct ci2c_job *job)
+{
+  struct ci2c_session *s;
+
+  ci2c_now (&job->started);
+  record_wait (w, job);
+
+  /* Commands are the unit of cancellation: once one is on the bus it
+     runs to completion */
+  if (__atomic_load_n (&job->cancel, __ATOMIC_ACQUIRE))
+    {
+      job->status = RSP_CANCELLED;
+      job->completed = job->started;
+      complete_job (w->sched, job);
+      return;
+    }
+
+  if (NULL != job->batch)
+    job->status = run_batch (w, job);
+  else if (NULL != (s = worker_session (w, job->addr)))
+    job->status = ci2c_session_process_command (s, job->cmd,
+                                                job->rsp, job->rsp_len);
+  else
+    job->status = RSP_COMM_ERROR;
+
+  ci2c_now (&job->completed);
+
+  complete_job (w->sched, job);
+}
+
+/* How long the worker may wait for work before it has to idle its
+   devices: CI2C_SCHED_IDLE_USEC, less if a wake window ends sooner.
+   Returns false if no device is awake, so there's nothing to idle. */
+static bool
+idle_after (const struct ci2c_worker *w, uint64_t *usec)
+{
+  const struct ci2c_session *s;
+  uint64_t left;
+  unsigned int x;
+  bool awake = false;
+
+  *usec = CI2C_SCHED_IDLE_USEC;
+
+  for (x = 0; x < w->nsessions; x++)
+    {
+      s = &w->sessions[x];
+
+      if (SESSION_AWAKE != s->state)
+        continue;
+
+      awake = true;
+      left = ci2c_session_window_left (s);
+      left = (left > s->guard_usec) ? left - s->guard_usec : 0;
+
+      if (left < *usec)
+        *usec = left;
+    }
+
+  return awake;
+}
+
+/* Takes a post, giving up after usec.  Returns false on timeout. */
+static bool
+wait_pending (struct ci2c_worker *w, uint64_t usec)
+{
+  struct timespec until;
+  int rc;
+
+  /* sem_timedwait only takes the realtime clock */
+  clock_gettime (CLOCK_REALTIME, &until);
+  until = ci2c_timespec_add (until, ci2c_usec_to_timespec (usec));
+
+  while ((rc = sem_timedwait (&w->pending, &until)) < 0 && EINTR == errno)
+    ;
+
+  return 0 == rc;
+}
+
+/* Returns NULL once the scheduler is stopping and the work is done */
+static struct ci2c_job *
+next_job (struct ci2c_worker *w)
+{
+  struct ci2c_job *job;
+  uint64_t usec;
+  unsigned int tries;
+
+  /* Out of work for a while: idle the devices so their TempKey
+     survives until the next burst without the watchdog firing */
+  if (!idle_after (w, &usec) || !wait_pending (w, usec))
+    {
+      worker_release (w, true);
+
+      while (sem_wait (&w->pending) < 0 && EINTR == errno)
+        ;
+    }
+
+  /* The semaphore was posted after the push started, so the node is
+     normally a few instructions away; a pusher preempted in between
+     is waited for with short sleeps.  The stop post comes after every
+     job, so finding nothing then means everything has run. */
+  for (tries = 0;; tries++)
+    {
+      drain_queues (w);
+
+      if (NULL != (job = select_job (w)))
+        return job;
+
+      if (__atomic_load_n (&w->stopping, __ATOMIC_ACQUIRE))
+        return NULL;
+
+      if (tries < SPIN_TRIES)
+        sched_yield ();
+      else
+        ci2c_sleep_usec (SPIN_SLEEP_USEC);
+    }
+}
+
+static void *
+worker_main (void *arg)
+{
+  struct ci2c_worker *w = arg;
+  struct ci2c_job *job;
+
+  while (NULL != (job = next_job (w)))
+    run_job (w, job);
+
+  worker_release (w, false);
+
+  return NULL;
+}
+
+struct ci2c_sched *
+ci2c_sched_new (void)
+{
+  struct ci2c_sched *sched = (struct ci2c_sched *)
+    ci2c_malloc_wipe (sizeof (struct ci2c_sched));
+
+  sched->aging_usec[PRIO_NORMAL] = CI2C_SCHED_AGING_NORMAL_USEC;
+  sched->aging_usec[PRIO_BULK] = CI2C_SCHED_AGING_BULK_USEC;
+
+  pthread_mutex_init (&sched->lock, NULL);
+  pthread_cond_init (&sched->done_cond, NULL);
+
+  return sched;
+}
+
+int
+ci2c_sched_add_fd (struct ci2c_sched *sched, int fd)
+{
+  struct ci2c_worker *w;
+  unsigned int x;
+  int index = -1;
+
+  assert (NULL != sched);
+
+  if (fd < 0)
+    return -1;
+
+  pthread_mutex_lock (&sched->lock);
+
+  if (sched->nbuses < CI2C_SCHED_MAX_BUSES)
+    {
+      w = &sched->workers[sched->nbuses];
+      memset (w, 0, sizeof (*w));
+      w->sched = sched;
+      w->index = sched->nbuses;
+      w->fd = fd;
+      w->addr = ci2c_transport_addr (fd);
+      ci2c_mux_state_init (&w->mux, w->addr);
+      for (x = 0; x < PRIO_COUNT; x++)
+        ci2c_mpsc_init (&w->queues[x]);
+      sem_init (&w->pending, 0, 0);
+
+      if (0 == pthread_create (&w->thread, NULL, worker_main, w))
+        {
+          index = sched->nbuses;
+          /* Publish the worker to submitters */
+          __atomic_store_n (&sched->nbuses, sched->nbuses + 1,
+                            __ATOMIC_RELEASE);
+        }
+      else
+        {
+          sem_destroy (&w->pending);
+        }
+    }
+
+  pthread_mutex_unlock (&sched->lock);
+
+  if (index < 0)
+    CI2C_LOG (SEVERE, "Failed to start a bus worker");
+
+  return index;
+}
+
+int
+ci2c_sched_add_bus (struct ci2c_sched *sched, const char *bus)
+{
+  int fd, index;
+
+  assert (NULL != bus);
+
+  if ((fd = ci2c_transport_open_default (bus)) < 0)
+    return -1;
+
+  if ((index = ci2c_sched_add_fd (sched, fd)) < 0)
+    ci2c_transport_close (fd);
+
+  return index;
+}
+
+unsigned int
+ci2c_sched_bus_count (const struct ci2c_sched *sched)
+{
+  assert (NULL != sched);
+
+  return __atomic_load_n (&sched->nbuses, __ATOMIC_ACQUIRE);
+}
+
+static int
+submit_job (struct ci2c_sched *sched, unsigned int bus, struct ci2c_job *job)
+{
+  struct ci2c_worker *w;
+
+  if (bus >= ci2c_sched_bus_count (sched))
+    return -1;
+
+  w = &sched->workers[bus];
+
+  if ((unsigned int)job->priority >= PRIO_COUNT)
+    job->priority = PRIO_NORMAL;
+
+  job->done = 0;
+  job->cancel = 0;
+  job->status = RSP_NAK;
+  ci2c_now (&job->submitted);
+
+  ci2c_mpsc_push (&w->queues[job->priority], &job->node);
+  sem_post (&w->pending);
+
+  return 0;
+}
+
+int
+ci2c_sched_submit (struct ci2c_sched *sched, unsigned int bus,
+                   struct ci2c_job *job)
+{
+  assert (NULL != sched);
+  assert (NULL != job);
+  assert (NULL != job->cmd);
+
+  job->batch = NULL;
+  job->batch_len = 0;
+
+  return submit_job (sched, bus, job);
+}
+
+int
+ci2c_sched_submit_batch (struct ci2c_sched *sched, unsigned int bus,
+                         struct ci2c_job *job,
+                         struct ci2c_batch_cmd *cmds, unsigned int n)
+{
+  assert (NULL != sched);
+  assert (NULL != job);
+  assert (NULL != cmds);
+  assert (n > 0);
+
+  job->batch = cmds;
+  job->batch_len = n;
+
+  return submit_job (sched, bus, job);
+}
+
+void
+ci2c_sched_set_aging (struct ci2c_sched *sched, enum CI2C_PRIORITY priority,
+                      uint64_t usec)
+{
+  assert (NULL != sched);
+  assert ((unsigned int)priority < PRIO_COUNT);
+
+  __atomic_store_n (&sched->aging_usec[priority], usec, __ATOMIC_RELAXED);
+}
+
+void
+ci2c_sched_class_stats (const struct ci2c_sched *sched,
+                        enum CI2C_PRIORITY priority,
+                        struct ci2c_class_stats *stats)
+{
+  const struct ci2c_class_stats *ws;
+  unsigned int x, nbuses;
+  uint64_t max;
+
+  assert (NULL != sched);
+  assert ((unsigned int)priority < PRIO_COUNT);
+  assert (NULL != stats);
+
+  memset (stats, 0, sizeof (*stats));
+  nbuses = ci2c_sched_bus_count (sched);
+
+  for (x = 0; x < nbuses; x++)
+    {
+      ws = &sched->workers[x].stats[priority];
+
+      stats->jobs += __atomic_load_n (&ws->jobs, __ATOMIC_RELAXED);
+      stats->total_wait_usec += __atomic_load_n (&ws->total_wait_usec,
+                                                 __ATOMIC_RELAXED);
+      stats->aged += __atomic_load_n (&ws->aged, __ATOMIC_RELAXED);
+      stats->preemptions += __atomic_load_n (&ws->preemptions,
+                                             __ATOMIC_RELAXED);
+
+      max = __atomic_load_n (&ws->max_wait_usec, __ATOMIC_RELAXED);
+      if (max > stats->max_wait_usec)
+        stats->max_wait_usec = max;
+    }
+}
+
+int
+ci2c_sched_mux_stats (const struct ci2c_sched *sched, unsigned int bus,
+                      struct ci2c_mux_stats *stats)
+{
+  const struct ci2c_mux_stats *ws;
+
+  assert (NULL != sched);
+  assert (NULL != stats);
+
+  if (bus >= ci2c_sched_bus_count (sched))
+    return -1;
+
+  ws = &sched->workers[bus].mux.stats;
+
+  stats->acquires = __atomic_load_n (&ws->acquires, __ATOMIC_RELAXED);
+  stats->reuses = __atomic_load_n (&ws->reuses, __ATOMIC_RELAXED);
+  stats->selects = __atomic_load_n (&ws->selects, __ATOMIC_RELAXED);
+  stats->deselects = __atomic_load_n (&ws->deselects, __ATOMIC_RELAXED);
+  stats->saved = __atomic_load_n (&ws->saved, __ATOMIC_RELAXED);
+  stats->regrouped = __atomic_load_n (&ws->regrouped, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+bool
+ci2c_job_done (const struct ci2c_job *job)
+{
+  assert (NULL != job);
+
+  return 0 != __atomic_load_n (&job->done, __ATOMIC_ACQUIRE);
+}
+
+void
+ci2c_job_cancel (struct ci2c_job *job)
+{
+  assert (NULL != job);
+
+  __atomic_store_n (&job->cancel, 1, __ATOMIC_RELEASE);
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_job_wait (struct ci2c_sched *sched, struct ci2c_job *job)
+{
+  assert (NULL != sched);
+  assert (NULL != job);
+
+  if (!ci2c_job_done (job))
+    {
+      pthread_mutex_lock (&sched->lock);
+      __atomic_add_fetch (&sched->waiters, 1, __ATOMIC_SEQ_CST);
+
+      while (0 == __atomic_load_n (&job->done, __ATOMIC_SEQ_CST))
+        pthread_cond_wait (&sched->done_cond, &sched->lock);
+
+      __atomic_sub_fetch (&sched->waiters, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock (&sched->lock);
+    }
+
+  return job->status;
+}
+
+void
+ci2c_sched_free (struct ci2c_sched *sched)
+{
+  unsigned int x;
+  struct ci2c_worker *w;
+
+  assert (NULL != sched);
+
+  for (x = 0; x < sched->nbuses; x++)
+    {
+      w = &sched->workers[x];
+      __atomic_store_n (&w->stopping, 1, __ATOMIC_RELEASE);
+      sem_post (&w->pending);
+    }
+
+  for (x = 0; x < sched->nbuses; x++)
+    {
+      w = &sched->workers[x];
+      pthread_join (w->thread, NULL);
+      sem_destroy (&w->pending);
+      ci2c_transport_close (w->fd);
+    }
+
+  pthread_cond_destroy (&sched->done_cond);
+  pthread_mutex_destroy (&sched->lock);
+
+  ci2c_free_wipe ((uint8_t *)sched, sizeof (*sched));
+}
@@ -0,0 +1,267 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "batch.h"
+#include "command_adaptation.h"
+#include "mux.h"
+#include "queue.h"
+
+#define CI2C_SCHED_MAX_BUSES 16
+#define CI2C_SCHED_MAX_DEVICES 8
+
+/* A job that has waited this long is run ahead of higher classes */
+#define CI2C_SCHED_AGING_NORMAL_USEC 50000
+#define CI2C_SCHED_AGING_BULK_USEC 250000
+
+/* How far a bus looks ahead in a class for work on its mux channel */
+#define CI2C_SCHED_MUX_WINDOW 8
+
+/* How long a bus that ran out of work waits for more before idling
+   its devices, well inside the 0.7 s watchdog window, so a steady
+   trickle of jobs doesn't pay an idle and a wake each */
+#define CI2C_SCHED_IDLE_USEC 50000
+
+/**
+ * Priority classes.  A bus runs the oldest job of the highest class
+ * that has work, except that a job which has waited past its class's
+ * aging limit goes first.  Zeroed jobs are PRIO_NORMAL.
+ */
+enum CI2C_PRIORITY
+  {
+    PRIO_NORMAL = 0,
+    PRIO_HIGH,                  /**< Latency critical, e.g. a handshake */
+    PRIO_BULK,                  /**< Background, e.g. dumps and refills */
+    PRIO_COUNT
+  };
+
+/* Queueing per class, summed over the buses */
+struct ci2c_class_stats
+{
+  unsigned long jobs;
+  uint64_t total_wait_usec;     /**< Submitted to started */
+  uint64_t max_wait_usec;
+  unsigned long aged;           /**< Run ahead of a higher class */
+  unsigned long preemptions;    /**< Times a batch of this class paused
+                                   for a higher class */
+};
+
+struct ci2c_job;
+
+/* Called on the bus worker thread once a job has finished */
+typedef void (*ci2c_job_cb) (struct ci2c_job *job, void *arg);
+
+/**
+ * A command for a bus worker.  Jobs are owned by the caller and must
+ * stay valid until they complete; submitting never allocates.  Either
+ * wait for a job with ci2c_job_wait or give it a callback, not both:
+ * the worker doesn't touch a job again after running its callback.
+ */
+struct ci2c_job
+{
+  /* Filled in by the caller */
+  int addr;                     /**< Slave address, packed with
+                                   ci2c_mux_encode behind a mux, -1
+                                   to keep the current one */
+  struct Command_ATSHA204 *cmd;
+  uint8_t *rsp;
+  unsigned int rsp_len;
+  ci2c_job_cb cb;
+  void *cb_arg;
+  enum CI2C_PRIORITY priority;  /**< Out of range runs as PRIO_NORMAL */
+
+  /* Filled in by the scheduler */
+  enum CI2C_STATUS_RESPONSE status;
+  struct timespec submitted;
+  struct timespec started;
+  struct timespec completed;
+
+  /* Internal */
+  struct ci2c_mpsc_node node;
+  struct ci2c_job *next;
+  struct ci2c_batch_cmd *batch;
+  unsigned int batch_len;
+  int done;
+  int cancel;
+};
+
+struct ci2c_sched;
+
+/**
+ * Creates a scheduler with no buses.
+ *
+ * @return The scheduler, NULL on error
+ */
+struct ci2c_sched *
+ci2c_sched_new (void);
+
+/**
+ * Opens a bus through the default transport and starts its worker
+ * thread.
+ *
+ * @param sched The scheduler
+ * @param bus The bus, i.e. /dev/i2c-1
+ *
+ * @return The bus index used to submit jobs, or -1 on error
+ */
+int
+ci2c_sched_add_bus (struct ci2c_sched *sched, const char *bus);
+
+/**
+ * Starts a worker thread for an already open descriptor.  The
+ * scheduler takes ownership of the descriptor and closes it when
+ * freed.
+ *
+ * @param sched The scheduler
+ * @param fd The open descriptor
+ *
+ * @return The bus index used to submit jobs, or -1 on error
+ */
+int
+ci2c_sched_add_fd (struct ci2c_sched *sched, int fd);
+
+/**
+ * Queues a job on a bus.  Safe to call from any thread.
+ *
+ * @param sched The scheduler
+ * @param bus The bus index
+ * @param job The job
+ *
+ * @return 0 on success, -1 if the bus doesn't exist
+ */
+int
+ci2c_sched_submit (struct ci2c_sched *sched, unsigned int bus,
+                   struct ci2c_job *job);
+
+/**
+ * Queues a batch of commands for one device as a single job.  The
+ * commands run back to back as with ci2c_session_process_batch,
+ * stopping at the first failure; job->cmd, job->rsp and job->rsp_len
+ * are unused and the job's status is that of the last command run.
+ * Between commands the batch gives way to waiting jobs of a higher
+ * class for other devices on the bus.  Jobs for the batch's own
+ * device wait for it, so a flow relying on TempKey is never split.
+ *
+ * @param sched The scheduler
+ * @param bus The bus index
+ * @param job The job
+ * @param cmds The commands
+ * @param n The number of commands
+ *
+ * @return 0 on success, -1 if the bus doesn't exist
+ */
+int
+ci2c_sched_submit_batch (struct ci2c_sched *sched, unsigned int bus,
+                         struct ci2c_job *job,
+                         struct ci2c_batch_cmd *cmds, unsigned int n);
+
+/**
+ * Sets how long a job of a class may wait before it runs ahead of
+ * higher classes.
+ *
+ * @param sched The scheduler
+ * @param priority The class
+ * @param usec The limit, 0 to never promote the class
+ */
+void
+ci2c_sched_set_aging (struct ci2c_sched *sched, enum CI2C_PRIORITY priority,
+                      uint64_t usec);
+
+/**
+ * Copies out the queueing statistics of a class.
+ *
+ * @param sched The scheduler
+ * @param priority The class
+ * @param stats Filled in with the statistics
+ */
+void
+ci2c_sched_class_stats (const struct ci2c_sched *sched,
+                        enum CI2C_PRIORITY priority,
+                        struct ci2c_class_stats *stats);
+
+/**
+ * Copies out a bus's mux channel switching statistics.  Devices
+ * behind a mux are given packed addresses, see ci2c_mux_encode; the
+ * bus then selects channels as needed and, within a priority class,
+ * runs queued jobs for the selected channel first.
+ *
+ * @param sched The scheduler
+ * @param bus The bus index
+ * @param stats Filled in with the statistics
+ *
+ * @return 0 on success, -1 if the bus doesn't exist
+ */
+int
+ci2c_sched_mux_stats (const struct ci2c_sched *sched, unsigned int bus,
+                      struct ci2c_mux_stats *stats);
+
+/**
+ * Returns true once the job has completed.
+ *
+ * @param job The job
+ */
+bool
+ci2c_job_done (const struct ci2c_job *job);
+
+/**
+ * Asks for a job to be dropped.  A job that hasn't started yet
+ * completes with RSP_CANCELLED without touching the device; one that
+ * is already running finishes normally.  Safe to call from any
+ * thread while the job is queued or running.
+ *
+ * @param job The job
+ */
+void
+ci2c_job_cancel (struct ci2c_job *job);
+
+/**
+ * Blocks until the job completes.
+ *
+ * @param sched The scheduler the job was submitted to
+ * @param job The job
+ *
+ * @return The job's status
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_job_wait (struct ci2c_sched *sched, struct ci2c_job *job);
+
+/**
+ * Returns the number of buses.
+ *
+ * @param sched The scheduler
+ */
+unsigned int
+ci2c_sched_bus_count (const struct ci2c_sched *sched);
+
+/**
+ * Runs every queued job, stops the workers, sleeps the devices and
+ * closes the buses.
+ *
+ * @param sched The scheduler
+ */
+void
+ci2c_sched_free (struct ci2c_sched *sched);
+
+#endif /* SCHEDULER_H */
@@ -0,0 +1,167 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "session.h"
+#include <assert.h>
+#include <string.h>
+#include "timing.h"
+#include "log.h"
+
+void
+ci2c_session_init (struct ci2c_session *s, int fd)
+{
+  assert (NULL != s);
+
+  memset (s, 0, sizeof (*s));
+
+  s->fd = fd;
+  s->state = SESSION_ASLEEP;
+  s->watchdog_usec = CI2C_WATCHDOG_USEC;
+  s->guard_usec = CI2C_SESSION_GUARD_USEC;
+  ci2c_wake_config_defaults (&s->wake_cfg);
+}
+
+uint64_t
+ci2c_session_window_left (const struct ci2c_session *s)
+{
+  assert (NULL != s);
+
+  if (SESSION_AWAKE != s->state)
+    return 0;
+
+  return ci2c_usec_until (s->watchdog_deadline);
+}
+
+enum CI2C_WAKE_STATUS
+ci2c_session_ensure_awake (struct ci2c_session *s, uint64_t need_usec)
+{
+  struct ci2c_wake_result result;
+  struct timespec woke_at;
+
+  assert (NULL != s);
+
+  if (SESSION_AWAKE == s->state)
+    {
+      if (ci2c_session_window_left (s) >= need_usec + s->guard_usec)
+        return WAKE_OK;
+
+      /* Not enough of the window left.  Idle rather than sleep so
+         TempKey survives into the next window. */
+      CI2C_LOG (DEBUG, "Session window exhausted, re-waking");
+      ci2c_idle (s->fd);
+      s->state = SESSION_IDLE;
+      s->idles++;
+      s->rewakes++;
+    }
+
+  /* The watchdog starts counting somewhere during the wake, so
+     measure the window from before it */
+  ci2c_now (&woke_at);
+
+  ci2c_wakeup_ex (s->fd, &s->wake_cfg, &result);
+
+  s->wake_usec += result.latency_usec;
+
+  if (WAKE_OK != result.status)
+    {
+      s->state = SESSION_ASLEEP;
+      return result.status;
+    }
+
+  s->wakes++;
+  s->state = SESSION_AWAKE;
+  s->watchdog_deadline =
+    ci2c_timespec_add (woke_at, ci2c_usec_to_timespec (s->watchdog_usec));
+
+  return WAKE_OK;
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_session_process_command (struct ci2c_session *s,
+                              struct Command_ATSHA204 *c,
+                              uint8_t *rec_buf,
+                              unsigned int recv_len)
+{
+  enum CI2C_STATUS_RESPONSE rsp;
+
+  assert (NULL != s);
+  assert (NULL != c);
+
+  if (WAKE_OK != ci2c_session_ensure_awake (s,
+                                            ci2c_timespec_to_usec (c->exec_time)))
+    return RSP_COMM_ERROR;
+
+  rsp = ci2c_process_command (s->fd, c, rec_buf, recv_len);
+
+  s->commands++;
+
+  /* After a communication failure the device state is unknown.  The
+     next command starts from a fresh wake. */
+  if (RSP_COMM_ERROR == rsp || RSP_TIMEOUT == rsp)
+    s->state = SESSION_ASLEEP;
+
+  return rsp;
+}
+
+unsigned int
+ci2c_session_run (struct ci2c_session *s,
+                  struct ci2c_session_cmd *cmds,
+                  unsigned int n)
+{
+  unsigned int x;
+
+  assert (NULL != s);
+  assert (NULL != cmds || 0 == n);
+
+  for (x = 0; x < n; x++)
+    {
+      if (WAKE_OK != ci2c_session_ensure_awake
+          (s, ci2c_timespec_to_usec (cmds[x].cmd->exec_time)))
+        break;
+
+      cmds[x].status = ci2c_session_process_command (s, cmds[x].cmd,
+                                                     cmds[x].rsp,
+                                                     cmds[x].rsp_len);
+    }
+
+  return x;
+}
+
+void
+ci2c_session_release (struct ci2c_session *s, bool more_expected)
+{
+  assert (NULL != s);
+
+  if (SESSION_AWAKE != s->state)
+    return;
+
+  if (more_expected)
+    {
+      ci2c_idle (s->fd);
+      s->state = SESSION_IDLE;
+      s->idles++;
+    }
+  else
+    {
+      ci2c_sleep_device (s->fd);
+      s->state = SESSION_ASLEEP;
+      s->sleeps++;
+    }
+}
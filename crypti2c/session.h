@@ -0,0 +1,151 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "command_adaptation.h"
+#include "i2c.h"
+
+/* The device puts itself to sleep tWATCHDOG after it wakes (0.7s
+   minimum, 1.3s typical).  Commands are only started if they are
+   expected to finish this long before the watchdog fires. */
+#define CI2C_WATCHDOG_USEC 700000
+#define CI2C_SESSION_GUARD_USEC 5000
+
+enum CI2C_SESSION_STATE
+  {
+    SESSION_ASLEEP = 0,
+    SESSION_IDLE,
+    SESSION_AWAKE
+  };
+
+/**
+ * Tracks the power state of one device so that several commands can
+ * share a wake.  The session assumes it is the only thing waking,
+ * idling or sleeping the device on this descriptor.
+ */
+struct ci2c_session
+{
+  int fd;
+  enum CI2C_SESSION_STATE state;
+  struct timespec watchdog_deadline; /**< Valid while awake */
+  unsigned int watchdog_usec;
+  unsigned int guard_usec;
+  struct ci2c_wake_config wake_cfg;
+
+  /* Statistics */
+  unsigned long commands;
+  unsigned long wakes;
+  unsigned long rewakes;        /**< Wakes forced by the watchdog window */
+  unsigned long idles;
+  unsigned long sleeps;
+  uint64_t wake_usec;           /**< Total time spent waking */
+};
+
+/**
+ * Initializes a session for an open descriptor with the slave already
+ * acquired.  The device is assumed to be asleep.
+ *
+ * @param s The session
+ * @param fd The open file descriptor
+ */
+void
+ci2c_session_init (struct ci2c_session *s, int fd);
+
+/**
+ * Makes sure the device is awake with at least need_usec left before
+ * the watchdog fires.  An awake device without enough time left is
+ * idled, which keeps TempKey, and woken again.
+ *
+ * @param s The session
+ * @param need_usec The time the next operation needs
+ *
+ * @return WAKE_OK if the device is awake
+ */
+enum CI2C_WAKE_STATUS
+ci2c_session_ensure_awake (struct ci2c_session *s, uint64_t need_usec);
+
+/**
+ * Runs a command inside the current wake window, waking the device
+ * first only if it has to.
+ *
+ * @param s The session
+ * @param c The command
+ * @param rec_buf The response buffer
+ * @param recv_len The expected response length
+ *
+ * @return The command status, RSP_COMM_ERROR if the device won't wake
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_session_process_command (struct ci2c_session *s,
+                              struct Command_ATSHA204 *c,
+                              uint8_t *rec_buf,
+                              unsigned int recv_len);
+
+/* One queued command for ci2c_session_run */
+struct ci2c_session_cmd
+{
+  struct Command_ATSHA204 *cmd;
+  uint8_t *rsp;
+  unsigned int rsp_len;
+  enum CI2C_STATUS_RESPONSE status;   /**< Filled in by the session */
+};
+
+/**
+ * Runs queued commands back to back, packing as many as fit into each
+ * wake window.
+ *
+ * @param s The session
+ * @param cmds The commands
+ * @param n The number of commands
+ *
+ * @return The number of commands that were sent.  Fewer than n only
+ * if the device stopped waking.
+ */
+unsigned int
+ci2c_session_run (struct ci2c_session *s,
+                  struct ci2c_session_cmd *cmds,
+                  unsigned int n);
+
+/**
+ * Ends a burst of work.  If more is expected soon the device is
+ * idled, which keeps TempKey and makes the next wake cheap; otherwise
+ * it is put to sleep.
+ *
+ * @param s The session
+ * @param more_expected True to idle instead of sleep
+ */
+void
+ci2c_session_release (struct ci2c_session *s, bool more_expected);
+
+/**
+ * Returns the microseconds left in the current wake window, 0 if the
+ * device isn't awake.
+ *
+ * @param s The session
+ */
+uint64_t
+ci2c_session_window_left (const struct ci2c_session *s);
+
+#endif /* SESSION_H */
@@ -0,0 +1,375 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "timing.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC  1000000000L
+#define NSEC_PER_USEC 1000L
+#define USEC_PER_SEC  1000000ULL
+
+void
+ci2c_now (struct timespec *ts)
+{
+  assert (NULL != ts);
+
+  clock_gettime (CLOCK_MONOTONIC, ts);
+}
+
+struct timespec
+ci2c_timespec_add (struct timespec a, struct timespec b)
+{
+  struct timespec r;
+
+  r.tv_sec = a.tv_sec + b.tv_sec;
+  r.tv_nsec = a.tv_nsec + b.tv_nsec;
+
+  if (r.tv_nsec >= NSEC_PER_SEC)
+    {
+      r.tv_sec++;
+      r.tv_nsec -= NSEC_PER_SEC;
+    }
+
+  return r;
+}
+
+struct timespec
+ci2c_usec_to_timespec (uint64_t usec)
+{
+  struct timespec ts;
+
+  ts.tv_sec = usec / USEC_PER_SEC;
+  ts.tv_nsec = (usec % USEC_PER_SEC) * NSEC_PER_USEC;
+
+  return ts;
+}
+
+uint64_t
+ci2c_timespec_to_usec (struct timespec ts)
+{
+  return (uint64_t)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / NSEC_PER_USEC;
+}
+
+int64_t
+ci2c_timespec_diff_usec (struct timespec end, struct timespec start)
+{
+  return (int64_t)(end.tv_sec - start.tv_sec) * (int64_t)USEC_PER_SEC
+    + (end.tv_nsec - start.tv_nsec) / NSEC_PER_USEC;
+}
+
+int
+ci2c_timespec_cmp (struct timespec a, struct timespec b)
+{
+  if (a.tv_sec != b.tv_sec)
+    return (a.tv_sec < b.tv_sec) ? -1 : 1;
+
+  if (a.tv_nsec != b.tv_nsec)
+    return (a.tv_nsec < b.tv_nsec) ? -1 : 1;
+
+  return 0;
+}
+
+struct timespec
+ci2c_deadline_after_usec (uint64_t usec)
+{
+  struct timespec now;
+
+  ci2c_now (&now);
+
+  return ci2c_timespec_add (now, ci2c_usec_to_timespec (usec));
+}
+
+uint64_t
+ci2c_usec_until (struct timespec deadline)
+{
+  struct timespec now;
+  int64_t left;
+
+  ci2c_now (&now);
+
+  left = ci2c_timespec_diff_usec (deadline, now);
+
+  return (left > 0) ? left : 0;
+}
+
+void
+ci2c_sleep_usec (uint64_t usec)
+{
+  struct timespec deadline = ci2c_deadline_after_usec (usec);
+
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+         == EINTR)
+    ;
+}
+
+static enum CI2C_WAIT_STRATEGY wait_strategy = WAIT_NANOSLEEP;
+static unsigned int wait_spin_usec = CI2C_WAIT_DEFAULT_SPIN_USEC;
+static struct ci2c_wait_stats wait_stats[WAIT_STRATEGY_COUNT];
+static const uint64_t wait_limits[] = CI2C_WAIT_BUCKET_LIMITS;
+
+/* Each thread that uses WAIT_TIMERFD gets its own timer, closed by
+   the key's destructor when the thread exits */
+static __thread int thread_tfd = -1;
+static pthread_key_t tfd_key;
+static pthread_once_t tfd_key_once = PTHREAD_ONCE_INIT;
+
+static void
+close_thread_tfd (void *value)
+{
+  /* The key holds the descriptor plus one, since NULL means unset */
+  close ((int)(intptr_t)value - 1);
+}
+
+static void
+make_tfd_key (void)
+{
+  pthread_key_create (&tfd_key, close_thread_tfd);
+}
+
+static int
+thread_tfd_get (void)
+{
+  if (thread_tfd >= 0)
+    return thread_tfd;
+
+  if ((thread_tfd = ci2c_timerfd_create ()) < 0)
+    return -1;
+
+  pthread_once (&tfd_key_once, make_tfd_key);
+  pthread_setspecific (tfd_key, (void *)(intptr_t)(thread_tfd + 1));
+
+  return thread_tfd;
+}
+
+void
+ci2c_set_wait_strategy (enum CI2C_WAIT_STRATEGY strategy,
+                        unsigned int spin_usec)
+{
+  assert (strategy < WAIT_STRATEGY_COUNT);
+
+  wait_strategy = strategy;
+  wait_spin_usec = spin_usec;
+}
+
+enum CI2C_WAIT_STRATEGY
+ci2c_get_wait_strategy (void)
+{
+  return wait_strategy;
+}
+
+static void
+record_overshoot (enum CI2C_WAIT_STRATEGY strategy, struct timespec deadline)
+{
+  struct ci2c_wait_stats *st = &wait_stats[strategy];
+  struct timespec now;
+  int64_t late;
+  uint64_t max;
+  unsigned int x;
+
+  ci2c_now (&now);
+
+  late = ci2c_timespec_diff_usec (now, deadline);
+  if (late < 0)
+    late = 0;
+
+  for (x = 0; x < CI2C_WAIT_BUCKETS - 1; x++)
+    if ((uint64_t)late <= wait_limits[x])
+      break;
+
+  __atomic_add_fetch (&st->waits, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&st->total_overshoot_usec, late, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&st->buckets[x], 1, __ATOMIC_RELAXED);
+
+  max = __atomic_load_n (&st->max_overshoot_usec, __ATOMIC_RELAXED);
+  while ((uint64_t)late > max
+         && !__atomic_compare_exchange_n (&st->max_overshoot_usec, &max, late,
+                                          true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+wait_relative (struct timespec deadline)
+{
+  struct timespec now, left, rem;
+
+  ci2c_now (&now);
+
+  if (ci2c_timespec_cmp (now, deadline) >= 0)
+    return;
+
+  left = ci2c_usec_to_timespec (ci2c_timespec_diff_usec (deadline, now));
+
+  while (nanosleep (&left, &rem) < 0 && EINTR == errno)
+    left = rem;
+}
+
+static void
+wait_absolute (struct timespec deadline)
+{
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+         == EINTR)
+    ;
+}
+
+static void
+wait_hybrid (struct timespec deadline)
+{
+  struct timespec now;
+  struct timespec spin = ci2c_usec_to_timespec (wait_spin_usec);
+  struct timespec sleep_until;
+
+  /* Sleep until deadline - spin, then burn the rest */
+  sleep_until.tv_sec = deadline.tv_sec - spin.tv_sec;
+  sleep_until.tv_nsec = deadline.tv_nsec - spin.tv_nsec;
+  if (sleep_until.tv_nsec < 0)
+    {
+      sleep_until.tv_sec--;
+      sleep_until.tv_nsec += NSEC_PER_SEC;
+    }
+
+  ci2c_now (&now);
+
+  if (ci2c_timespec_cmp (now, sleep_until) < 0)
+    wait_absolute (sleep_until);
+
+  do
+    {
+      ci2c_now (&now);
+    }
+  while (ci2c_timespec_cmp (now, deadline) < 0);
+}
+
+static void
+wait_timerfd (struct timespec deadline)
+{
+  struct pollfd pfd;
+  uint64_t expirations;
+
+  if (thread_tfd_get () < 0)
+    {
+      wait_absolute (deadline);
+      return;
+    }
+
+  if (ci2c_timerfd_arm (thread_tfd, deadline) < 0)
+    {
+      wait_absolute (deadline);
+      return;
+    }
+
+  pfd.fd = thread_tfd;
+  pfd.events = POLLIN;
+
+  while (poll (&pfd, 1, -1) < 0 && EINTR == errno)
+    ;
+
+  /* Clear the expiration so the next wait starts clean */
+  if (read (thread_tfd, &expirations, sizeof (expirations)) < 0)
+    expirations = 0;
+}
+
+void
+ci2c_wait_until (struct timespec deadline)
+{
+  enum CI2C_WAIT_STRATEGY strategy = wait_strategy;
+
+  switch (strategy)
+    {
+    case WAIT_ABSOLUTE:
+      wait_absolute (deadline);
+      break;
+    case WAIT_HYBRID:
+      wait_hybrid (deadline);
+      break;
+    case WAIT_TIMERFD:
+      wait_timerfd (deadline);
+      break;
+    case WAIT_NANOSLEEP:
+    default:
+      strategy = WAIT_NANOSLEEP;
+      wait_relative (deadline);
+      break;
+    }
+
+  record_overshoot (strategy, deadline);
+}
+
+void
+ci2c_wait_usec (uint64_t usec)
+{
+  ci2c_wait_until (ci2c_deadline_after_usec (usec));
+}
+
+void
+ci2c_wait_stats_get (enum CI2C_WAIT_STRATEGY strategy,
+                     struct ci2c_wait_stats *stats)
+{
+  struct ci2c_wait_stats *st;
+  unsigned int x;
+
+  assert (strategy < WAIT_STRATEGY_COUNT);
+  assert (NULL != stats);
+
+  st = &wait_stats[strategy];
+
+  stats->waits = __atomic_load_n (&st->waits, __ATOMIC_RELAXED);
+  stats->total_overshoot_usec =
+    __atomic_load_n (&st->total_overshoot_usec, __ATOMIC_RELAXED);
+  stats->max_overshoot_usec =
+    __atomic_load_n (&st->max_overshoot_usec, __ATOMIC_RELAXED);
+
+  for (x = 0; x < CI2C_WAIT_BUCKETS; x++)
+    stats->buckets[x] = __atomic_load_n (&st->buckets[x], __ATOMIC_RELAXED);
+}
+
+void
+ci2c_wait_stats_reset (void)
+{
+  memset (wait_stats, 0, sizeof (wait_stats));
+}
+
+int
+ci2c_timerfd_create (void)
+{
+  return timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+int
+ci2c_timerfd_arm (int tfd, struct timespec deadline)
+{
+  struct itimerspec its;
+
+  memset (&its, 0, sizeof (its));
+  its.it_value = deadline;
+
+  /* A zero it_value would disarm the timer */
+  if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec)
+    its.it_value.tv_nsec = 1;
+
+  return timerfd_settime (tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
@@ -0,0 +1,187 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Reads the monotonic clock.
+ *
+ * @param ts Filled with the current time
+ */
+void
+ci2c_now (struct timespec *ts);
+
+/**
+ * Returns a + b, normalized.
+ */
+struct timespec
+ci2c_timespec_add (struct timespec a, struct timespec b);
+
+/**
+ * Returns a timespec for the given number of microseconds.
+ */
+struct timespec
+ci2c_usec_to_timespec (uint64_t usec);
+
+/**
+ * Returns the time in microseconds, rounded down.
+ */
+uint64_t
+ci2c_timespec_to_usec (struct timespec ts);
+
+/**
+ * Returns end - start in microseconds.  Negative if end is before
+ * start.
+ */
+int64_t
+ci2c_timespec_diff_usec (struct timespec end, struct timespec start);
+
+/**
+ * Compares two times.
+ *
+ * @return <0, 0 or >0 as a is before, equal to or after b
+ */
+int
+ci2c_timespec_cmp (struct timespec a, struct timespec b);
+
+/**
+ * Returns a monotonic deadline usec microseconds from now.
+ */
+struct timespec
+ci2c_deadline_after_usec (uint64_t usec);
+
+/**
+ * Returns the microseconds left until the deadline, 0 if it passed.
+ */
+uint64_t
+ci2c_usec_until (struct timespec deadline);
+
+/**
+ * Sleeps for the given number of microseconds, resuming after
+ * signals.
+ */
+void
+ci2c_sleep_usec (uint64_t usec);
+
+/* How the command path waits for a deadline */
+enum CI2C_WAIT_STRATEGY
+  {
+    WAIT_NANOSLEEP = 0,         /**< Relative nanosleep, resumed with
+                                   the remainder */
+    WAIT_ABSOLUTE,              /**< clock_nanosleep to an absolute
+                                   monotonic deadline */
+    WAIT_HYBRID,                /**< Absolute sleep until spin_usec
+                                   before the deadline, then spin */
+    WAIT_TIMERFD,               /**< Block on a per-thread timerfd */
+    WAIT_STRATEGY_COUNT
+  };
+
+/* Overshoot histogram bucket limits in microseconds.  The last bucket
+   holds everything above the last limit. */
+#define CI2C_WAIT_BUCKETS 6
+#define CI2C_WAIT_BUCKET_LIMITS { 10, 50, 100, 500, 1000 }
+
+#define CI2C_WAIT_DEFAULT_SPIN_USEC 100
+
+/* How late wake-ups were, per strategy */
+struct ci2c_wait_stats
+{
+  unsigned long waits;
+  uint64_t total_overshoot_usec;
+  uint64_t max_overshoot_usec;
+  unsigned long buckets[CI2C_WAIT_BUCKETS];
+};
+
+/**
+ * Selects the wait strategy for the whole library.
+ *
+ * @param strategy The strategy
+ * @param spin_usec For WAIT_HYBRID, how long before the deadline to
+ * stop sleeping and start spinning
+ */
+void
+ci2c_set_wait_strategy (enum CI2C_WAIT_STRATEGY strategy,
+                        unsigned int spin_usec);
+
+/**
+ * Returns the current wait strategy.
+ */
+enum CI2C_WAIT_STRATEGY
+ci2c_get_wait_strategy (void);
+
+/**
+ * Waits until the monotonic deadline with the current strategy and
+ * records how far past it the caller was woken.
+ *
+ * @param deadline The absolute monotonic deadline
+ */
+void
+ci2c_wait_until (struct timespec deadline);
+
+/**
+ * Waits for usec microseconds with the current strategy.
+ *
+ * @param usec The time to wait
+ */
+void
+ci2c_wait_usec (uint64_t usec);
+
+/**
+ * Retrieves the overshoot statistics of a strategy.
+ *
+ * @param strategy The strategy
+ * @param stats Filled with the statistics
+ */
+void
+ci2c_wait_stats_get (enum CI2C_WAIT_STRATEGY strategy,
+                     struct ci2c_wait_stats *stats);
+
+/**
+ * Clears the overshoot statistics of every strategy.
+ */
+void
+ci2c_wait_stats_reset (void);
+
+/**
+ * Creates a non-blocking monotonic timerfd, for event loops that want
+ * to wait for device deadlines themselves.
+ *
+ * @return The timerfd or -1 on error
+ */
+int
+ci2c_timerfd_create (void);
+
+/**
+ * Arms a timerfd to fire once at an absolute monotonic deadline.
+ *
+ * @param tfd The timerfd
+ * @param deadline The deadline
+ *
+ * @return 0 on success, -1 on error
+ */
+int
+ci2c_timerfd_arm (int tfd, struct timespec deadline);
+
+#endif /* TIMING_H */
@@ -0,0 +1,169 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "transport.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include "exec_model.h"
+#include "fd_table.h"
+#include "log.h"
+
+struct ci2c_bus_entry
+{
+  const struct ci2c_transport *transport;
+  void *ctx;
+  int addr;
+};
+
+static struct ci2c_fd_table bus_table =
+  CI2C_FD_TABLE_INITIALIZER (struct ci2c_bus_entry);
+
+static const struct ci2c_transport *default_transport = &ci2c_i2cdev_transport;
+static void *default_arg = NULL;
+
+static struct ci2c_bus_entry *
+get_entry (int fd)
+{
+  return (struct ci2c_bus_entry *)ci2c_fd_table_find (&bus_table, fd);
+}
+
+static struct ci2c_bus_entry *
+new_entry (int fd)
+{
+  return (struct ci2c_bus_entry *)ci2c_fd_table_get (&bus_table, fd);
+}
+
+int
+ci2c_transport_open (const struct ci2c_transport *t,
+                     const char *bus, void *arg)
+{
+  void *ctx = NULL;
+  int fd;
+  struct ci2c_bus_entry *entry;
+
+  assert (NULL != t);
+  assert (NULL != t->open);
+
+  if ((fd = t->open (bus, arg, &ctx)) < 0)
+    return -1;
+
+  if (NULL == (entry = new_entry (fd)))
+    {
+      CI2C_LOG (SEVERE, "No room to track descriptor %d for %s",
+                fd, t->name);
+
+      if (NULL != t->close)
+        t->close (fd, ctx);
+
+      return -1;
+    }
+
+  entry->transport = t;
+  entry->ctx = ctx;
+  entry->addr = -1;
+
+  CI2C_LOG (DEBUG, "Opened %s on %d via %s",
+            NULL != bus ? bus : "(none)", fd, t->name);
+
+  return fd;
+}
+
+const struct ci2c_transport *
+ci2c_transport_get (int fd)
+{
+  struct ci2c_bus_entry *entry = get_entry (fd);
+
+  if (NULL == entry || NULL == entry->transport)
+    return &ci2c_i2cdev_transport;
+
+  return entry->transport;
+}
+
+void *
+ci2c_transport_ctx (int fd)
+{
+  struct ci2c_bus_entry *entry = get_entry (fd);
+
+  return (NULL != entry) ? entry->ctx : NULL;
+}
+
+int
+ci2c_transport_addr (int fd)
+{
+  struct ci2c_bus_entry *entry = get_entry (fd);
+
+  if (NULL == entry || NULL == entry->transport)
+    return -1;
+
+  return entry->addr;
+}
+
+void
+ci2c_transport_set_addr (int fd, int addr)
+{
+  struct ci2c_bus_entry *entry = new_entry (fd);
+
+  if (NULL == entry)
+    return;
+
+  /* Descriptors opened outside the library are i2c-dev ones */
+  if (NULL == entry->transport)
+    {
+      entry->transport = &ci2c_i2cdev_transport;
+      entry->ctx = NULL;
+    }
+
+  entry->addr = addr;
+}
+
+void
+ci2c_transport_close (int fd)
+{
+  const struct ci2c_transport *t = ci2c_transport_get (fd);
+  struct ci2c_bus_entry *entry = get_entry (fd);
+  void *ctx = ci2c_transport_ctx (fd);
+
+  /* Once closed the number may be handed out again at once, even to
+     another thread opening a bus, so drop everything kept about it
+     first */
+  if (NULL != entry)
+    memset (entry, 0, sizeof (*entry));
+
+  ci2c_exec_model_forget_fd (fd);
+
+  if (NULL != t->close)
+    t->close (fd, ctx);
+  else
+    close (fd);
+}
+
+void
+ci2c_set_default_transport (const struct ci2c_transport *t, void *arg)
+{
+  default_transport = (NULL != t) ? t : &ci2c_i2cdev_transport;
+  default_arg = arg;
+}
+
+int
+ci2c_transport_open_default (const char *bus)
+{
+  return ci2c_transport_open (default_transport, bus, default_arg);
+}
@@ -0,0 +1,305 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* The bytes the library writes to wake, idle and sleep a device.  All
+   backends see the same sequences. */
+#define CI2C_WORD_ADDR_RESET   0x00
+#define CI2C_WORD_ADDR_SLEEP   0x01
+#define CI2C_WORD_ADDR_IDLE    0x02
+#define CI2C_WORD_ADDR_COMMAND 0x03
+
+/* Every socketpair bus transaction is a request packet from the
+   library followed by a reply packet from the peer, so reads stay
+   master driven as on a real bus:
+
+     write:  'W' data...      ->  status
+     read:   'R' len_lo len_hi ->  status data...
+
+   status is 1 if the device ACKed, 0 if it NAKed. */
+#define CI2C_SOCK_OP_WRITE 'W'
+#define CI2C_SOCK_OP_READ  'R'
+
+/**
+ * The operations a bus backend provides.  Every operation other than
+ * open takes the descriptor returned by open; backends look up their
+ * private state with ci2c_transport_ctx().  close is handed that state
+ * instead, as the descriptor is unbound by then.  combined and
+ * write_read are optional and may be NULL.
+ */
+struct ci2c_transport
+{
+  const char *name;
+  /* Returns a descriptor or -1.  *ctx is bound to the descriptor. */
+  int (*open) (const char *bus, void *arg, void **ctx);
+  /* Selects the slave address.  Returns 0 on success. */
+  int (*acquire) (int fd, int addr);
+  ssize_t (*write) (int fd, const uint8_t *buf, unsigned int len);
+  ssize_t (*read) (int fd, uint8_t *buf, unsigned int len);
+  /* Returns true if write_read can be used on this descriptor */
+  bool (*combined) (int fd);
+  ssize_t (*write_read) (int fd,
+                         const uint8_t *send_buf, unsigned int send_len,
+                         uint8_t *recv_buf, unsigned int recv_len);
+  /* Sends the wake pulse.  Does not read the wake status. */
+  bool (*wake) (int fd);
+  bool (*idle) (int fd);
+  int (*sleep) (int fd);
+  void (*close) (int fd, void *ctx);
+};
+
+/* The Linux /dev/i2c-N backend.  This is the default. */
+extern const struct ci2c_transport ci2c_i2cdev_transport;
+
+/* The in-process backend, see struct ci2c_mem_device */
+extern const struct ci2c_transport ci2c_mem_transport;
+
+/* The SOCK_SEQPACKET socketpair backend, see ci2c_socketpair_serve */
+extern const struct ci2c_transport ci2c_socketpair_transport;
+
+/**
+ * Opens a bus through the given transport and binds the descriptor
+ * to it.
+ *
+ * @param t The transport
+ * @param bus The bus name, interpreted by the transport
+ * @param arg Transport specific argument
+ *
+ * @return The descriptor or -1 on error
+ */
+int
+ci2c_transport_open (const struct ci2c_transport *t,
+                     const char *bus, void *arg);
+
+/**
+ * Returns the transport bound to the descriptor.  Descriptors that
+ * were not opened through a transport use the i2c-dev backend.
+ *
+ * @param fd The descriptor
+ */
+const struct ci2c_transport *
+ci2c_transport_get (int fd);
+
+/**
+ * Returns the private state the transport bound to the descriptor.
+ *
+ * @param fd The descriptor
+ */
+void *
+ci2c_transport_ctx (int fd);
+
+/**
+ * Returns the last slave address acquired on the descriptor, or -1.
+ *
+ * @param fd The descriptor
+ */
+int
+ci2c_transport_addr (int fd);
+
+/**
+ * Records the slave address acquired on the descriptor.
+ *
+ * @param fd The descriptor
+ * @param addr The slave address
+ */
+void
+ci2c_transport_set_addr (int fd, int addr);
+
+/**
+ * Unbinds the descriptor and then closes it through its transport.
+ *
+ * @param fd The descriptor
+ */
+void
+ci2c_transport_close (int fd);
+
+/**
+ * Sets the transport used by ci2c_setup and ci2c_atmel_setup.
+ *
+ * @param t The transport, NULL restores i2c-dev
+ * @param arg The argument passed to the transport's open
+ */
+void
+ci2c_set_default_transport (const struct ci2c_transport *t, void *arg);
+
+/**
+ * Opens a bus through the default transport.
+ *
+ * @param bus The bus name
+ *
+ * @return The descriptor or -1 on error
+ */
+int
+ci2c_transport_open_default (const char *bus);
+
+/**
+ * An in-process device for the memory backend.  write is handed every
+ * frame the library sends, including the wake, idle and sleep
+ * sequences; read fills in the device's reply.  Both return the
+ * number of bytes transferred or -1 to NAK.
+ */
+struct ci2c_mem_device
+{
+  ssize_t (*write) (void *arg, int addr, const uint8_t *buf, unsigned int len);
+  ssize_t (*read) (void *arg, int addr, uint8_t *buf, unsigned int len);
+  void *arg;
+};
+
+enum CI2C_EMU_STATE
+  {
+    EMU_ASLEEP = 0,
+    EMU_IDLE,
+    EMU_AWAKE
+  };
+
+/**
+ * A minimal ATSHA204 stand-in for the memory and socketpair
+ * backends.  It answers the wake sequence, honours idle and sleep,
+ * checks the CRC of every command and mimics execution time by
+ * NAKing reads for busy_usec after each command, and then the next
+ * busy_reads reads.  respond, if set, builds the
+ * payload for a command; otherwise every command returns a success
+ * status.
+ */
+struct ci2c_emulator
+{
+  enum CI2C_EMU_STATE state;
+  unsigned int busy_reads;
+  unsigned int busy_usec;
+  unsigned int (*respond) (void *arg, const uint8_t *frame, unsigned int len,
+                           uint8_t *payload, unsigned int max);
+  void *respond_arg;
+
+  /* Internal */
+  unsigned int busy_left;
+  struct timespec ready_at;
+  uint8_t rsp[256];
+  unsigned int rsp_len;
+
+  /* Statistics */
+  unsigned long commands;
+  unsigned long wakes;
+  unsigned long naks;
+};
+
+/**
+ * Initializes an emulator, asleep, with no execution delay.
+ *
+ * @param emu The emulator
+ */
+void
+ci2c_emulator_init (struct ci2c_emulator *emu);
+
+/**
+ * Returns a memory device backed by the emulator, suitable as the
+ * arg to ci2c_transport_open with ci2c_mem_transport.
+ *
+ * @param emu The emulator
+ */
+struct ci2c_mem_device
+ci2c_emulator_device (struct ci2c_emulator *emu);
+
+#define CI2C_MUX_SIM_CHANNELS 8
+#define CI2C_MUX_SIM_DEVICES 4
+
+struct ci2c_mux_sim_slot
+{
+  int addr;
+  struct ci2c_mem_device dev;
+};
+
+/**
+ * A PCA9548 style mux for the memory backend.  A one byte write to
+ * the mux's address enables the channels whose bits are set and a
+ * read returns them.  Other transfers go to the root devices and the
+ * devices on enabled channels that answer to the address.  When more
+ * than one answers, all see the writes, the first one's read is
+ * returned and the clash is counted.
+ */
+struct ci2c_mux_sim
+{
+  int addr;
+  uint8_t enabled;
+  struct ci2c_mux_sim_slot root[CI2C_MUX_SIM_DEVICES];
+  unsigned int nroot;
+  struct ci2c_mux_sim_slot slots[CI2C_MUX_SIM_CHANNELS][CI2C_MUX_SIM_DEVICES];
+  unsigned int nslots[CI2C_MUX_SIM_CHANNELS];
+
+  /* Statistics */
+  unsigned long selects;        /**< Writes to the mux */
+  unsigned long clashes;        /**< Transfers more than one device
+                                   answered */
+};
+
+/**
+ * Initializes a mux with every channel off and nothing attached.
+ *
+ * @param mux The mux
+ * @param addr The mux's 7 bit address
+ */
+void
+ci2c_mux_sim_init (struct ci2c_mux_sim *mux, int addr);
+
+/**
+ * Attaches a device to a channel, or to the root segment.
+ *
+ * @param mux The mux
+ * @param channel The channel, or -1 for the root segment
+ * @param addr The device's 7 bit address
+ * @param dev The device, copied
+ *
+ * @return 0 on success, -1 if the channel is full or doesn't exist
+ */
+int
+ci2c_mux_sim_attach (struct ci2c_mux_sim *mux, int channel, int addr,
+                     const struct ci2c_mem_device *dev);
+
+/**
+ * Returns a memory device for the whole bus behind the mux, suitable
+ * as the arg to ci2c_transport_open with ci2c_mem_transport.
+ *
+ * @param mux The mux
+ */
+struct ci2c_mem_device
+ci2c_mux_sim_device (struct ci2c_mux_sim *mux);
+
+/**
+ * Serves the device end of a socketpair: every packet read from peer
+ * is handed to dev->write and the device's reply, if any, is sent
+ * back.  Returns when the library end is closed.  Meant to be run on
+ * its own thread.
+ *
+ * @param peer The peer descriptor returned through the socketpair
+ * backend's open
+ * @param dev The device to serve
+ *
+ * @return 0 when the library end closed, -1 on error
+ */
+int
+ci2c_socketpair_serve (int peer, const struct ci2c_mem_device *dev);
+
+#endif /* TRANSPORT_H */
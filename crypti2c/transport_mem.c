@@ -0,0 +1,419 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "transport.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "crc.h"
+#include "util.h"
+#include "log.h"
+#include "timing.h"
+
+/* The memory backend still hands out a real descriptor so that it can
+   be keyed, polled and closed like any other.  Nothing is ever read
+   from or written to it. */
+static int
+mem_open (const char *bus, void *arg, void **ctx)
+{
+  const struct ci2c_mem_device *dev = arg;
+  struct ci2c_mem_device *copy;
+  int fd;
+
+  assert (NULL != dev);
+  assert (NULL != dev->write);
+  assert (NULL != dev->read);
+
+  if ((fd = open ("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+    return -1;
+
+  copy = (struct ci2c_mem_device *)ci2c_malloc_wipe (sizeof (*copy));
+  *copy = *dev;
+  *ctx = copy;
+
+  return fd;
+}
+
+static int
+mem_acquire (int fd, int addr)
+{
+  return 0;
+}
+
+static ssize_t
+mem_write (int fd, const uint8_t *buf, unsigned int len)
+{
+  struct ci2c_mem_device *dev = ci2c_transport_ctx (fd);
+
+  return dev->write (dev->arg, ci2c_transport_addr (fd), buf, len);
+}
+
+static ssize_t
+mem_read (int fd, uint8_t *buf, unsigned int len)
+{
+  struct ci2c_mem_device *dev = ci2c_transport_ctx (fd);
+
+  return dev->read (dev->arg, ci2c_transport_addr (fd), buf, len);
+}
+
+static bool
+mem_wake (int fd)
+{
+  uint8_t wup[] = {CI2C_WORD_ADDR_RESET, CI2C_WORD_ADDR_RESET};
+
+  return mem_write (fd, wup, sizeof (wup)) > 1;
+}
+
+static bool
+mem_idle (int fd)
+{
+  uint8_t idle[] = {CI2C_WORD_ADDR_IDLE};
+
+  return 1 == mem_write (fd, idle, sizeof (idle));
+}
+
+static int
+mem_sleep (int fd)
+{
+  uint8_t sleep_byte[] = {CI2C_WORD_ADDR_SLEEP};
+
+  return mem_write (fd, sleep_byte, sizeof (sleep_byte));
+}
+
+static void
+mem_close (int fd, void *ctx)
+{
+  struct ci2c_mem_device *dev = (struct ci2c_mem_device *)ctx;
+
+  if (NULL != dev)
+    ci2c_free_wipe ((uint8_t *)dev, sizeof (*dev));
+
+  close (fd);
+}
+
+const struct ci2c_transport ci2c_mem_transport =
+  {
+    .name = "memory",
+    .open = mem_open,
+    .acquire = mem_acquire,
+    .write = mem_write,
+    .read = mem_read,
+    .combined = NULL,
+    .write_read = NULL,
+    .wake = mem_wake,
+    .idle = mem_idle,
+    .sleep = mem_sleep,
+    .close = mem_close
+  };
+
+/* Emulator */
+
+static void
+emu_set_response (struct ci2c_emulator *emu,
+                  const uint8_t *payload, unsigned int len)
+{
+  uint16_t crc;
+
+  assert (len + 3 <= sizeof (emu->rsp));
+
+  emu->rsp[0] = len + 3;
+  memcpy (&emu->rsp[1], payload, len);
+  crc = ci2c_calculate_crc16 (emu->rsp, len + 1);
+  memcpy (&emu->rsp[len + 1], &crc, sizeof (crc));
+  emu->rsp_len = len + 3;
+}
+
+static void
+emu_set_status (struct ci2c_emulator *emu, uint8_t status)
+{
+  emu_set_response (emu, &status, 1);
+}
+
+static ssize_t
+emu_write (void *arg, int addr, const uint8_t *buf, unsigned int len)
+{
+  struct ci2c_emulator *emu = arg;
+  uint8_t payload[sizeof (emu->rsp) - 3];
+  unsigned int count;
+
+  if (0 == len)
+    return -1;
+
+  /* Any traffic wakes a sleeping or idle device.  A wake token while
+     awake is answered with the awake status again so that callers
+     can resynchronise. */
+  if (EMU_AWAKE != emu->state
+      || (CI2C_WORD_ADDR_RESET == buf[0] && 0 == emu->rsp_len))
+    {
+      emu->state = EMU_AWAKE;
+      emu->wakes++;
+      emu->busy_left = 0;
+      emu_set_status (emu, 0x11);
+      return len;
+    }
+
+  switch (buf[0])
+    {
+    case CI2C_WORD_ADDR_RESET:
+      break;
+    case CI2C_WORD_ADDR_SLEEP:
+      emu->state = EMU_ASLEEP;
+      emu->rsp_len = 0;
+      break;
+    case CI2C_WORD_ADDR_IDLE:
+      emu->state = EMU_IDLE;
+      emu->rsp_len = 0;
+      break;
+    case CI2C_WORD_ADDR_COMMAND:
+      emu->commands++;
+      count = (len > 1) ? buf[1] : 0;
+
+      if (count < 3 || count != len - 1
+          || !ci2c_is_crc_16_valid (&buf[1], count - CI2C_CRC_16_LEN,
+                                    &buf[1 + count - CI2C_CRC_16_LEN]))
+        {
+          emu_set_status (emu, 0xFF);
+        }
+      else if (NULL != emu->respond)
+        {
+          emu_set_response (emu, payload,
+                            emu->respond (emu->respond_arg, &buf[1], count,
+                                          payload, sizeof (payload)));
+        }
+      else
+        {
+          emu_set_status (emu, 0x00);
+        }
+
+      emu->busy_left = emu->busy_reads;
+      emu->ready_at = ci2c_deadline_after_usec (emu->busy_usec);
+      break;
+    default:
+      emu->naks++;
+      errno = ENXIO;
+      return -1;
+    }
+
+  return len;
+}
+
+static ssize_t
+emu_read (void *arg, int addr, uint8_t *buf, unsigned int len)
+{
+  struct ci2c_emulator *emu = arg;
+
+  if (EMU_AWAKE != emu->state || 0 == emu->rsp_len)
+    {
+      emu->naks++;
+      errno = ENXIO;
+      return -1;
+    }
+
+  if (emu->busy_usec > 0 && ci2c_usec_until (emu->ready_at) > 0)
+    {
+      emu->naks++;
+      errno = EBUSY;
+      return -1;
+    }
+
+  if (emu->busy_left > 0)
+    {
+      emu->busy_left--;
+      emu->naks++;
+      errno = EBUSY;
+      return -1;
+    }
+
+  /* Like the bus, a read longer than the response is padded */
+  memset (buf, 0xFF, len);
+  memcpy (buf, emu->rsp, (len < emu->rsp_len) ? len : emu->rsp_len);
+  emu->rsp_len = 0;
+
+  return len;
+}
+
+void
+ci2c_emulator_init (struct ci2c_emulator *emu)
+{
+  assert (NULL != emu);
+
+  memset (emu, 0, sizeof (*emu));
+  emu->state = EMU_ASLEEP;
+}
+
+struct ci2c_mem_device
+ci2c_emulator_device (struct ci2c_emulator *emu)
+{
+  struct ci2c_mem_device dev;
+
+  assert (NULL != emu);
+
+  dev.write = emu_write;
+  dev.read = emu_read;
+  dev.arg = emu;
+
+  return dev;
+}
+
+/* Mux */
+
+void
+ci2c_mux_sim_init (struct ci2c_mux_sim *mux, int addr)
+{
+  assert (NULL != mux);
+
+  memset (mux, 0, sizeof (*mux));
+  mux->addr = addr;
+}
+
+int
+ci2c_mux_sim_attach (struct ci2c_mux_sim *mux, int channel, int addr,
+                     const struct ci2c_mem_device *dev)
+{
+  struct ci2c_mux_sim_slot *slot;
+
+  assert (NULL != mux);
+  assert (NULL != dev);
+
+  if (channel < 0)
+    {
+      if (mux->nroot >= CI2C_MUX_SIM_DEVICES)
+        return -1;
+
+      slot = &mux->root[mux->nroot++];
+    }
+  else
+    {
+      if (channel >= CI2C_MUX_SIM_CHANNELS
+          || mux->nslots[channel] >= CI2C_MUX_SIM_DEVICES)
+        return -1;
+
+      slot = &mux->slots[channel][mux->nslots[channel]++];
+    }
+
+  slot->addr = addr;
+  slot->dev = *dev;
+
+  return 0;
+}
+
+/* Collects the devices that answer to addr right now */
+static unsigned int
+mux_sim_targets (struct ci2c_mux_sim *mux, int addr,
+                 struct ci2c_mux_sim_slot **targets)
+{
+  unsigned int n = 0, x, ch;
+
+  for (x = 0; x < mux->nroot; x++)
+    if (mux->root[x].addr == addr)
+      targets[n++] = &mux->root[x];
+
+  for (ch = 0; ch < CI2C_MUX_SIM_CHANNELS; ch++)
+    if (mux->enabled & (1 << ch))
+      for (x = 0; x < mux->nslots[ch]; x++)
+        if (mux->slots[ch][x].addr == addr)
+          targets[n++] = &mux->slots[ch][x];
+
+  if (n > 1)
+    mux->clashes++;
+
+  return n;
+}
+
+static ssize_t
+mux_sim_write (void *arg, int addr, const uint8_t *buf, unsigned int len)
+{
+  struct ci2c_mux_sim *mux = arg;
+  struct ci2c_mux_sim_slot *targets[(CI2C_MUX_SIM_CHANNELS + 1)
+                                    * CI2C_MUX_SIM_DEVICES];
+  unsigned int n, x;
+  ssize_t rc = -1, r;
+
+  if (addr == mux->addr)
+    {
+      if (1 != len)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      mux->enabled = buf[0];
+      mux->selects++;
+
+      return len;
+    }
+
+  n = mux_sim_targets (mux, addr, targets);
+
+  for (x = 0; x < n; x++)
+    {
+      r = targets[x]->dev.write (targets[x]->dev.arg, addr, buf, len);
+
+      if (0 == x)
+        rc = r;
+    }
+
+  if (0 == n)
+    errno = ENXIO;
+
+  return rc;
+}
+
+static ssize_t
+mux_sim_read (void *arg, int addr, uint8_t *buf, unsigned int len)
+{
+  struct ci2c_mux_sim *mux = arg;
+  struct ci2c_mux_sim_slot *targets[(CI2C_MUX_SIM_CHANNELS + 1)
+                                    * CI2C_MUX_SIM_DEVICES];
+
+  if (addr == mux->addr)
+    {
+      if (0 == len)
+        return 0;
+
+      memset (buf, mux->enabled, len);
+
+      return len;
+    }
+
+  if (0 == mux_sim_targets (mux, addr, targets))
+    {
+      errno = ENXIO;
+      return -1;
+    }
+
+  return targets[0]->dev.read (targets[0]->dev.arg, addr, buf, len);
+}
+
+struct ci2c_mem_device
+ci2c_mux_sim_device (struct ci2c_mux_sim *mux)
+{
+  struct ci2c_mem_device dev;
+
+  assert (NULL != mux);
+
+  dev.write = mux_sim_write;
+  dev.read = mux_sim_read;
+  dev.arg = mux;
+
+  return dev;
+}
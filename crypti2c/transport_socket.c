@@ -0,0 +1,195 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "transport.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+
+#define SOCK_MAX_PACKET 258
+
+static int
+sock_open (const char *bus, void *arg, void **ctx)
+{
+  int *peer = arg;
+  int sv[2];
+
+  assert (NULL != peer);
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    return -1;
+
+  *peer = sv[1];
+
+  return sv[0];
+}
+
+static int
+sock_acquire (int fd, int addr)
+{
+  return 0;
+}
+
+static ssize_t
+sock_write (int fd, const uint8_t *buf, unsigned int len)
+{
+  uint8_t pkt[SOCK_MAX_PACKET];
+  uint8_t status = 0;
+
+  if (len + 1 > sizeof (pkt))
+    {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+  pkt[0] = CI2C_SOCK_OP_WRITE;
+  memcpy (&pkt[1], buf, len);
+
+  if (send (fd, pkt, len + 1, MSG_NOSIGNAL) < 0
+      || recv (fd, &status, sizeof (status), 0) != 1)
+    return -1;
+
+  if (1 != status)
+    {
+      errno = ENXIO;
+      return -1;
+    }
+
+  return len;
+}
+
+static ssize_t
+sock_read (int fd, uint8_t *buf, unsigned int len)
+{
+  uint8_t pkt[SOCK_MAX_PACKET];
+  ssize_t got;
+
+  if (len + 1 > sizeof (pkt))
+    {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+  pkt[0] = CI2C_SOCK_OP_READ;
+  pkt[1] = len & 0xFF;
+  pkt[2] = len >> 8;
+
+  if (send (fd, pkt, 3, MSG_NOSIGNAL) < 0
+      || (got = recv (fd, pkt, len + 1, 0)) < 1)
+    return -1;
+
+  if (1 != pkt[0])
+    {
+      errno = ENXIO;
+      return -1;
+    }
+
+  memcpy (buf, &pkt[1], got - 1);
+
+  return got - 1;
+}
+
+static bool
+sock_wake (int fd)
+{
+  uint8_t wup[] = {CI2C_WORD_ADDR_RESET, CI2C_WORD_ADDR_RESET};
+
+  return sock_write (fd, wup, sizeof (wup)) > 1;
+}
+
+static bool
+sock_idle (int fd)
+{
+  uint8_t idle[] = {CI2C_WORD_ADDR_IDLE};
+
+  return 1 == sock_write (fd, idle, sizeof (idle));
+}
+
+static int
+sock_sleep (int fd)
+{
+  uint8_t sleep_byte[] = {CI2C_WORD_ADDR_SLEEP};
+
+  return sock_write (fd, sleep_byte, sizeof (sleep_byte));
+}
+
+static void
+sock_close (int fd, void *ctx)
+{
+  close (fd);
+}
+
+const struct ci2c_transport ci2c_socketpair_transport =
+  {
+    .name = "socketpair",
+    .open = sock_open,
+    .acquire = sock_acquire,
+    .write = sock_write,
+    .read = sock_read,
+    .combined = NULL,
+    .write_read = NULL,
+    .wake = sock_wake,
+    .idle = sock_idle,
+    .sleep = sock_sleep,
+    .close = sock_close
+  };
+
+int
+ci2c_socketpair_serve (int peer, const struct ci2c_mem_device *dev)
+{
+  uint8_t pkt[SOCK_MAX_PACKET];
+  ssize_t got, rc;
+  unsigned int len;
+
+  assert (NULL != dev);
+
+  while ((got = recv (peer, pkt, sizeof (pkt), 0)) > 0)
+    {
+      if (CI2C_SOCK_OP_WRITE == pkt[0])
+        {
+          rc = dev->write (dev->arg, -1, &pkt[1], got - 1);
+          pkt[0] = (rc >= 0) ? 1 : 0;
+          rc = send (peer, pkt, 1, MSG_NOSIGNAL);
+        }
+      else if (CI2C_SOCK_OP_READ == pkt[0] && got >= 3)
+        {
+          len = pkt[1] | (pkt[2] << 8);
+          if (len > sizeof (pkt) - 1)
+            len = sizeof (pkt) - 1;
+
+          rc = dev->read (dev->arg, -1, &pkt[1], len);
+          pkt[0] = (rc >= 0) ? 1 : 0;
+          rc = send (peer, pkt, (rc >= 0) ? rc + 1 : 1, MSG_NOSIGNAL);
+        }
+      else
+        {
+          CI2C_LOG (WARNING, "Unknown socketpair request 0x%02x", pkt[0]);
+          rc = -1;
+        }
+
+      if (rc < 0)
+        return -1;
+    }
+
+  return (0 == got) ? 0 : -1;
+}
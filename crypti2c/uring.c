@@ -0,0 +1,855 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "uring.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "i2c.h"
+#include "transport.h"
+#include "timing.h"
+#include "exec_model.h"
+#include "fd_table.h"
+#include "util.h"
+#include "log.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef IORING_TIMEOUT_ETIME_SUCCESS
+#define IORING_TIMEOUT_ETIME_SUCCESS (1U << 5)
+#endif
+
+/* The steps of a command, in chain order.  The step rides in the low
+   bits of each submission's user_data, under the op pointer. */
+enum CI2C_URING_STEP
+  {
+    STEP_BACKOFF = 0,           /* Delay before a resend */
+    STEP_WRITE,                 /* The command frame */
+    STEP_WSTATUS,               /* Socketpair only: the write's ACK */
+    STEP_WAIT,                  /* Execution time, or the poll interval */
+    STEP_RSEND,                 /* Socketpair only: the read request */
+    STEP_READ,                  /* The response */
+    STEP_COUNT
+  };
+
+#define STEP_BIT(step) (1U << (step))
+#define STEP_MASK 0x7
+
+/* user_data of the engine's own wait timer */
+#define TIMER_DATA 0
+
+struct fd_queue
+{
+  struct ci2c_uring_op *head;
+  struct ci2c_uring_op *tail;
+};
+
+struct ci2c_uring
+{
+  int ring_fd;
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int sq_entries;
+  unsigned int sqe_tail;        /* Ours, published on flush */
+
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Older kernels can't continue a chain past an expired timeout.
+     There every wait ends its chain and the rest follows on its
+     completion. */
+  bool split_waits;
+  bool chain_waits;             /* What the kernel supports */
+  bool cur_pos;                 /* Offset -1 means the file position */
+
+  unsigned int in_flight;
+  int completed;
+  int64_t timer_ts[2];
+  struct ci2c_uring_stats stats;
+  struct ci2c_fd_table queue;   /* struct fd_queue per descriptor */
+};
+
+static int
+uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+             unsigned int flags)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                  NULL, 0);
+}
+
+static void
+set_ts (int64_t *ts, uint64_t usec)
+{
+  ts[0] = usec / 1000000;
+  ts[1] = (usec % 1000000) * 1000;
+}
+
+static void
+count_batch (struct ci2c_uring *u, unsigned int n)
+{
+  unsigned int bucket = 0;
+
+  u->stats.enters++;
+  u->stats.sqes += n;
+
+  if (n > u->stats.max_batch)
+    u->stats.max_batch = n;
+
+  while (bucket < 4 && n >= (2U << bucket))
+    bucket++;
+
+  u->stats.batch_hist[bucket]++;
+}
+
+/* Publishes queued entries to the kernel and optionally waits */
+static int
+flush (struct ci2c_uring *u, unsigned int min_complete)
+{
+  unsigned int pending;
+  int rc;
+
+  __atomic_store_n (u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+
+  pending = u->sqe_tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE);
+
+  if (0 == pending && 0 == min_complete)
+    return 0;
+
+  do
+    rc = uring_enter (u->ring_fd, pending, min_complete,
+                      min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+  while (rc < 0 && EINTR == errno);
+
+  if (rc > 0)
+    count_batch (u, rc);
+
+  return rc;
+}
+
+/* Makes room for n entries, so a chain never straddles two enters */
+static int
+reserve (struct ci2c_uring *u, unsigned int n)
+{
+  if (u->sqe_tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE)
+      + n <= u->sq_entries)
+    return 0;
+
+  if (flush (u, 0) < 0)
+    return -1;
+
+  return (u->sqe_tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE)
+          + n <= u->sq_entries) ? 0 : -1;
+}
+
+static struct io_uring_sqe *
+get_sqe (struct ci2c_uring *u, uint64_t user_data)
+{
+  unsigned int idx = u->sqe_tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->user_data = user_data;
+  u->sq_array[idx] = idx;
+  u->sqe_tail++;
+
+  return sqe;
+}
+
+static void
+prep_io (struct io_uring_sqe *sqe, uint8_t opcode, int fd,
+         void *buf, unsigned int len)
+{
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+}
+
+static void
+prep_timeout (struct ci2c_uring *u, struct io_uring_sqe *sqe, int64_t *ts)
+{
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uintptr_t)ts;
+  sqe->len = 1;
+
+  if (!u->split_waits)
+    sqe->timeout_flags = IORING_TIMEOUT_ETIME_SUCCESS;
+}
+
+/* Queues the steps of a command from the given one to the read as
+   one linked chain */
+static int
+submit_chain (struct ci2c_uring *u, struct ci2c_uring_op *op,
+              unsigned int from)
+{
+  struct io_uring_sqe *sqe = NULL;
+  unsigned int frame_len = op->rsp_len + CI2C_RSP_OVERHEAD;
+  unsigned int step;
+
+  if (reserve (u, STEP_COUNT) < 0)
+    return -1;
+
+  op->resume = 0;
+
+  for (step = from; step < STEP_COUNT; step++)
+    {
+      if (!op->sock && (STEP_WSTATUS == step || STEP_RSEND == step))
+        continue;
+
+      if (STEP_BACKOFF == step && 0 == op->backoff_usec)
+        continue;
+
+      if (NULL != sqe)
+        sqe->flags |= IOSQE_IO_LINK;
+
+      sqe = get_sqe (u, (uintptr_t)op | step);
+      op->steps |= STEP_BIT (step);
+      op->res[step] = 0;
+      op->outstanding++;
+
+      switch (step)
+        {
+        case STEP_BACKOFF:
+          set_ts (op->backoff_ts, op->backoff_usec);
+          prep_timeout (u, sqe, op->backoff_ts);
+          break;
+        case STEP_WRITE:
+          ci2c_now (&op->sent_at);
+          op->sent_at = ci2c_timespec_add
+            (op->sent_at, ci2c_usec_to_timespec (op->backoff_usec));
+          if (op->sock)
+            {
+              prep_io (sqe, IORING_OP_SEND, op->fd, op->tx, op->tx_len + 1);
+              sqe->msg_flags = MSG_NOSIGNAL;
+            }
+          else
+            {
+              prep_io (sqe, IORING_OP_WRITE, op->fd, op->tx + 1, op->tx_len);
+              sqe->off = u->cur_pos ? (uint64_t)-1 : 0;
+            }
+          break;
+        case STEP_WSTATUS:
+          prep_io (sqe, IORING_OP_RECV, op->fd, &op->wstatus, 1);
+          break;
+        case STEP_WAIT:
+          set_ts (op->wait_ts, op->wait_usec);
+          prep_timeout (u, sqe, op->wait_ts);
+          break;
+        case STEP_RSEND:
+          op->rpkt[0] = CI2C_SOCK_OP_READ;
+          op->rpkt[1] = frame_len & 0xFF;
+          op->rpkt[2] = frame_len >> 8;
+          prep_io (sqe, IORING_OP_SEND, op->fd, op->rpkt, sizeof (op->rpkt));
+          sqe->msg_flags = MSG_NOSIGNAL;
+          break;
+        case STEP_READ:
+          if (op->sock)
+            prep_io (sqe, IORING_OP_RECV, op->fd, op->rx, frame_len + 1);
+          else
+            {
+              prep_io (sqe, IORING_OP_READ, op->fd, op->rx + 1, frame_len);
+              sqe->off = u->cur_pos ? (uint64_t)-1 : 0;
+            }
+          break;
+        }
+
+      if (u->split_waits && (STEP_BACKOFF == step || STEP_WAIT == step))
+        {
+          op->resume = step + 1;
+          break;
+        }
+    }
+
+  return 0;
+}
+
+static void start_op (struct ci2c_uring *u, struct ci2c_uring_op *op);
+
+static void
+finish_op (struct ci2c_uring *u, struct ci2c_uring_op *op,
+           enum CI2C_STATUS_RESPONSE status)
+{
+  struct fd_queue *q = ci2c_fd_table_find (&u->queue, op->fd);
+  struct ci2c_uring_op *next;
+  ci2c_uring_cb cb = op->cb;
+  void *cb_arg = op->cb_arg;
+
+  op->status = status;
+  ci2c_now (&op->completed);
+
+  /* Frames may carry key material */
+  ci2c_wipe (op->tx, sizeof (op->tx));
+  ci2c_wipe (op->rx, sizeof (op->rx));
+
+  q->head = next = op->next;
+  if (NULL == q->head)
+    q->tail = NULL;
+
+  u->in_flight--;
+  u->completed++;
+  u->stats.ops++;
+
+  if (RSP_TIMEOUT == status)
+    u->stats.timeouts++;
+
+  if (NULL != cb)
+    cb (op, cb_arg);
+
+  /* An op the callback submitted to an empty queue is already
+     started; only the one that was waiting isn't */
+  if (NULL != next)
+    start_op (u, next);
+}
+
+static bool
+past_deadline (const struct ci2c_uring_op *op)
+{
+  return op->policy.deadline_usec > 0 && 0 == ci2c_usec_until (op->deadline);
+}
+
+/* Caps a wait at the time left before the deadline */
+static uint64_t
+bounded_wait (const struct ci2c_uring_op *op, uint64_t usec)
+{
+  uint64_t left;
+
+  if (op->policy.deadline_usec > 0
+      && (left = ci2c_usec_until (op->deadline)) < usec)
+    usec = left;
+
+  return usec;
+}
+
+static void
+resend_op (struct ci2c_uring *u, struct ci2c_uring_op *op,
+           enum CI2C_STATUS_RESPONSE rsp)
+{
+  if (past_deadline (op))
+    {
+      finish_op (u, op, RSP_TIMEOUT);
+      return;
+    }
+
+  if (op->attempts >= op->policy.max_attempts)
+    {
+      finish_op (u, op, rsp);
+      return;
+    }
+
+  op->backoff_usec =
+    bounded_wait (op, ci2c_retry_backoff_usec (&op->policy, op->attempts));
+  op->wait_usec = op->first_wait_usec;
+  op->attempts++;
+  u->stats.resends++;
+
+  if (submit_chain (u, op, STEP_BACKOFF) < 0)
+    finish_op (u, op, RSP_COMM_ERROR);
+}
+
+/* Called when every entry of a chain has completed */
+static void
+advance_op (struct ci2c_uring *u, struct ci2c_uring_op *op)
+{
+  enum CI2C_STATUS_RESPONSE rsp;
+  const uint8_t *payload;
+  unsigned int payload_len;
+  unsigned int steps = op->steps;
+  struct timespec now;
+  ssize_t got;
+  bool write_ok;
+
+  op->steps = 0;
+
+  if (steps & STEP_BIT (STEP_WRITE))
+    {
+      write_ok = op->sock ?
+        (op->res[STEP_WRITE] == (int)op->tx_len + 1
+         && 1 == op->res[STEP_WSTATUS] && 1 == op->wstatus) :
+        op->res[STEP_WRITE] == (int)op->tx_len;
+
+      if (!write_ok)
+        {
+          CI2C_LOG (DEBUG, "Send failed on fd %d", op->fd);
+          resend_op (u, op, RSP_COMM_ERROR);
+          return;
+        }
+    }
+
+  if (0 != op->resume)
+    {
+      if (submit_chain (u, op, op->resume) < 0)
+        finish_op (u, op, RSP_COMM_ERROR);
+      return;
+    }
+
+  got = (steps & STEP_BIT (STEP_READ)) ? op->res[STEP_READ] : -1;
+
+  if (op->sock)
+    got = (got >= 1 && 1 == op->rx[0]) ? got - 1 : -1;
+
+  rsp = ci2c_check_response (op->rx + 1, got, op->rsp_len,
+                             &payload, &payload_len);
+
+  switch (rsp)
+    {
+    case RSP_NAK:
+      if (past_deadline (op)
+          || (op->policy.max_polls > 0 && op->polls >= op->policy.max_polls))
+        {
+          finish_op (u, op, RSP_TIMEOUT);
+          break;
+        }
+
+      op->polls++;
+      u->stats.polls++;
+      op->wait_usec = bounded_wait (op, op->poll_usec);
+
+      if (submit_chain (u, op, STEP_WAIT) < 0)
+        finish_op (u, op, RSP_COMM_ERROR);
+      break;
+    case RSP_AWAKE:
+    case RSP_COMM_ERROR:
+      resend_op (u, op, rsp);
+      break;
+    default:
+      if (op->learn)
+        {
+          ci2c_now (&now);
+          ci2c_exec_model_record (op->fd, ci2c_transport_addr (op->fd),
+                                  op->opcode,
+                                  ci2c_timespec_diff_usec (now, op->sent_at));
+        }
+
+      memcpy (op->rsp, payload, payload_len);
+      finish_op (u, op, rsp);
+    }
+}
+
+/* Sends the command at the head of a bus queue */
+static void
+start_op (struct ci2c_uring *u, struct ci2c_uring_op *op)
+{
+  uint64_t exec_usec = ci2c_timespec_to_usec (op->cmd->exec_time);
+
+  if (op->addr >= 0 && op->addr != ci2c_transport_addr (op->fd)
+      && ci2c_acquire_bus (op->fd, op->addr) < 0)
+    {
+      finish_op (u, op, RSP_COMM_ERROR);
+      return;
+    }
+
+  op->opcode = op->tx[1 + CI2C_OPCODE_OFFSET];
+  ci2c_retry_policy_for (op->opcode, &op->policy);
+
+  if (op->policy.deadline_usec > 0)
+    op->deadline = ci2c_deadline_after_usec (op->policy.deadline_usec);
+
+  op->first_wait_usec = exec_usec;
+  op->poll_usec = exec_usec;
+  op->learn = ci2c_exec_model_enabled ();
+
+  if (op->learn)
+    {
+      op->first_wait_usec =
+        ci2c_exec_model_first_wait (op->fd, ci2c_transport_addr (op->fd),
+                                    op->opcode, exec_usec);
+      op->poll_usec = ci2c_exec_model_poll_usec ();
+    }
+
+  op->attempts = 1;
+  op->backoff_usec = 0;
+  op->wait_usec = op->first_wait_usec;
+
+  if (submit_chain (u, op, STEP_WRITE) < 0)
+    finish_op (u, op, RSP_COMM_ERROR);
+}
+
+static void
+reap (struct ci2c_uring *u)
+{
+  unsigned int head = *u->cq_head;
+  struct io_uring_cqe *cqe;
+  struct ci2c_uring_op *op;
+  unsigned int step;
+
+  while (head != __atomic_load_n (u->cq_tail, __ATOMIC_ACQUIRE))
+    {
+      cqe = &u->cqes[head & *u->cq_mask];
+      u->stats.cqes++;
+
+      if (TIMER_DATA != cqe->user_data)
+        {
+          op = (struct ci2c_uring_op *)(uintptr_t)
+            (cqe->user_data & ~(uint64_t)STEP_MASK);
+          step = cqe->user_data & STEP_MASK;
+          op->res[step] = cqe->res;
+
+          if (0 == --op->outstanding)
+            advance_op (u, op);
+        }
+
+      head++;
+      __atomic_store_n (u->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/* Checks that a chain carries on past an expired timeout */
+static bool
+probe_etime_success (struct ci2c_uring *u)
+{
+  struct io_uring_sqe *sqe;
+  int64_t ts[2] = { 0, 0 };
+  bool ok = false;
+  unsigned int head;
+  struct io_uring_cqe *cqe;
+  unsigned int seen = 0;
+
+  sqe = get_sqe (u, 1);
+  prep_timeout (u, sqe, ts);
+  sqe->flags |= IOSQE_IO_LINK;
+  sqe = get_sqe (u, 2);
+  sqe->opcode = IORING_OP_NOP;
+
+  if (flush (u, 2) < 0)
+    return false;
+
+  for (head = *u->cq_head;
+       head != __atomic_load_n (u->cq_tail, __ATOMIC_ACQUIRE); head++)
+    {
+      cqe = &u->cqes[head & *u->cq_mask];
+      if (2 == cqe->user_data && 0 == cqe->res)
+        ok = true;
+      seen++;
+    }
+
+  __atomic_store_n (u->cq_head, head, __ATOMIC_RELEASE);
+  memset (&u->stats, 0, sizeof (u->stats));
+
+  return ok && 2 == seen;
+}
+
+struct ci2c_uring *
+ci2c_uring_new (unsigned int entries)
+{
+  struct ci2c_uring *u;
+  struct io_uring_params p;
+  size_t single;
+
+  if (0 == entries)
+    entries = CI2C_URING_DEFAULT_ENTRIES;
+
+  u = (struct ci2c_uring *)ci2c_malloc_wipe (sizeof (struct ci2c_uring));
+  ci2c_fd_table_init (&u->queue, sizeof (struct fd_queue));
+
+  memset (&p, 0, sizeof (p));
+
+  if ((u->ring_fd = syscall (__NR_io_uring_setup, entries, &p)) < 0)
+    {
+      CI2C_LOG (DEBUG, "io_uring_setup: %s", strerror (errno));
+      ci2c_free_wipe ((uint8_t *)u, sizeof (struct ci2c_uring));
+      return NULL;
+    }
+
+  u->sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      single = (u->sq_size > u->cq_size) ? u->sq_size : u->cq_size;
+      u->sq_size = u->cq_size = single;
+    }
+
+  u->sq_ptr = mmap (NULL, u->sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+
+  if (MAP_FAILED == u->sq_ptr)
+    goto fail_ring;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_ptr = u->sq_ptr;
+  else
+    {
+      u->cq_ptr = mmap (NULL, u->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, u->ring_fd,
+                        IORING_OFF_CQ_RING);
+      if (MAP_FAILED == u->cq_ptr)
+        goto fail_sq;
+    }
+
+  u->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  u->sqes = mmap (NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+
+  if (MAP_FAILED == u->sqes)
+    goto fail_cq;
+
+  u->sq_head = (unsigned int *)((char *)u->sq_ptr + p.sq_off.head);
+  u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+  u->sq_mask = (unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+  u->sq_entries = p.sq_entries;
+  u->sqe_tail = *u->sq_tail;
+
+  u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+  u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+  u->cq_mask = (unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+  u->cur_pos = (p.features & IORING_FEAT_RW_CUR_POS) != 0;
+  u->chain_waits = probe_etime_success (u);
+  u->split_waits = !u->chain_waits;
+
+  if (u->split_waits)
+    CI2C_LOG (DEBUG, "io_uring: waits end their chains");
+
+  return u;
+
+fail_cq:
+  if (u->cq_ptr != u->sq_ptr)
+    munmap (u->cq_ptr, u->cq_size);
+fail_sq:
+  munmap (u->sq_ptr, u->sq_size);
+fail_ring:
+  close (u->ring_fd);
+  ci2c_free_wipe ((uint8_t *)u, sizeof (struct ci2c_uring));
+
+  return NULL;
+}
+
+int
+ci2c_uring_submit (struct ci2c_uring *u, struct ci2c_uring_op *op)
+{
+  const struct ci2c_transport *t;
+  struct fd_queue *q;
+
+  assert (NULL != u);
+  assert (NULL != op);
+  assert (NULL != op->cmd);
+  assert (NULL != op->rsp);
+  assert (0 == ((uintptr_t)op & STEP_MASK));
+
+  if (op->fd < 0 || op->fd >= CI2C_FD_TABLE_CHUNK * CI2C_FD_TABLE_CHUNKS)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+  t = ci2c_transport_get (op->fd);
+
+  if (&ci2c_socketpair_transport != t && &ci2c_i2cdev_transport != t)
+    {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+
+  op->tx_len = ci2c_serialize_command_into (op->cmd, op->tx + 1,
+                                            CI2C_MAX_FRAME_LEN);
+
+  if (0 == op->tx_len || op->rsp_len + CI2C_RSP_OVERHEAD > CI2C_MAX_FRAME_LEN)
+    {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+  if (NULL == (q = ci2c_fd_table_get (&u->queue, op->fd)))
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  op->tx[0] = CI2C_SOCK_OP_WRITE;
+  op->sock = (&ci2c_socketpair_transport == t);
+  op->status = RSP_NAK;
+  op->attempts = 0;
+  op->polls = 0;
+  op->steps = 0;
+  op->outstanding = 0;
+  op->next = NULL;
+  ci2c_now (&op->submitted);
+
+  u->in_flight++;
+
+  if (NULL != q->tail)
+    {
+      q->tail->next = op;
+      q->tail = op;
+    }
+  else
+    {
+      q->head = q->tail = op;
+      start_op (u, op);
+    }
+
+  return 0;
+}
+
+int
+ci2c_uring_run (struct ci2c_uring *u, uint64_t max_wait_usec)
+{
+  struct io_uring_sqe *sqe;
+
+  assert (NULL != u);
+
+  u->completed = 0;
+
+  reap (u);
+
+  if (0 == u->completed && max_wait_usec > 0 && u->in_flight > 0)
+    {
+      if (reserve (u, 1) < 0)
+        return -1;
+
+      /* Fires after max_wait_usec or as soon as anything else
+         completes, whichever comes first */
+      set_ts (u->timer_ts, max_wait_usec);
+      sqe = get_sqe (u, TIMER_DATA);
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (uintptr_t)u->timer_ts;
+      sqe->len = 1;
+      sqe->off = 1;
+
+      if (flush (u, 1) < 0)
+        return -1;
+
+      reap (u);
+    }
+
+  /* Send the next step of everything that just advanced, for every
+     bus, in one go */
+  if (flush (u, 0) < 0)
+    return -1;
+
+  return u->completed;
+}
+
+unsigned int
+ci2c_uring_in_flight (const struct ci2c_uring *u)
+{
+  assert (NULL != u);
+
+  return u->in_flight;
+}
+
+void
+ci2c_uring_stats_get (const struct ci2c_uring *u,
+                      struct ci2c_uring_stats *stats)
+{
+  assert (NULL != u);
+  assert (NULL != stats);
+
+  *stats = u->stats;
+}
+
+void
+ci2c_uring_set_split_waits (struct ci2c_uring *u, bool split)
+{
+  assert (NULL != u);
+
+  u->split_waits = split || !u->chain_waits;
+}
+
+void
+ci2c_uring_free (struct ci2c_uring *u)
+{
+  if (NULL == u)
+    return;
+
+  assert (0 == u->in_flight);
+
+  munmap (u->sqes, u->sqes_size);
+  if (u->cq_ptr != u->sq_ptr)
+    munmap (u->cq_ptr, u->cq_size);
+  munmap (u->sq_ptr, u->sq_size);
+  close (u->ring_fd);
+
+  ci2c_fd_table_free (&u->queue);
+  ci2c_free_wipe ((uint8_t *)u, sizeof (struct ci2c_uring));
+}
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+struct ci2c_uring *
+ci2c_uring_new (unsigned int entries)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+ci2c_uring_submit (struct ci2c_uring *u, struct ci2c_uring_op *op)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+ci2c_uring_run (struct ci2c_uring *u, uint64_t max_wait_usec)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+unsigned int
+ci2c_uring_in_flight (const struct ci2c_uring *u)
+{
+  return 0;
+}
+
+void
+ci2c_uring_stats_get (const struct ci2c_uring *u,
+                      struct ci2c_uring_stats *stats)
+{
+  assert (NULL != stats);
+
+  memset (stats, 0, sizeof (*stats));
+}
+
+void
+ci2c_uring_set_split_waits (struct ci2c_uring *u, bool split)
+{
+}
+
+void
+ci2c_uring_free (struct ci2c_uring *u)
+{
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
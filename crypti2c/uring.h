@@ -0,0 +1,181 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "command_adaptation.h"
+#include "retry.h"
+
+#define CI2C_URING_DEFAULT_ENTRIES 64
+
+struct ci2c_uring;
+struct ci2c_uring_op;
+
+typedef void (*ci2c_uring_cb) (struct ci2c_uring_op *op, void *arg);
+
+/**
+ * A command driven by the io_uring engine.  The caller owns it and
+ * fills in the fields up to cb_arg; the op must stay valid until it
+ * completes.  The device is expected to be awake: the engine resends
+ * on RSP_AWAKE and on CRC failures as the retry policy allows, but
+ * never wakes the device itself.
+ */
+struct ci2c_uring_op
+{
+  int fd;                       /**< An i2c-dev or socketpair bus */
+  int addr;                     /**< Slave address, -1 keeps the current */
+  struct Command_ATSHA204 *cmd;
+  uint8_t *rsp;
+  unsigned int rsp_len;
+  ci2c_uring_cb cb;             /**< Called on completion, may be NULL */
+  void *cb_arg;
+
+  /* Filled in by the engine */
+  enum CI2C_STATUS_RESPONSE status;
+  unsigned int attempts;        /**< Sends */
+  unsigned int polls;           /**< NAKed reads */
+  struct timespec submitted;
+  struct timespec completed;
+
+  /* Internal */
+  struct ci2c_uring_op *next;
+  bool sock;
+  bool learn;
+  uint8_t opcode;
+  unsigned int steps;           /**< Steps of the chain in flight */
+  unsigned int resume;          /**< Step to continue from, 0 if none */
+  unsigned int outstanding;
+  int res[6];
+  int64_t backoff_ts[2];        /**< struct __kernel_timespec */
+  int64_t wait_ts[2];
+  struct ci2c_retry_policy policy;
+  struct timespec deadline;
+  struct timespec sent_at;
+  uint64_t first_wait_usec;
+  uint64_t poll_usec;
+  uint64_t backoff_usec;        /**< Of the chain in flight */
+  uint64_t wait_usec;
+  unsigned int tx_len;
+  uint8_t wstatus;
+  uint8_t rpkt[3];
+  uint8_t tx[1 + CI2C_MAX_FRAME_LEN];
+  uint8_t rx[1 + CI2C_MAX_FRAME_LEN];
+};
+
+/* Submission batching, across the life of an engine */
+struct ci2c_uring_stats
+{
+  unsigned long enters;         /**< io_uring_enter calls that submitted */
+  unsigned long sqes;           /**< Submission entries */
+  unsigned long cqes;           /**< Completion entries reaped */
+  unsigned long max_batch;      /**< Most entries in one enter */
+  unsigned long batch_hist[5];  /**< Entries per enter: 1, 2-3, 4-7,
+                                   8-15, 16 or more */
+  unsigned long ops;            /**< Commands completed */
+  unsigned long resends;
+  unsigned long polls;
+  unsigned long timeouts;
+};
+
+/**
+ * Creates an engine that runs commands on any number of buses from a
+ * single thread.  Every command becomes one linked chain of
+ * submissions, write, execution time wait and read, so the ring
+ * carries work for all buses in each system call.  Only the thread
+ * that created the engine may use it.
+ *
+ * @param entries The submission queue size, 0 for the default
+ *
+ * @return The engine, NULL with errno set if io_uring is unavailable
+ */
+struct ci2c_uring *
+ci2c_uring_new (unsigned int entries);
+
+/**
+ * Queues a command.  Commands on the same bus run in order, one at a
+ * time; commands on different buses run concurrently.  Nothing is
+ * sent until the next ci2c_uring_run.
+ *
+ * @param u The engine
+ * @param op The command
+ *
+ * @return 0 on success, -1 with errno set if the bus isn't an
+ * i2c-dev or socketpair descriptor or the command doesn't fit a frame
+ */
+int
+ci2c_uring_submit (struct ci2c_uring *u, struct ci2c_uring_op *op);
+
+/**
+ * Submits queued work, waits up to max_wait_usec for something to
+ * complete and processes every completion, advancing each command.
+ *
+ * @param u The engine
+ * @param max_wait_usec How long to wait, 0 to only poll
+ *
+ * @return The number of commands completed, -1 on error
+ */
+int
+ci2c_uring_run (struct ci2c_uring *u, uint64_t max_wait_usec);
+
+/**
+ * Returns the number of commands submitted and not yet complete.
+ *
+ * @param u The engine
+ */
+unsigned int
+ci2c_uring_in_flight (const struct ci2c_uring *u);
+
+/**
+ * Copies out the batching statistics.
+ *
+ * @param u The engine
+ * @param stats Filled in with the statistics
+ */
+void
+ci2c_uring_stats_get (const struct ci2c_uring *u,
+                      struct ci2c_uring_stats *stats);
+
+/**
+ * Makes every execution time wait and backoff end its chain, with the
+ * rest of the command submitted when the wait completes.  That is what
+ * the engine does by itself on kernels whose timeouts can't continue
+ * a chain; forcing it lets the fallback run anywhere.  Commands
+ * already in flight keep the chains they were given.
+ *
+ * @param u The engine
+ * @param split True to split chains at waits, false to go back to
+ * what the kernel supports
+ */
+void
+ci2c_uring_set_split_waits (struct ci2c_uring *u, bool split);
+
+/**
+ * Frees the engine.  Every command must have completed.
+ *
+ * @param u The engine
+ */
+void
+ci2c_uring_free (struct ci2c_uring *u);
+
+#endif /* URING_H */
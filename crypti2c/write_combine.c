@@ -0,0 +1,237 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "write_combine.h"
+#include <assert.h>
+#include <string.h>
+#include "timing.h"
+#include "util.h"
+
+#define ZONE_MASK 0x03
+#define ADDR_WORD_MASK 0x07
+
+static uint16_t
+command_addr (const struct Command_ATSHA204 *c)
+{
+  return c->param2[0] | (c->param2[1] << 8);
+}
+
+static struct ci2c_write_block *
+find (struct ci2c_write_buffer *wb, uint8_t zone, uint16_t addr)
+{
+  unsigned int x;
+
+  addr &= ~ADDR_WORD_MASK;
+
+  for (x = 0; x < CI2C_WRITE_BUFFER_BLOCKS; x++)
+    if (wb->blocks[x].used && wb->blocks[x].zone == zone
+        && wb->blocks[x].addr == addr)
+      return &wb->blocks[x];
+
+  return NULL;
+}
+
+void
+ci2c_write_buffer_init (struct ci2c_write_buffer *wb, uint64_t hold_usec)
+{
+  assert (NULL != wb);
+
+  memset (wb, 0, sizeof (*wb));
+  wb->hold_usec = hold_usec;
+}
+
+bool
+ci2c_write_buffer_accepts (const struct Command_ATSHA204 *c)
+{
+  uint8_t zone;
+  unsigned int len;
+
+  assert (NULL != c);
+
+  if (CI2C_OP_WRITE != c->opcode)
+    return false;
+
+  zone = c->param1 & ZONE_MASK;
+  len = (c->param1 & CI2C_ZONE_BLOCK) ? CI2C_BLOCK_LEN : CI2C_WORD_LEN;
+
+  /* An encrypted Write has its MAC after the data and a bit in
+     param1 */
+  return (CI2C_ZONE_OTP == zone || CI2C_ZONE_DATA == zone)
+    && c->data_len == len && NULL != c->data
+    && 0 == (c->param1 & ~(ZONE_MASK | CI2C_ZONE_BLOCK));
+}
+
+int
+ci2c_write_buffer_add (struct ci2c_write_buffer *wb,
+                       const struct Command_ATSHA204 *c)
+{
+  struct ci2c_write_block *b;
+  uint8_t zone = c->param1 & ZONE_MASK;
+  uint16_t addr = command_addr (c);
+  unsigned int x;
+
+  assert (NULL != wb);
+  assert (ci2c_write_buffer_accepts (c));
+
+  if (NULL != (b = find (wb, zone, addr)))
+    wb->stats.merged++;
+  else
+    {
+      for (x = 0; x < CI2C_WRITE_BUFFER_BLOCKS && wb->blocks[x].used; x++)
+        ;
+
+      if (CI2C_WRITE_BUFFER_BLOCKS == x)
+        return -1;
+
+      b = &wb->blocks[x];
+      memset (b, 0, sizeof (*b));
+      b->used = true;
+      b->zone = zone;
+      b->addr = addr & ~ADDR_WORD_MASK;
+      b->due = ci2c_deadline_after_usec (wb->hold_usec);
+      wb->used++;
+    }
+
+  if (c->param1 & CI2C_ZONE_BLOCK)
+    {
+      memcpy (b->data, c->data, CI2C_BLOCK_LEN);
+      b->dirty = 0xFF;
+    }
+  else
+    {
+      x = addr & ADDR_WORD_MASK;
+      memcpy (&b->data[x * CI2C_WORD_LEN], c->data, CI2C_WORD_LEN);
+      b->dirty |= 1 << x;
+    }
+
+  wb->stats.writes++;
+
+  return 0;
+}
+
+struct ci2c_write_block *
+ci2c_write_buffer_conflict (struct ci2c_write_buffer *wb,
+                            const struct Command_ATSHA204 *c)
+{
+  assert (NULL != wb);
+  assert (NULL != c);
+
+  if (CI2C_OP_READ != c->opcode || 0 == wb->used)
+    return NULL;
+
+  /* A word Read only needs its block flushed if its word is pending,
+     but flushing the whole block costs no more than flushing the
+     word */
+  return find (wb, c->param1 & ZONE_MASK, command_addr (c));
+}
+
+struct ci2c_write_block *
+ci2c_write_buffer_oldest (struct ci2c_write_buffer *wb)
+{
+  struct ci2c_write_block *oldest = NULL;
+  unsigned int x;
+
+  assert (NULL != wb);
+
+  for (x = 0; x < CI2C_WRITE_BUFFER_BLOCKS; x++)
+    if (wb->blocks[x].used
+        && (NULL == oldest
+            || ci2c_timespec_cmp (wb->blocks[x].due, oldest->due) < 0))
+      oldest = &wb->blocks[x];
+
+  return oldest;
+}
+
+void
+ci2c_write_buffer_remove (struct ci2c_write_buffer *wb,
+                          struct ci2c_write_block *b)
+{
+  assert (NULL != wb);
+  assert (NULL != b && b->used);
+
+  ci2c_wipe (b->data, sizeof (b->data));
+  b->used = false;
+  wb->used--;
+}
+
+static struct ci2c_write_failure *
+find_failure (struct ci2c_write_buffer *wb, uint8_t zone, uint16_t addr)
+{
+  unsigned int x;
+
+  addr &= ~ADDR_WORD_MASK;
+
+  for (x = 0; x < CI2C_WRITE_BUFFER_BLOCKS; x++)
+    if (wb->failed[x].used && wb->failed[x].zone == zone
+        && wb->failed[x].addr == addr)
+      return &wb->failed[x];
+
+  return NULL;
+}
+
+void
+ci2c_write_buffer_fail (struct ci2c_write_buffer *wb,
+                        const struct ci2c_write_block *b,
+                        enum CI2C_STATUS_RESPONSE status)
+{
+  unsigned int x;
+
+  assert (NULL != wb);
+  assert (NULL != b && b->used);
+
+  if (RSP_SUCCESS == status || NULL != find_failure (wb, b->zone, b->addr))
+    return;
+
+  for (x = 0; x < CI2C_WRITE_BUFFER_BLOCKS; x++)
+    if (!wb->failed[x].used)
+      {
+        wb->failed[x].used = true;
+        wb->failed[x].zone = b->zone;
+        wb->failed[x].addr = b->addr;
+        wb->failed[x].status = status;
+        return;
+      }
+}
+
+enum CI2C_STATUS_RESPONSE
+ci2c_write_buffer_take_failure (struct ci2c_write_buffer *wb,
+                                const struct Command_ATSHA204 *c)
+{
+  struct ci2c_write_failure *f;
+
+  assert (NULL != wb);
+  assert (NULL != c);
+
+  if (NULL == (f = find_failure (wb, c->param1 & ZONE_MASK,
+                                 command_addr (c))))
+    return RSP_SUCCESS;
+
+  f->used = false;
+
+  return f->status;
+}
+
+void
+ci2c_write_buffer_clear_failures (struct ci2c_write_buffer *wb)
+{
+  assert (NULL != wb);
+
+  memset (wb->failed, 0, sizeof (wb->failed));
+}
@@ -0,0 +1,184 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WRITE_COMBINE_H
+#define WRITE_COMBINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "catalog.h"
+#include "command_adaptation.h"
+
+/* Blocks that can be pending at once */
+#define CI2C_WRITE_BUFFER_BLOCKS 16
+
+/* How long a write may stay pending by default */
+#define CI2C_WRITE_BUFFER_DEFAULT_USEC 20000
+
+struct ci2c_write_buffer_stats
+{
+  unsigned long writes;         /**< Writes accepted */
+  unsigned long merged;         /**< Accepted into an already pending
+                                   block */
+  unsigned long block_writes;   /**< 32 byte Writes sent */
+  unsigned long word_writes;    /**< 4 byte Writes sent */
+  unsigned long read_merges;    /**< Blocks read to fill in the words
+                                   that weren't written */
+  unsigned long deadline_flushes; /**< Blocks flushed for age */
+  unsigned long conflict_flushes; /**< Blocks flushed for a command
+                                     that needed them */
+  unsigned long failures;       /**< Flushed Writes that failed */
+};
+
+/* A block with pending writes */
+struct ci2c_write_block
+{
+  bool used;
+  uint8_t zone;
+  uint16_t addr;                /**< Word address of the block start */
+  uint8_t dirty;                /**< One bit per word */
+  uint8_t data[CI2C_BLOCK_LEN];
+  struct timespec due;          /**< When it must be flushed */
+};
+
+/* A block whose flush failed where no caller could be told */
+struct ci2c_write_failure
+{
+  bool used;
+  uint8_t zone;
+  uint16_t addr;                /**< Word address of the block start */
+  enum CI2C_STATUS_RESPONSE status;
+};
+
+/**
+ * Plain Writes to the OTP and data zones, gathered per 32 byte block.
+ * Just the bookkeeping; the owner sends the blocks and serializes
+ * access.
+ */
+struct ci2c_write_buffer
+{
+  struct ci2c_write_block blocks[CI2C_WRITE_BUFFER_BLOCKS];
+  struct ci2c_write_failure failed[CI2C_WRITE_BUFFER_BLOCKS];
+  unsigned int used;
+  uint64_t hold_usec;
+  struct ci2c_write_buffer_stats stats;
+};
+
+/**
+ * Initializes an empty buffer.
+ *
+ * @param wb The buffer
+ * @param hold_usec How long a write may stay pending
+ */
+void
+ci2c_write_buffer_init (struct ci2c_write_buffer *wb, uint64_t hold_usec);
+
+/**
+ * Tells whether a command is a Write the buffer can hold: a clear
+ * text word or block Write to the OTP or data zone.  Encrypted
+ * Writes, which carry a MAC, aren't.
+ *
+ * @param c The command
+ */
+bool
+ci2c_write_buffer_accepts (const struct Command_ATSHA204 *c);
+
+/**
+ * Adds a Write.
+ *
+ * @param wb The buffer
+ * @param c A command ci2c_write_buffer_accepts
+ *
+ * @return 0 on success, -1 if a new block is needed and none is free
+ */
+int
+ci2c_write_buffer_add (struct ci2c_write_buffer *wb,
+                       const struct Command_ATSHA204 *c);
+
+/**
+ * Finds the pending block a Read needs.
+ *
+ * @param wb The buffer
+ * @param c The command
+ *
+ * @return The block, or NULL if c isn't a Read or nothing it covers
+ * is pending
+ */
+struct ci2c_write_block *
+ci2c_write_buffer_conflict (struct ci2c_write_buffer *wb,
+                            const struct Command_ATSHA204 *c);
+
+/**
+ * Returns the block due soonest.
+ *
+ * @param wb The buffer
+ *
+ * @return The block, or NULL if none is pending
+ */
+struct ci2c_write_block *
+ci2c_write_buffer_oldest (struct ci2c_write_buffer *wb);
+
+/**
+ * Forgets a block once it has been sent.
+ *
+ * @param wb The buffer
+ * @param b The block
+ */
+void
+ci2c_write_buffer_remove (struct ci2c_write_buffer *wb,
+                          struct ci2c_write_block *b);
+
+/**
+ * Remembers that a block's flush failed, so the next Write to it can
+ * report that.  The first failure per block is kept; when every slot
+ * is taken the failure isn't recorded.
+ *
+ * @param wb The buffer
+ * @param b The block, still pending
+ * @param status The flush status
+ */
+void
+ci2c_write_buffer_fail (struct ci2c_write_buffer *wb,
+                        const struct ci2c_write_block *b,
+                        enum CI2C_STATUS_RESPONSE status);
+
+/**
+ * Returns and forgets the recorded failure of the block a Write
+ * covers.
+ *
+ * @param wb The buffer
+ * @param c A command ci2c_write_buffer_accepts
+ *
+ * @return The failure, or RSP_SUCCESS if none is recorded
+ */
+enum CI2C_STATUS_RESPONSE
+ci2c_write_buffer_take_failure (struct ci2c_write_buffer *wb,
+                                const struct Command_ATSHA204 *c);
+
+/**
+ * Forgets every recorded failure.
+ *
+ * @param wb The buffer
+ */
+void
+ci2c_write_buffer_clear_failures (struct ci2c_write_buffer *wb);
+
+#endif /* WRITE_COMBINE_H */
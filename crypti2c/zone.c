@@ -0,0 +1,318 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "zone.h"
+#include <assert.h>
+#include <string.h>
+#include "batch.h"
+#include "timing.h"
+#include "util.h"
+#include "log.h"
+
+#define ATSHA204_CONFIG_LEN 88
+#define ECC108_CONFIG_LEN 128
+#define OTP_LEN 64
+#define ATSHA204_DATA_LEN 512
+
+#define WORDS_PER_BLOCK (CI2C_BLOCK_LEN / CI2C_WORD_LEN)
+
+/* ECC108 data slots: 0-7 hold 36 bytes, 8 holds 416, 9-15 hold 72 */
+#define ECC108_SLOT_SMALL_LEN 36
+#define ECC108_SLOT_8_LEN 416
+#define ECC108_SLOT_LARGE_LEN 72
+
+/* Config bytes */
+#define CONFIG_OTP_MODE 18
+#define CONFIG_SLOT_CONFIG 20
+#define CONFIG_LOCK_VALUE 86
+#define LOCK_UNLOCKED 0x55
+#define OTP_MODE_LEGACY 0x00
+#define SLOT_IS_SECRET 0x80
+
+/* Word addresses: the word in bits 0-2, the slot (data zone) or
+   block (config and OTP) above it, and on the ECC108 the block of a
+   data slot in bits 8-11 */
+#define ADDR_SLOT_SHIFT 3
+#define ADDR_BLOCK_SHIFT 8
+
+/* Enough for the ECC108 data zone: two Reads for each small slot,
+   13 for slot 8 and four for each large one */
+#define MAX_READS 64
+
+struct dump_plan
+{
+  struct Command_ATSHA204 cmds[MAX_READS];
+  struct ci2c_batch_cmd batch[MAX_READS];
+  unsigned int n;
+  unsigned int blocks;
+  unsigned int words;
+};
+
+unsigned int
+ci2c_zone_len (unsigned int family, uint8_t zone)
+{
+  switch (zone)
+    {
+    case CI2C_ZONE_CONFIG:
+      if (CI2C_FAMILY_ATSHA204 == family)
+        return ATSHA204_CONFIG_LEN;
+      if (CI2C_FAMILY_ECC108 == family)
+        return ECC108_CONFIG_LEN;
+      break;
+    case CI2C_ZONE_OTP:
+      if (CI2C_FAMILY_ATSHA204 == family || CI2C_FAMILY_ECC108 == family)
+        return OTP_LEN;
+      break;
+    case CI2C_ZONE_DATA:
+      if (CI2C_FAMILY_ATSHA204 == family)
+        return ATSHA204_DATA_LEN;
+      if (CI2C_FAMILY_ECC108 == family)
+        return 8 * ECC108_SLOT_SMALL_LEN + ECC108_SLOT_8_LEN
+          + 7 * ECC108_SLOT_LARGE_LEN;
+      break;
+    default:
+      break;
+    }
+
+  return 0;
+}
+
+static void
+plan_read (struct dump_plan *p, uint8_t zone, uint16_t addr,
+           uint8_t *dst, unsigned int len)
+{
+  struct Command_ATSHA204 *c;
+  uint8_t param1 = zone;
+
+  assert (p->n < MAX_READS);
+
+  if (CI2C_BLOCK_LEN == len)
+    {
+      param1 |= CI2C_ZONE_BLOCK;
+      p->blocks++;
+    }
+  else
+    p->words++;
+
+  c = &p->cmds[p->n];
+  ci2c_command_init (c, CI2C_OP_READ, param1, addr, NULL, 0);
+
+  p->batch[p->n].cmd = c;
+  p->batch[p->n].rsp = dst;
+  p->batch[p->n].rsp_len = len;
+  p->n++;
+}
+
+/* Plans len bytes starting at a block boundary: whole blocks, then
+   words for what's left */
+static void
+plan_span (struct dump_plan *p, uint8_t zone, uint16_t (*addr) (int, int),
+           int slot, uint8_t *dst, unsigned int len, bool blocks)
+{
+  unsigned int off;
+
+  for (off = 0; off < len;)
+    {
+      uint16_t a = addr (slot, off / CI2C_WORD_LEN);
+
+      if (blocks && len - off >= CI2C_BLOCK_LEN)
+        {
+          plan_read (p, zone, a, dst + off, CI2C_BLOCK_LEN);
+          off += CI2C_BLOCK_LEN;
+        }
+      else
+        {
+          plan_read (p, zone, a, dst + off, CI2C_WORD_LEN);
+          off += CI2C_WORD_LEN;
+        }
+    }
+}
+
+/* Config, OTP and ATSHA204 data: the word address is the word index */
+static uint16_t
+linear_addr (int slot, int word)
+{
+  return word;
+}
+
+static uint16_t
+ecc108_data_addr (int slot, int word)
+{
+  return ((word / WORDS_PER_BLOCK) << ADDR_BLOCK_SHIFT)
+    | (slot << ADDR_SLOT_SHIFT) | (word % WORDS_PER_BLOCK);
+}
+
+static unsigned int
+ecc108_slot_len (int slot)
+{
+  if (slot < 8)
+    return ECC108_SLOT_SMALL_LEN;
+
+  return (8 == slot) ? ECC108_SLOT_8_LEN : ECC108_SLOT_LARGE_LEN;
+}
+
+static bool
+slot_is_secret (const uint8_t *config, int slot)
+{
+  return 0 != (config[CONFIG_SLOT_CONFIG + 2 * slot] & SLOT_IS_SECRET);
+}
+
+static void
+plan_data (struct dump_plan *p, unsigned int family, const uint8_t *config,
+           uint8_t *buf, uint16_t *unread)
+{
+  unsigned int slot_len = ATSHA204_DATA_LEN / CI2C_SLOTS;
+  int slot;
+
+  for (slot = 0; slot < CI2C_SLOTS; buf += slot_len, slot++)
+    {
+      if (CI2C_FAMILY_ECC108 == family)
+        slot_len = ecc108_slot_len (slot);
+
+      if (slot_is_secret (config, slot))
+        {
+          *unread |= 1 << slot;
+          continue;
+        }
+
+      /* An ATSHA204 slot is one block at word address slot * 8 */
+      if (CI2C_FAMILY_ECC108 == family)
+        plan_span (p, CI2C_ZONE_DATA, ecc108_data_addr, slot, buf,
+                   slot_len, true);
+      else
+        plan_read (p, CI2C_ZONE_DATA, slot << ADDR_SLOT_SHIFT, buf,
+                   CI2C_BLOCK_LEN);
+    }
+}
+
+static int
+run_plan (struct ci2c_session *s, struct dump_plan *p,
+          struct ci2c_zone_dump_stats *stats)
+{
+  struct ci2c_batch_result result;
+  unsigned int completed;
+
+  if (0 == p->n)
+    return 0;
+
+  completed = ci2c_session_process_batch (s, p->batch, p->n, &result);
+
+  stats->blocks += p->blocks;
+  stats->words += p->words;
+  stats->wakes += result.wakes;
+
+  if (completed != p->n)
+    {
+      CI2C_LOG (DEBUG, "Zone dump stopped at read %u of %u, status 0x%02x",
+                completed, p->n, p->batch[completed].status);
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+ci2c_session_dump_zone (struct ci2c_session *s, unsigned int family,
+                        uint8_t zone, const uint8_t *config,
+                        uint8_t *buf, unsigned int len,
+                        struct ci2c_zone_dump_stats *stats)
+{
+  struct ci2c_zone_dump_stats local;
+  struct dump_plan plan;
+  uint8_t own_config[ECC108_CONFIG_LEN];
+  struct timespec start, end;
+  unsigned int zone_len;
+  int rc = -1;
+
+  assert (NULL != s);
+  assert (NULL != buf);
+
+  if (NULL == stats)
+    stats = &local;
+
+  memset (stats, 0, sizeof (*stats));
+  ci2c_now (&start);
+
+  zone_len = ci2c_zone_len (family, zone);
+
+  if (0 == zone_len || len < zone_len)
+    return -1;
+
+  memset (buf, 0, zone_len);
+  memset (&plan, 0, sizeof (plan));
+
+  if (CI2C_ZONE_CONFIG == zone)
+    {
+      plan_span (&plan, zone, linear_addr, 0, buf, zone_len, true);
+      rc = run_plan (s, &plan, stats);
+      goto out;
+    }
+
+  if (NULL == config)
+    {
+      plan_span (&plan, CI2C_ZONE_CONFIG, linear_addr, 0, own_config,
+                 CI2C_ZONE_CONFIG_NEEDED, true);
+
+      if (0 != run_plan (s, &plan, stats))
+        goto out;
+
+      memset (&plan, 0, sizeof (plan));
+      config = own_config;
+    }
+
+  if (LOCK_UNLOCKED == config[CONFIG_LOCK_VALUE])
+    {
+      stats->locked_out = true;
+      rc = 0;
+      goto out;
+    }
+
+  if (CI2C_ZONE_OTP == zone)
+    plan_span (&plan, zone, linear_addr, 0, buf, zone_len,
+               OTP_MODE_LEGACY != config[CONFIG_OTP_MODE]);
+  else
+    plan_data (&plan, family, config, buf, &stats->unread_slots);
+
+  rc = run_plan (s, &plan, stats);
+
+out:
+  ci2c_now (&end);
+  stats->usec = ci2c_timespec_diff_usec (end, start);
+  ci2c_wipe (own_config, sizeof (own_config));
+
+  return (0 == rc) ? (int) zone_len : -1;
+}
+
+int
+ci2c_dump_zone (int fd, unsigned int family, uint8_t zone,
+                const uint8_t *config, uint8_t *buf, unsigned int len,
+                struct ci2c_zone_dump_stats *stats)
+{
+  struct ci2c_session s;
+  int rc;
+
+  ci2c_session_init (&s, fd);
+
+  rc = ci2c_session_dump_zone (&s, family, zone, config, buf, len, stats);
+
+  ci2c_session_release (&s, false);
+
+  return rc;
+}
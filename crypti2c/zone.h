@@ -0,0 +1,100 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "catalog.h"
+#include "session.h"
+
+/* The largest zone, the ECC108 data zone */
+#define CI2C_ZONE_MAX_LEN 1208
+
+/* Config bytes a dump of the OTP or data zone needs, through the
+   lock bytes */
+#define CI2C_ZONE_CONFIG_NEEDED 88
+
+#define CI2C_SLOTS 16
+
+struct ci2c_zone_dump_stats
+{
+  unsigned int blocks;          /**< 32 byte Reads sent */
+  unsigned int words;           /**< 4 byte Reads sent */
+  unsigned int wakes;           /**< Wakes the dump needed */
+  uint16_t unread_slots;        /**< Data slots that can't be read in
+                                   the clear, left zeroed */
+  bool locked_out;              /**< The data zone isn't locked, so
+                                   nothing was read */
+  uint64_t usec;
+};
+
+/**
+ * Returns the length of a zone.
+ *
+ * @param family CI2C_FAMILY_ATSHA204 or CI2C_FAMILY_ECC108
+ * @param zone CI2C_ZONE_CONFIG, CI2C_ZONE_OTP or CI2C_ZONE_DATA
+ *
+ * @return The length in bytes, 0 if either is unknown
+ */
+unsigned int
+ci2c_zone_len (unsigned int family, uint8_t zone);
+
+/**
+ * Reads a whole zone into one buffer inside the session's wake
+ * window.  32 byte Reads are used wherever the zone layout and the
+ * OTP mode allow, 4 byte Reads only for the ragged ends.  Data slots
+ * that can't be read in the clear are zeroed and reported, and the
+ * OTP and data zones read as zeros until the data zone is locked.
+ * The device is left awake.
+ *
+ * @param s The session
+ * @param family CI2C_FAMILY_ATSHA204 or CI2C_FAMILY_ECC108
+ * @param zone The zone
+ * @param config The config zone, at least CI2C_ZONE_CONFIG_NEEDED
+ * bytes, for the OTP and data zones.  NULL reads it first in the same
+ * wake.  Unused for the config zone.
+ * @param buf The buffer
+ * @param len Its length, at least ci2c_zone_len
+ * @param stats Filled in.  May be NULL.
+ *
+ * @return The zone length, or -1 if a Read failed or the zone is
+ * unknown or doesn't fit
+ */
+int
+ci2c_session_dump_zone (struct ci2c_session *s, unsigned int family,
+                        uint8_t zone, const uint8_t *config,
+                        uint8_t *buf, unsigned int len,
+                        struct ci2c_zone_dump_stats *stats);
+
+/**
+ * Wakes the device, dumps a zone and puts the device back to sleep.
+ *
+ * @param fd The open file descriptor with the slave acquired
+ *
+ * @see ci2c_session_dump_zone
+ */
+int
+ci2c_dump_zone (int fd, unsigned int family, uint8_t zone,
+                const uint8_t *config, uint8_t *buf, unsigned int len,
+                struct ci2c_zone_dump_stats *stats);
+
+#endif /* ZONE_H */
@@ -29,6 +29,27 @@
 #include "crypti2c/command_adaptation.h"
 #include "crypti2c/hash.h"
 #include "crypti2c/i2c.h"
+#include "crypti2c/transport.h"
+#include "crypti2c/fd_table.h"
+#include "crypti2c/timing.h"
+#include "crypti2c/session.h"
+#include "crypti2c/queue.h"
+#include "crypti2c/scheduler.h"
+#include "crypti2c/async.h"
+#include "crypti2c/exec_model.h"
+#include "crypti2c/batch.h"
+#include "crypti2c/retry.h"
+#include "crypti2c/catalog.h"
+#include "crypti2c/uring.h"
+#include "crypti2c/pool.h"
+#include "crypti2c/deadline.h"
+#include "crypti2c/mux.h"
+#include "crypti2c/discover.h"
+#include "crypti2c/device.h"
+#include "crypti2c/random_pool.h"
+#include "crypti2c/read_cache.h"
+#include "crypti2c/zone.h"
+#include "crypti2c/write_combine.h"
 #include "crypti2c/ecdsa.h"
 
 #endif // LIBCRYPTI2C_H_
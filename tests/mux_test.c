@@ -0,0 +1,270 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Drives mux channel switching against a simulated PCA9548 with
+   emulated devices behind it, directly and through the scheduler */
+
+#include <stdio.h>
+#include <string.h>
+#include "crypti2c/catalog.h"
+#include "crypti2c/i2c.h"
+#include "crypti2c/mux.h"
+#include "crypti2c/scheduler.h"
+#include "crypti2c/timing.h"
+#include "crypti2c/transport.h"
+
+#define MUX_ADDR 0x70
+#define DEV_ADDR 0x64
+#define ROOT_ADDR 0x60
+#define CHANNELS 4
+#define JOBS 100
+#define EXEC_USEC 1000
+
+#define CHECK(expr)                                                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(expr))                                                      \
+        {                                                               \
+          fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,    \
+                   #expr);                                              \
+          failed = 1;                                                   \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+static int failed;
+
+/* The bus behind the mux.  A write to fail_addr is NAKed once. */
+static struct ci2c_mem_device inner;
+static int fail_addr = -1;
+
+static ssize_t
+bus_write (void *arg, int addr, const uint8_t *buf, unsigned int len)
+{
+  if (addr == fail_addr)
+    {
+      fail_addr = -1;
+      return -1;
+    }
+
+  return inner.write (inner.arg, addr, buf, len);
+}
+
+static ssize_t
+bus_read (void *arg, int addr, uint8_t *buf, unsigned int len)
+{
+  return inner.read (inner.arg, addr, buf, len);
+}
+
+static int
+bus_open (struct ci2c_mux_sim *mux)
+{
+  static struct ci2c_mem_device dev = { bus_write, bus_read, NULL };
+
+  inner = ci2c_mux_sim_device (mux);
+  fail_addr = -1;
+
+  return ci2c_transport_open (&ci2c_mem_transport, NULL, &dev);
+}
+
+static int
+route (int mux_addr, int channel, int addr)
+{
+  struct ci2c_mux_route r;
+
+  r.mux_addr = mux_addr;
+  r.channel = channel;
+  r.addr = addr;
+
+  return ci2c_mux_encode (&r);
+}
+
+/* Jobs for devices with the same address on different channels, run
+   interleaved by the scheduler, reach the right device without two
+   ever answering at once, and are regrouped to save channel switches */
+static void
+test_grouping (void)
+{
+  static struct ci2c_mux_sim mux;
+  static struct ci2c_emulator emu[CHANNELS + 1];
+  static struct ci2c_job jobs[JOBS];
+  static uint8_t rsp[JOBS][32];
+  struct ci2c_mem_device dev;
+  struct ci2c_mux_stats stats;
+  struct Command_ATSHA204 cmd;
+  struct ci2c_sched *sched;
+  int addrs[CHANNELS + 1];
+  int fd;
+  unsigned int x;
+
+  ci2c_mux_sim_init (&mux, MUX_ADDR);
+
+  for (x = 0; x <= CHANNELS; x++)
+    {
+      ci2c_emulator_init (&emu[x]);
+      emu[x].busy_usec = EXEC_USEC;
+      dev = ci2c_emulator_device (&emu[x]);
+
+      /* The last device is on the root segment */
+      if (x < CHANNELS)
+        {
+          CHECK (0 == ci2c_mux_sim_attach (&mux, x, DEV_ADDR, &dev));
+          addrs[x] = route (MUX_ADDR, x, DEV_ADDR);
+        }
+      else
+        {
+          CHECK (0 == ci2c_mux_sim_attach (&mux, -1, ROOT_ADDR, &dev));
+          addrs[x] = route (CI2C_MUX_NONE, 0, ROOT_ADDR);
+        }
+    }
+
+  ci2c_command_init (&cmd, CI2C_OP_RANDOM, 0, 0, NULL, 0);
+  cmd.exec_time = ci2c_usec_to_timespec (EXEC_USEC);
+
+  sched = ci2c_sched_new ();
+  CHECK ((fd = bus_open (&mux)) >= 0);
+  CHECK (0 == ci2c_sched_add_fd (sched, fd));
+
+  memset (jobs, 0, sizeof (jobs));
+
+  for (x = 0; x < JOBS; x++)
+    {
+      jobs[x].addr = addrs[x % (CHANNELS + 1)];
+      jobs[x].cmd = &cmd;
+      jobs[x].rsp = rsp[x];
+      jobs[x].rsp_len = 32;
+      CHECK (0 == ci2c_sched_submit (sched, 0, &jobs[x]));
+    }
+
+  for (x = 0; x < JOBS; x++)
+    CHECK (RSP_SUCCESS == ci2c_job_wait (sched, &jobs[x]));
+
+  CHECK (0 == ci2c_sched_mux_stats (sched, 0, &stats));
+  CHECK (stats.regrouped > 0);
+  CHECK (stats.saved > 0);
+  CHECK (stats.selects < JOBS);
+
+  ci2c_sched_free (sched);
+
+  for (x = 0; x <= CHANNELS; x++)
+    CHECK (JOBS / (CHANNELS + 1) == emu[x].commands);
+
+  CHECK (0 == mux.clashes);
+}
+
+/* The simulator counts devices answering together, and selecting a
+   channel through the mux code leaves only one enabled */
+static void
+test_clashes (void)
+{
+  static struct ci2c_mux_sim mux;
+  static struct ci2c_emulator emu[2];
+  struct ci2c_mem_device dev;
+  struct ci2c_mux_state state;
+  uint8_t both = 0x03;
+  unsigned long clashes;
+  unsigned int x;
+  int fd;
+
+  ci2c_mux_sim_init (&mux, MUX_ADDR);
+
+  for (x = 0; x < 2; x++)
+    {
+      ci2c_emulator_init (&emu[x]);
+      dev = ci2c_emulator_device (&emu[x]);
+      CHECK (0 == ci2c_mux_sim_attach (&mux, x, DEV_ADDR, &dev));
+    }
+
+  CHECK ((fd = bus_open (&mux)) >= 0);
+
+  /* Both channels on by hand: both devices wake */
+  CHECK (0 == ci2c_acquire_bus (fd, MUX_ADDR));
+  CHECK (1 == ci2c_write (fd, &both, sizeof (both)));
+  CHECK (0 == ci2c_acquire_bus (fd, DEV_ADDR));
+  ci2c_wakeup (fd);
+  CHECK (mux.clashes > 0);
+  CHECK (1 == emu[0].wakes && 1 == emu[1].wakes);
+
+  ci2c_sleep_device (fd);
+  clashes = mux.clashes;
+
+  ci2c_mux_state_init (&state, -1);
+  CHECK (0 == ci2c_mux_acquire (fd, &state, route (MUX_ADDR, 1, DEV_ADDR)));
+  CHECK (0x02 == mux.enabled);
+  CHECK (ci2c_wakeup (fd));
+  CHECK (clashes == mux.clashes);
+  CHECK (1 == emu[0].wakes && 2 == emu[1].wakes);
+  CHECK (1 == state.stats.selects);
+
+  ci2c_transport_close (fd);
+}
+
+/* After a failed mux write which mux is on isn't known, so the next
+   acquire turns off every mux the bus ever selected */
+static void
+test_recovery (void)
+{
+  static struct ci2c_mux_sim mux;
+  static struct ci2c_emulator emu[2];
+  struct ci2c_mem_device dev;
+  struct ci2c_mux_state state;
+  int fd;
+
+  ci2c_mux_sim_init (&mux, MUX_ADDR);
+  ci2c_emulator_init (&emu[0]);
+  ci2c_emulator_init (&emu[1]);
+  dev = ci2c_emulator_device (&emu[0]);
+  CHECK (0 == ci2c_mux_sim_attach (&mux, 2, ROOT_ADDR, &dev));
+  dev = ci2c_emulator_device (&emu[1]);
+  CHECK (0 == ci2c_mux_sim_attach (&mux, -1, ROOT_ADDR, &dev));
+
+  CHECK ((fd = bus_open (&mux)) >= 0);
+  ci2c_mux_state_init (&state, -1);
+
+  CHECK (0 == ci2c_mux_acquire (fd, &state, route (MUX_ADDR, 2, ROOT_ADDR)));
+  CHECK (0x04 == mux.enabled);
+
+  /* Switching to channel 3 fails with channel 2 still on */
+  fail_addr = MUX_ADDR;
+  CHECK (ci2c_mux_acquire (fd, &state, route (MUX_ADDR, 3, ROOT_ADDR)) < 0);
+  CHECK (0x04 == mux.enabled);
+
+  /* Going to the root segment has to turn the mux off first */
+  CHECK (0 == ci2c_mux_acquire (fd, &state,
+                                route (CI2C_MUX_NONE, 0, ROOT_ADDR)));
+  CHECK (0 == mux.enabled);
+  CHECK (1 == state.stats.deselects);
+
+  CHECK (ci2c_wakeup (fd));
+  CHECK (0 == mux.clashes);
+  CHECK (0 == emu[0].wakes && 1 == emu[1].wakes);
+
+  ci2c_transport_close (fd);
+}
+
+int
+main (void)
+{
+  test_grouping ();
+  test_clashes ();
+  test_recovery ();
+
+  return failed;
+}
@@ -0,0 +1,387 @@
+/* -*- mode: c; c-file-style: "gnu" -*-
+ * Copyright (C) 2014 Cryptotronix, LLC.
+ *
+ * This file is part of libcrypti2c.
+ *
+ * libcrypti2c is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcrypti2c is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libcrypti2c.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Drives the io_uring engine against emulated devices on socketpair
+   buses.  Exits 77, which automake reads as skipped, where io_uring
+   isn't available. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "crypti2c/catalog.h"
+#include "crypti2c/i2c.h"
+#include "crypti2c/timing.h"
+#include "crypti2c/transport.h"
+#include "crypti2c/uring.h"
+
+#define BUSES 3
+#define OPS_PER_BUS 10
+#define DEV_ADDR 0x64
+#define EXEC_USEC 1000
+
+#define CHECK(expr)                                                     \
+  do                                                                    \
+    {                                                                   \
+      if (!(expr))                                                      \
+        {                                                               \
+          fprintf (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,    \
+                   #expr);                                              \
+          failed = 1;                                                   \
+        }                                                               \
+    }                                                                   \
+  while (0)
+
+static int failed;
+
+/* An emulated device on its own socketpair bus.  The first
+   fail_writes commands written to it are NAKed. */
+struct bus
+{
+  int fd;
+  int peer;
+  pthread_t thread;
+  struct ci2c_emulator emu;
+  struct ci2c_mem_device dev;
+  unsigned int fail_writes;
+};
+
+static unsigned int
+respond (void *arg, const uint8_t *frame, unsigned int len,
+         uint8_t *payload, unsigned int max)
+{
+  unsigned int x;
+
+  for (x = 0; x < 32; x++)
+    payload[x] = x;
+
+  return 32;
+}
+
+static ssize_t
+bus_write (void *arg, int addr, const uint8_t *buf, unsigned int len)
+{
+  struct bus *b = arg;
+  struct ci2c_mem_device emu_dev = ci2c_emulator_device (&b->emu);
+
+  if (len > 0 && CI2C_WORD_ADDR_COMMAND == buf[0] && b->fail_writes > 0)
+    {
+      b->fail_writes--;
+      return -1;
+    }
+
+  return emu_dev.write (emu_dev.arg, addr, buf, len);
+}
+
+static ssize_t
+bus_read (void *arg, int addr, uint8_t *buf, unsigned int len)
+{
+  struct bus *b = arg;
+  struct ci2c_mem_device emu_dev = ci2c_emulator_device (&b->emu);
+
+  return emu_dev.read (emu_dev.arg, addr, buf, len);
+}
+
+static void *
+serve (void *arg)
+{
+  struct bus *b = arg;
+
+  ci2c_socketpair_serve (b->peer, &b->dev);
+
+  return NULL;
+}
+
+static int
+bus_open (struct bus *b, unsigned int busy_reads, unsigned int busy_usec)
+{
+  memset (b, 0, sizeof (*b));
+  ci2c_emulator_init (&b->emu);
+  b->emu.respond = respond;
+  b->emu.busy_reads = busy_reads;
+  b->emu.busy_usec = busy_usec;
+  b->dev.write = bus_write;
+  b->dev.read = bus_read;
+  b->dev.arg = b;
+
+  if ((b->fd = ci2c_transport_open (&ci2c_socketpair_transport, NULL,
+                                    &b->peer)) < 0)
+    return -1;
+
+  if (0 != pthread_create (&b->thread, NULL, serve, b))
+    return -1;
+
+  if (ci2c_acquire_bus (b->fd, DEV_ADDR) < 0)
+    return -1;
+
+  return ci2c_wakeup (b->fd) ? 0 : -1;
+}
+
+static void
+bus_close (struct bus *b)
+{
+  ci2c_transport_close (b->fd);
+  pthread_join (b->thread, NULL);
+}
+
+static void
+op_init (struct ci2c_uring_op *op, int fd, struct Command_ATSHA204 *cmd,
+         uint8_t *rsp, ci2c_uring_cb cb, void *cb_arg)
+{
+  memset (op, 0, sizeof (*op));
+  op->fd = fd;
+  op->addr = -1;
+  op->cmd = cmd;
+  op->rsp = rsp;
+  op->rsp_len = 32;
+  op->cb = cb;
+  op->cb_arg = cb_arg;
+}
+
+static void
+random_cmd (struct Command_ATSHA204 *cmd)
+{
+  ci2c_command_init (cmd, CI2C_OP_RANDOM, 0, 0, NULL, 0);
+  cmd->exec_time = ci2c_usec_to_timespec (EXEC_USEC);
+}
+
+static bool
+rsp_ok (const uint8_t *rsp)
+{
+  unsigned int x;
+
+  for (x = 0; x < 32; x++)
+    if (rsp[x] != x)
+      return false;
+
+  return true;
+}
+
+/* Runs the engine until nothing is in flight, or gives up */
+static void
+run_all (struct ci2c_uring *u)
+{
+  unsigned int rounds;
+
+  for (rounds = 0; rounds < 1000 && ci2c_uring_in_flight (u) > 0; rounds++)
+    CHECK (ci2c_uring_run (u, 100000) >= 0);
+
+  CHECK (0 == ci2c_uring_in_flight (u));
+}
+
+/* Commands on several buses at once, with execution time waits that
+   fall short so that every command also polls */
+static void
+test_chains (bool split)
+{
+  static struct bus buses[BUSES];
+  static struct ci2c_uring_op ops[BUSES][OPS_PER_BUS];
+  static uint8_t rsp[BUSES][OPS_PER_BUS][32];
+  struct Command_ATSHA204 cmd;
+  struct ci2c_uring_stats stats;
+  struct ci2c_uring *u;
+  unsigned int b, x;
+
+  CHECK (NULL != (u = ci2c_uring_new (0)));
+  ci2c_uring_set_split_waits (u, split);
+  random_cmd (&cmd);
+
+  for (b = 0; b < BUSES; b++)
+    CHECK (0 == bus_open (&buses[b], 1, 2 * EXEC_USEC));
+
+  for (b = 0; b < BUSES; b++)
+    for (x = 0; x < OPS_PER_BUS; x++)
+      {
+        op_init (&ops[b][x], buses[b].fd, &cmd, rsp[b][x], NULL, NULL);
+        CHECK (0 == ci2c_uring_submit (u, &ops[b][x]));
+      }
+
+  run_all (u);
+
+  for (b = 0; b < BUSES; b++)
+    for (x = 0; x < OPS_PER_BUS; x++)
+      {
+        CHECK (RSP_SUCCESS == ops[b][x].status);
+        CHECK (1 == ops[b][x].attempts);
+        CHECK (ops[b][x].polls > 0);
+        CHECK (rsp_ok (rsp[b][x]));
+      }
+
+  ci2c_uring_stats_get (u, &stats);
+  CHECK (BUSES * OPS_PER_BUS == stats.ops);
+  CHECK (0 == stats.resends);
+  CHECK (0 == stats.timeouts);
+
+  ci2c_uring_free (u);
+
+  for (b = 0; b < BUSES; b++)
+    {
+      bus_close (&buses[b]);
+      CHECK (OPS_PER_BUS == buses[b].emu.commands);
+    }
+}
+
+/* A NAKed write is sent again */
+static void
+test_resend (void)
+{
+  static struct bus bus;
+  struct ci2c_uring_op op;
+  struct Command_ATSHA204 cmd;
+  struct ci2c_uring_stats stats;
+  struct ci2c_uring *u;
+  uint8_t rsp[32];
+
+  CHECK (NULL != (u = ci2c_uring_new (0)));
+  random_cmd (&cmd);
+  CHECK (0 == bus_open (&bus, 0, 0));
+  bus.fail_writes = 2;
+
+  op_init (&op, bus.fd, &cmd, rsp, NULL, NULL);
+  CHECK (0 == ci2c_uring_submit (u, &op));
+  run_all (u);
+
+  CHECK (RSP_SUCCESS == op.status);
+  CHECK (3 == op.attempts);
+  CHECK (rsp_ok (rsp));
+
+  ci2c_uring_stats_get (u, &stats);
+  CHECK (2 == stats.resends);
+
+  ci2c_uring_free (u);
+  bus_close (&bus);
+  CHECK (1 == bus.emu.commands);
+}
+
+/* A device that NAKs reads while it executes is polled until it
+   answers, without resending */
+static void
+test_nak_polling (void)
+{
+  static struct bus bus;
+  struct ci2c_uring_op op;
+  struct Command_ATSHA204 cmd;
+  struct ci2c_uring *u;
+  uint8_t rsp[32];
+
+  CHECK (NULL != (u = ci2c_uring_new (0)));
+  random_cmd (&cmd);
+  CHECK (0 == bus_open (&bus, 5, 0));
+
+  op_init (&op, bus.fd, &cmd, rsp, NULL, NULL);
+  CHECK (0 == ci2c_uring_submit (u, &op));
+  run_all (u);
+
+  CHECK (RSP_SUCCESS == op.status);
+  CHECK (1 == op.attempts);
+  CHECK (5 == op.polls);
+  CHECK (rsp_ok (rsp));
+
+  ci2c_uring_free (u);
+  bus_close (&bus);
+  CHECK (5 == bus.emu.naks);
+}
+
+/* Callbacks that submit more work, to their own bus once its queue
+   has emptied and to another bus that has nothing queued */
+struct chain
+{
+  struct ci2c_uring *u;
+  struct ci2c_uring_op ops[2][OPS_PER_BUS];
+  int fds[2];
+  unsigned int next[2];
+  uint8_t rsp[32];
+};
+
+static void
+chain_cb (struct ci2c_uring_op *op, void *arg)
+{
+  struct chain *c = arg;
+  unsigned int b = (op->fd == c->fds[0]) ? 1 : 0;
+  struct ci2c_uring_op *next;
+
+  if (c->next[b] >= OPS_PER_BUS)
+    return;
+
+  next = &c->ops[b][c->next[b]++];
+  op_init (next, c->fds[b], op->cmd, c->rsp, chain_cb, c);
+  CHECK (0 == ci2c_uring_submit (c->u, next));
+}
+
+static void
+test_callback_submit (void)
+{
+  static struct bus buses[2];
+  static struct chain c;
+  struct Command_ATSHA204 cmd;
+  unsigned int b, x;
+
+  memset (&c, 0, sizeof (c));
+  CHECK (NULL != (c.u = ci2c_uring_new (0)));
+  random_cmd (&cmd);
+
+  for (b = 0; b < 2; b++)
+    {
+      CHECK (0 == bus_open (&buses[b], 1, 0));
+      c.fds[b] = buses[b].fd;
+    }
+
+  op_init (&c.ops[0][0], c.fds[0], &cmd, c.rsp, chain_cb, &c);
+  c.next[0] = 1;
+  CHECK (0 == ci2c_uring_submit (c.u, &c.ops[0][0]));
+  run_all (c.u);
+
+  for (b = 0; b < 2; b++)
+    {
+      CHECK (OPS_PER_BUS == c.next[b]);
+
+      for (x = 0; x < OPS_PER_BUS; x++)
+        CHECK (RSP_SUCCESS == c.ops[b][x].status);
+    }
+
+  ci2c_uring_free (c.u);
+
+  for (b = 0; b < 2; b++)
+    {
+      bus_close (&buses[b]);
+      CHECK (OPS_PER_BUS == buses[b].emu.commands);
+    }
+}
+
+int
+main (void)
+{
+  struct ci2c_uring *u;
+
+  if (NULL == (u = ci2c_uring_new (0)))
+    {
+      perror ("ci2c_uring_new");
+      return 77;
+    }
+
+  ci2c_uring_free (u);
+
+  test_chains (false);
+  test_chains (true);
+  test_resend ();
+  test_nak_polling ();
+  test_callback_submit ();
+
+  return failed;
+}